@@ -56,3 +56,72 @@ int avc_decoder_record_parse(uint8_t *data, size_t data_len, uint8_t **pp_sps, s
 
     return 0;
 }
+
+static const uint32_t aac_sample_rates[] = {
+    96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000,
+    11025, 8000, 7350
+};
+
+// MSB first bit reader over the config.
+typedef struct tag_bit_reader {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+} bit_reader_t;
+
+static uint32_t read_bits(bit_reader_t *br, int bits)
+{
+    uint32_t v = 0;
+    for (int i = 0; i != bits; ++i, ++br->pos) {
+        uint8_t b = br->pos / 8 < br->len ? br->data[br->pos / 8] : 0;
+        v = (v << 1) | ((b >> (7 - br->pos % 8)) & 1);
+    }
+    return v;
+}
+
+static uint8_t read_object_type(bit_reader_t *br)
+{
+    uint8_t object_type = (uint8_t)read_bits(br, 5);
+    if (object_type == 31) {
+        object_type = 32 + (uint8_t)read_bits(br, 6);
+    }
+    return object_type;
+}
+
+static uint32_t read_sample_rate(bit_reader_t *br, uint8_t *index)
+{
+    *index = (uint8_t)read_bits(br, 4);
+    if (*index == 0xF) {
+        return read_bits(br, 24);
+    }
+    return *index < sizeof(aac_sample_rates) / sizeof(aac_sample_rates[0]) ? aac_sample_rates[*index] : 0;
+}
+
+int aac_audio_config_parse(const uint8_t *data, size_t data_len, aac_audio_config_t *config)
+{
+    bit_reader_t br = { data, data_len, 0 };
+    uint8_t extension_index;
+
+    memset(config, 0, sizeof(*config));
+    if (data_len < 2) {
+        printf("  AudioSpecificConfig too short: %zu\n", data_len);
+        return -1;
+    }
+
+    config->object_type = read_object_type(&br);
+    config->sample_rate = read_sample_rate(&br, &config->sampling_index);
+    config->channel_config = (uint8_t)read_bits(&br, 4);
+
+    // SBR (5) and PS (29): the extension rate comes first, then the core type.
+    if (config->object_type == 5 || config->object_type == 29) {
+        config->sbr = 1;
+        read_sample_rate(&br, &extension_index);
+        config->object_type = read_object_type(&br);
+    }
+
+    if (br.pos > data_len * 8) {
+        printf("  AudioSpecificConfig truncated\n");
+        return -1;
+    }
+    return 0;
+}
@@ -14,3 +14,15 @@
 int avc_decoder_record_parse(uint8_t *data, size_t data_len, 
     uint8_t **pp_sps, size_t *out_sps_len,
     uint8_t **pp_pps, size_t *out_pps_len);
+
+// Fields of an AudioSpecificConfig (ISO/IEC 14496-3 1.6.2.1).
+typedef struct tag_aac_audio_config {
+    uint8_t object_type;        // Audio object type. For SBR/PS (HE-AAC), the core type.
+    uint8_t sampling_index;     // samplingFrequencyIndex of the core, 0xF if explicit.
+    uint32_t sample_rate;
+    uint8_t channel_config;
+    int sbr;                    // Explicit SBR or PS signaling.
+} aac_audio_config_t;
+
+// @return 0 on success
+int aac_audio_config_parse(const uint8_t *data, size_t data_len, aac_audio_config_t *config);
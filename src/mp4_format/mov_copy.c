@@ -0,0 +1,70 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "mov_copy.h"
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+static uint8_t copy_buffer[1024 * 1024];
+
+int mov_copy_range(FILE *in, uint64_t offset, uint64_t size, FILE *out)
+{
+#ifdef __linux__
+    fflush(out);
+    int in_fd = fileno(in);
+    int out_fd = fileno(out);
+    loff_t off_in = offset;
+    loff_t off_out = _ftelli64(out);
+    while (size && off_out >= 0) {
+        ssize_t n = copy_file_range(in_fd, &off_in, out_fd, &off_out, size, 0);
+        if (n <= 0) {
+            break;
+        }
+        size -= n;
+    }
+    if (size) {
+        // copy_file_range() is not supported between these files, or "out"
+        // is not seekable.
+        off_t off = off_in;
+        if (off_out >= 0) {
+            lseek(out_fd, off_out, SEEK_SET);
+        }
+        while (size) {
+            ssize_t n = sendfile(out_fd, in_fd, &off, size);
+            if (n <= 0) {
+                break;
+            }
+            size -= n;
+        }
+        off_in = off;
+        off_out = lseek(out_fd, 0, SEEK_CUR);
+    }
+    if (off_out >= 0) {
+        _fseeki64(out, off_out, SEEK_SET);
+    }
+    offset = off_in;
+    if (size == 0) {
+        return 0;
+    }
+#endif
+
+    _fseeki64(in, offset, SEEK_SET);
+    while (size) {
+        size_t n = size < sizeof(copy_buffer) ? (size_t)size : sizeof(copy_buffer);
+        if (fread(copy_buffer, n, 1, in) != 1) {
+            printf("failed to read %zu bytes at: %llu\n", n, offset);
+            return -1;
+        }
+        if (fwrite(copy_buffer, n, 1, out) != 1) {
+            printf("failed to write %zu bytes\n", n);
+            return -1;
+        }
+        offset += n;
+        size -= n;
+    }
+    return 0;
+}
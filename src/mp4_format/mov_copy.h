@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Copy "size" bytes at "offset" of "in" to the current position of "out".
+// On Linux the kernel copies between the files, so media data stays out of
+// user space. "out" may also be a pipe or a socket.
+// @return 0 on success.
+int mov_copy_range(FILE *in, uint64_t offset, uint64_t size, FILE *out);
@@ -0,0 +1,116 @@
+#include "mov_crc32c.h"
+
+// Reversed polynomial of CRC-32C.
+#define CRC32C_POLY 0x82F63B78u
+
+// Slicing by 8: table k gives the CRC of a byte followed by k zero bytes.
+static uint32_t crc_tables[8][256];
+static int crc_tables_ready = 0;
+
+void mov_crc32c_init(void)
+{
+    if (crc_tables_ready) {
+        return;
+    }
+    for (uint32_t i = 0; i != 256; ++i) {
+        uint32_t crc = i;
+        for (int k = 0; k != 8; ++k) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc_tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i != 256; ++i) {
+        for (int k = 1; k != 8; ++k) {
+            uint32_t crc = crc_tables[k - 1][i];
+            crc_tables[k][i] = (crc >> 8) ^ crc_tables[0][crc & 0xFF];
+        }
+    }
+    crc_tables_ready = 1;
+}
+
+uint32_t mov_crc32c(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    mov_crc32c_init();
+
+    crc = ~crc;
+    while (len && ((uintptr_t)p & 7)) {
+        crc = (crc >> 8) ^ crc_tables[0][(crc ^ *p++) & 0xFF];
+        --len;
+    }
+    while (len >= 8) {
+        // Bytes in little endian order, whatever the host order.
+        uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crc_tables[7][lo & 0xFF] ^ crc_tables[6][(lo >> 8) & 0xFF] ^
+            crc_tables[5][(lo >> 16) & 0xFF] ^ crc_tables[4][lo >> 24] ^
+            crc_tables[3][hi & 0xFF] ^ crc_tables[2][(hi >> 8) & 0xFF] ^
+            crc_tables[1][(hi >> 16) & 0xFF] ^ crc_tables[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ crc_tables[0][(crc ^ *p++) & 0xFF];
+    }
+    return ~crc;
+}
+
+// Multiply "vec" by the GF(2) matrix "mat".
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+        vec >>= 1;
+        ++mat;
+    }
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
+{
+    for (int n = 0; n != 32; ++n) {
+        square[n] = gf2_matrix_times(mat, mat[n]);
+    }
+}
+
+uint32_t mov_crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b)
+{
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    if (len_b == 0) {
+        return crc_a;
+    }
+
+    // Operator for one zero bit.
+    odd[0] = CRC32C_POLY;
+    uint32_t row = 1;
+    for (int n = 1; n != 32; ++n) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2_matrix_square(even, odd);   // two zero bits
+    gf2_matrix_square(odd, even);   // four zero bits
+
+    // Append len_b zero bytes to crc_a, squaring the operator per bit of len_b.
+    do {
+        gf2_matrix_square(even, odd);
+        if (len_b & 1) {
+            crc_a = gf2_matrix_times(even, crc_a);
+        }
+        len_b >>= 1;
+        if (len_b == 0) {
+            break;
+        }
+        gf2_matrix_square(odd, even);
+        if (len_b & 1) {
+            crc_a = gf2_matrix_times(odd, crc_a);
+        }
+        len_b >>= 1;
+    } while (len_b);
+
+    return crc_a ^ crc_b;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli). Start with crc 0, and pass the result back in to
+// continue over more data.
+
+// Build the tables. Call once before using CRCs from several threads.
+void mov_crc32c_init(void);
+
+uint32_t mov_crc32c(uint32_t crc, const void *data, size_t len);
+
+// CRC of data A followed by data B, from the CRCs of both and the length of
+// B. Lets ranges be checksummed in parallel, then combined in order.
+uint32_t mov_crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b);
@@ -9,12 +9,116 @@
 typedef struct tag_mov_atom {
     uint32_t type;
     int64_t size;       // total size (excluding the size and type fields)
+    int64_t content_pos;    // File position right after the box header.
 
     char str_type[5];   // For debug purpose.
 } mov_atom_t;
 
+// Node of boxes left out of the box index, see mov_ctx_t::cur_box_node.
+#define MOV_BOX_NODE_NONE (-2)
+
+// One box of the file, recorded while parsing. Boxes inside 'moof' are only
+// recorded for lazy loading or profiling.
+typedef struct tag_mov_box_node {
+    uint32_t type;
+    int32_t parent;             // Index of parent node, -1 for top-level boxes.
+    int64_t offset;             // File offset of the box header.
+    int64_t content_pos;        // File offset of the box content.
+    int64_t size;               // Content size (excluding the header).
+
+    // Filled when profiling. Bytes and times include children, and later
+    // loading of deferred boxes.
+    uint32_t entry_count;       // Entries of a table box, or 0.
+    uint64_t bytes_read;        // Bytes read by parsing, not skipped.
+    uint64_t wall_us;
+    uint64_t cpu_us;
+} mov_box_node_t;
+
+// Per-sample index of a track, built from the sample tables.
+// Each field is kept in its own array, indexed by sample number - 1.
+typedef struct tag_mov_sample_index {
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t *offsets;          // File offset of sample data.
+    uint32_t *sizes;
+    uint64_t *dts;              // Decoding time in the media timescale.
+    int32_t *cts_offsets;       // Composition time minus decoding time.
+    uint8_t *sync_flags;        // Non-zero for sync samples.
+} mov_sample_index_t;
+
+// Block size of mov_packed_index_t, in samples.
+#define MOV_PACKED_BLOCK_SHIFT 6
+#define MOV_PACKED_BLOCK_SIZE (1 << MOV_PACKED_BLOCK_SHIFT)
+
+// Compressed per-sample index, for tracks with millions of samples.
+// Samples are varint coded in blocks, each block starts from an absolute
+// checkpoint so any block can be located directly.
+typedef struct tag_mov_packed_index {
+    uint32_t count;
+    uint32_t block_count;
+
+    uint32_t const_size;        // Size of all samples, 0 if sizes vary.
+    uint32_t const_delta;       // Duration of all samples, 0 if durations vary.
+    uint32_t cts_unit;          // Composition offsets are coded in this unit, 0 if none.
+    int all_sync;               // No 'stss', every sample is a sync sample.
+
+    // Checkpoints, one per block.
+    uint64_t *block_offsets;    // File offset of the first sample.
+    uint64_t *block_dts;        // Decoding time of the first sample.
+    uint32_t *block_data_pos;   // Position of the block in "data".
+
+    // Per sample: [size] offset gap [duration] [cts offset], varint coded.
+    uint8_t *data;
+    uint32_t data_size;
+
+    uint8_t *sync_bits;         // One bit per sample.
+} mov_packed_index_t;
+
+// One decoded sample.
+typedef struct tag_mov_sample {
+    uint64_t offset;
+    uint32_t size;
+    uint64_t dts;
+    int32_t cts_offset;
+    int sync;
+} mov_sample_t;
+
+// A track fragment ('traf') of a 'moof'.
+typedef struct tag_mov_fragment {
+    uint64_t moof_offset;       // File offset of the 'moof' box.
+    uint64_t data_offset;       // File offset of the first sample.
+    uint64_t base_decode_time;
+    uint32_t first_sample;      // Index of the first sample in the track sample index.
+    uint32_t sample_count;
+    int starts_with_sync;
+} mov_fragment_t;
+
+// An entry of 'tfra', a random access point of a track.
+typedef struct tag_mov_tfra_entry {
+    uint64_t time;              // Presentation time of the sync sample.
+    uint64_t moof_offset;       // File offset of the 'moof' holding the sample.
+    uint32_t traf_number;       // 1-based numbers of traf, trun and sample.
+    uint32_t trun_number;
+    uint32_t sample_number;
+} mov_tfra_entry_t;
+
+// A media reference of 'sidx'. References to other 'sidx' boxes are
+// resolved, so the table only holds leaf segments, in file order.
+typedef struct tag_mov_segment {
+    uint64_t offset;            // File offset of the first byte of the segment.
+    uint64_t size;
+    uint64_t earliest_pts;      // In "timescale" units.
+    uint32_t duration;
+    uint32_t timescale;
+    uint32_t reference_id;      // Track ID the 'sidx' was made for.
+    uint8_t starts_with_sap;
+    uint8_t sap_type;
+} mov_segment_t;
+
 typedef struct tag_track {
     int valid;                  // Indicate a valid track.
+    int tables_loaded;          // Sample tables (stts, stsz, ...) have been decoded.
+    int32_t stbl_node;          // Box index node of 'stbl', used for lazy loading.
 
     // tkhd
     uint32_t trackid;
@@ -48,54 +152,117 @@ typedef struct tag_track {
     uint32_t pps_len;
     uint8_t *vps;               // hevc only.
     uint32_t vps_len;
+    uint8_t *decoder_config;    // Content of 'avcC' or 'hvcC', as stored.
+    uint32_t decoder_config_len;
 
     // stsd (audio)
     uint16_t channel_count;
     uint16_t audio_sample_size;
     uint32_t audio_sample_rate;
+    uint8_t *audio_specific_config;     // DecoderSpecificInfo of 'esds'.
+    uint32_t audio_specific_config_len;
 
     // stts
     uint32_t stts_entry_count;
+    uint32_t stts_capacity;            // Allocated entries, kept by mov_ctx_reset().
     uint32_t *stts_sample_counts;
     uint32_t *stts_sample_deltas;      // Delta of samples in the time-scale of the media
+    uint32_t *stts_run_first_sample;   // Prefix sums of the runs above, built on demand.
+    uint64_t *stts_run_first_dts;
 
     // ctts
     uint32_t ctts_entry_count;
+    uint32_t ctts_capacity;
     uint32_t *ctts_sample_counts;
     uint32_t *ctts_sample_offsets;
+    uint32_t *ctts_run_first_sample;   // Prefix sums, built on demand.
 
     // stss
     uint32_t sample_number_count; // Count of "sample number"
+    uint32_t sample_number_capacity;
     uint32_t *sample_numbers;   // Array of "sample number"
 
     // stsc
     uint32_t stsc_count;
+    uint32_t stsc_capacity;
     uint32_t *stsc_first_chunk;
     uint32_t *stsc_sample_per_chunk;
     uint32_t *stsc_sample_desc_index;
+    uint32_t *stsc_run_first_sample;   // Prefix sums, built on demand.
 
     // stsz
     uint32_t *sample_lengths;
     uint32_t sample_lengths_count;
+    uint32_t sample_lengths_capacity;
 
     // stco
     uint64_t *chunk_offsets;
     uint32_t chunk_offset_count;
+    uint32_t chunk_offset_capacity;
+
+    // Flattened index of all samples. Raw tables above are emptied once built.
+    mov_sample_index_t samples;
+    mov_packed_index_t packed;  // Alternative to "samples" for long tracks.
+
+    // trex, defaults of fragment samples.
+    uint32_t trex_default_sample_desc_index;
+    uint32_t trex_default_sample_duration;
+    uint32_t trex_default_sample_size;
+    uint32_t trex_default_sample_flags;
 
-    // tfhd
-    uint64_t cur_frag_offset;
+    // tfhd, for the fragment being parsed.
+    uint64_t cur_frag_offset;           // Base data offset.
+    uint32_t cur_frag_default_sample_duration;
     uint32_t cur_frag_default_sample_size;
+    uint32_t cur_frag_default_sample_flags;
+    uint64_t cur_frag_data_end;         // End of sample data of the last trun.
+    uint64_t next_frag_dts;             // tfdt, or continued from the last fragment.
+    uint64_t moov_end_dts;              // End of samples of 'moov', where fragments go on.
 
-    // trun
-    uint32_t *trun_sample_sizes;
-    uint64_t *trun_sample_offsets;
-    uint32_t trun_sample_count;
-    uint32_t trun_sample_capacity;
+    // Fragments of the track. Their samples are appended to "samples".
+    mov_fragment_t *fragments;
+    uint32_t fragment_count;
+    uint32_t fragment_capacity;
+
+    // tfra
+    mov_tfra_entry_t *tfra_entries;
+    uint32_t tfra_count;
+    uint32_t tfra_capacity;
 
 } mov_track_t;
 
 typedef struct tag_mov_context {
     FILE *f;
+    int64_t file_size;
+    int64_t resume_pos;         // Top-level parsing stopped here, 0 when the whole file was walked.
+    int64_t mfra_offset;        // 'mfra' loaded through 'mfro', 0 if not.
+
+    // sidx
+    mov_segment_t *segments;
+    uint32_t segment_count;
+    uint32_t segment_capacity;
+    int64_t *nested_sidx;       // Content offsets of 'sidx' boxes read through a reference.
+    uint32_t nested_sidx_count;
+    uint32_t nested_sidx_capacity;
+
+    // Lazy mode: only box headers under 'stbl' and top-level 'moof' are
+    // indexed during parsing. Use mov_load_track_tables() before reading samples.
+    int lazy;
+    int fragments_loaded;       // All 'moof' boxes have been parsed.
+
+    // Box tree index, in file order.
+    mov_box_node_t *box_nodes;
+    uint32_t box_node_count;
+    uint32_t box_node_capacity;
+    int32_t cur_box_node;       // During parsing, node of the box being parsed.
+                                // -1 at top level, MOV_BOX_NODE_NONE if not indexed.
+    uint32_t *top_level_nodes;  // Nodes of top-level boxes, by offset.
+    uint32_t top_level_count;
+    uint32_t top_level_capacity;
+
+    // Profiling: time and bytes of each box are recorded in its node.
+    int profile;
+    uint64_t skipped_bytes;     // Bytes skipped so far, by seeking forward.
 
     // mvhd
     uint64_t create_time;
@@ -105,14 +272,12 @@ typedef struct tag_mov_context {
 
     mov_track_t *tracks;        // Since track id starts from 1, there could be empty track.
     int track_count;
+    int track_capacity;         // Allocated tracks, with buffers kept by mov_ctx_reset().
     mov_track_t *cur_track;     // During parsing, points to current track.
 
     // moof parsing.
     uint64_t cur_moof_offset;   // Offset of the current moof box.
+    uint64_t cur_moof_data_end; // End of sample data of the last traf in current moof.
 } mov_ctx_t;
 
-typedef struct tag_mov_box_handler
-{
-    uint32_t type;
-    int (*box_handler_func)(mov_ctx_t *ctx, mov_atom_t atom);
-} mov_box_handler_t;
+typedef int (*mov_box_handler_func_t)(mov_ctx_t *ctx, mov_atom_t atom);
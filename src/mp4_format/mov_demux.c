@@ -0,0 +1,115 @@
+#include "mov_demux.h"
+#include "mov_read_functions.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Prefetch sample "index" of the track. Packed indexes and tables are read
+// in order.
+static void fetch_sample(mov_demux_track_t *t, uint32_t index)
+{
+    t->has_next = index < t->count;
+    if (!t->has_next) {
+        return;
+    }
+
+    t->next_index = index;
+    if (t->track->packed.count) {
+        mov_packed_cursor_next(&t->cursor, &t->next);
+    } else if (t->track->samples.count) {
+        mov_get_sample(&t->track->samples, index, &t->next);
+    } else if (mov_table_cursor_next(&t->table_cursor, &t->next) != 0) {
+        // Chunks cover fewer samples than 'stsz'.
+        t->has_next = 0;
+    }
+}
+
+int mov_demux_init(mov_demux_t *demux, mov_ctx_t *ctx, mov_track_t **tracks, int track_count)
+{
+    int ret;
+
+    memset(demux, 0, sizeof(*demux));
+    demux->tracks = calloc(track_count ? track_count : 1, sizeof(mov_demux_track_t));
+    if (NULL == demux->tracks) {
+        printf("failed to allocate demux tracks\n");
+        return -1;
+    }
+    demux->track_count = track_count;
+
+    for (int i = 0; i != track_count; ++i) {
+        mov_demux_track_t *t = demux->tracks + i;
+        mov_track_t *track = tracks[i];
+        t->track = track;
+
+        ret = mov_load_track_tables(ctx, track);
+        if (ret != 0) {
+            printf("failed to load sample tables of track %u\n", track->trackid);
+            return ret;
+        }
+
+        if (track->packed.count) {
+            mov_packed_cursor_seek(&t->cursor, &track->packed, 0);
+            t->count = track->packed.count;
+        } else if (track->samples.count || track->fragment_count) {
+            ret = mov_build_sample_index(track);
+            if (ret != 0) {
+                printf("failed to build sample index of track %u\n", track->trackid);
+                return ret;
+            }
+            t->count = track->samples.count;
+        } else {
+            // Nothing is expanded per sample.
+            ret = mov_build_run_prefix_sums(track);
+            if (ret != 0) {
+                printf("failed to allocate run prefix sums\n");
+                return ret;
+            }
+            mov_table_cursor_seek(&t->table_cursor, track, 0);
+            t->count = track->sample_lengths_count;
+        }
+
+        fetch_sample(t, 0);
+    }
+    return 0;
+}
+
+void mov_demux_set_range(mov_demux_t *demux, int i, uint32_t first, uint32_t end)
+{
+    mov_demux_track_t *t = demux->tracks + i;
+    if (end < t->count) {
+        t->count = end;
+    }
+    if (t->track->packed.count) {
+        mov_packed_cursor_seek(&t->cursor, &t->track->packed, first);
+    } else if (t->track->samples.count == 0) {
+        mov_table_cursor_seek(&t->table_cursor, t->track, first);
+    }
+    fetch_sample(t, first);
+}
+
+int mov_demux_next(mov_demux_t *demux, mov_demux_sample_t *sample)
+{
+    // Tracks are few, a linear scan beats a heap here.
+    mov_demux_track_t *best = NULL;
+    for (int i = 0; i != demux->track_count; ++i) {
+        mov_demux_track_t *t = demux->tracks + i;
+        if (t->has_next && (NULL == best || t->next.offset < best->next.offset)) {
+            best = t;
+        }
+    }
+    if (NULL == best) {
+        return -1;
+    }
+
+    sample->track = best->track;
+    sample->index = best->next_index;
+    sample->sample = best->next;
+    fetch_sample(best, best->next_index + 1);
+    return 0;
+}
+
+void mov_demux_free(mov_demux_t *demux)
+{
+    free(demux->tracks);
+    memset(demux, 0, sizeof(*demux));
+}
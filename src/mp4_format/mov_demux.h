@@ -0,0 +1,46 @@
+#pragma once
+
+#include "mov_defs.h"
+#include "mov_sample_index.h"
+#include "mov_table_cursor.h"
+
+// Demux of several tracks in file order. Samples of all tracks are merged by
+// file offset, so one forward pass over the file serves every track. Each
+// track still yields its samples in decoding order.
+
+typedef struct tag_mov_demux_track {
+    mov_track_t *track;
+    uint32_t next_index;        // 0-based index of "next" in the track.
+    uint32_t count;
+    int has_next;
+    mov_sample_t next;
+    mov_packed_cursor_t cursor; // Used when the track has a packed index.
+    mov_table_cursor_t table_cursor;    // Used when the track has no index.
+} mov_demux_track_t;
+
+typedef struct tag_mov_demux {
+    mov_demux_track_t *tracks;
+    int track_count;
+} mov_demux_t;
+
+typedef struct tag_mov_demux_sample {
+    mov_track_t *track;
+    uint32_t index;             // 0-based sample index in the track.
+    mov_sample_t sample;
+} mov_demux_sample_t;
+
+// Load tables of "tracks" and start from their first samples. A track with
+// a packed index built is read through it, fragmented tracks through the
+// flat index, others straight from the run-length tables.
+// @return 0 on success.
+int mov_demux_init(mov_demux_t *demux, mov_ctx_t *ctx, mov_track_t **tracks, int track_count);
+
+// Restrict track "i" to samples [first, end). Call before the first
+// mov_demux_next().
+void mov_demux_set_range(mov_demux_t *demux, int i, uint32_t first, uint32_t end);
+
+// Get the sample at the lowest file offset among all tracks.
+// @return 0 on success, -1 when no more sample.
+int mov_demux_next(mov_demux_t *demux, mov_demux_sample_t *sample);
+
+void mov_demux_free(mov_demux_t *demux);
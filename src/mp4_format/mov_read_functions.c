@@ -1,9 +1,16 @@
 #include "mov_read_functions.h"
+#include "mov_sample_index.h"
 #include "read_utils.h"
 #include "decoder_config_record.h"
 
 #include <stdlib.h>
 #include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
 
 static mov_track_t *get_track_by_id(mov_ctx_t *ctx, uint32_t trackid);
 
@@ -14,7 +21,7 @@ static uint32_t read_int24_mov(mov_ctx_t *ctx) { return read_int24(ctx->f); }
 static uint32_t read_int32_mov(mov_ctx_t *ctx) { return read_int32(ctx->f); }
 static uint64_t read_int48_mov(mov_ctx_t *ctx) { return read_int48(ctx->f); }
 static uint64_t read_int64_mov(mov_ctx_t *ctx) { return read_int64(ctx->f); }
-static int skip_bytes_mov(mov_ctx_t *ctx, int64_t bytes) { return skip_bytes(ctx->f, bytes); }
+static int skip_bytes_mov(mov_ctx_t *ctx, int64_t bytes) { ctx->skipped_bytes += bytes; return skip_bytes(ctx->f, bytes); }
 static int read_bytes_mov(mov_ctx_t *ctx, int64_t bytes, void *dst) { return read_bytes(ctx->f, bytes, dst); }
 
 static uint32_t read_box_type(mov_ctx_t *ctx);
@@ -22,8 +29,16 @@ static uint32_t read_box_type(mov_ctx_t *ctx);
 // Read "type" and "size" part of a Box. "largesize" is handled.
 static mov_atom_t read_box_atom_head(mov_ctx_t *ctx);
 
-static const mov_box_handler_t *get_box_handler(uint32_t box_type);
-static int parse_common_box(mov_ctx_t *ctx);
+// Parent type of top-level boxes.
+#define MOV_BOX_ROOT 0
+
+#define MOV_MAX(a,b) ((a) > (b) ? (a) : (b))
+
+static mov_box_handler_func_t get_box_handler(uint32_t box_type);
+static int is_child_box_allowed(uint32_t parent_type, uint32_t box_type);
+static int32_t add_box_node(mov_ctx_t *ctx, mov_atom_t atom, int64_t start_pos);
+static int parse_common_box(mov_ctx_t *ctx, uint32_t parent_type);
+static int parse_top_level_boxes(mov_ctx_t *ctx, int stop_at_fragment);
 static int parse_sub_boxes(mov_ctx_t *ctx, mov_atom_t atom);
 
 static int parse_moov_box(mov_ctx_t *ctx, mov_atom_t atom);
@@ -36,6 +51,8 @@ static int parse_hdlr_box(mov_ctx_t *ctx, mov_atom_t atom);
 static int parse_minf_box(mov_ctx_t *ctx, mov_atom_t atom);
 static int parse_stbl_box(mov_ctx_t *ctx, mov_atom_t atom);
 static int parse_stsd_box(mov_ctx_t *ctx, mov_atom_t atom);
+static int parse_visual_sample_entry(mov_ctx_t *ctx, mov_atom_t atom);
+static int parse_audio_sample_entry(mov_ctx_t *ctx, mov_atom_t atom);
 static int parse_stts_box(mov_ctx_t *ctx, mov_atom_t atom);
 static int parse_ctts_box(mov_ctx_t *ctx, mov_atom_t atom);
 static int parse_stss_box(mov_ctx_t *ctx, mov_atom_t atom);
@@ -43,6 +60,13 @@ static int parse_stsc_box(mov_ctx_t *ctx, mov_atom_t atom);
 static int parse_stsz_box(mov_ctx_t *ctx, mov_atom_t atom);
 static int parse_stco_box(mov_ctx_t *ctx, mov_atom_t atom);
 
+static int parse_mvex_box(mov_ctx_t *ctx, mov_atom_t atom);
+static int parse_trex_box(mov_ctx_t *ctx, mov_atom_t atom);
+
+static int parse_sidx_box(mov_ctx_t *ctx, mov_atom_t atom);
+static int parse_mfra_box(mov_ctx_t *ctx, mov_atom_t atom);
+static int parse_tfra_box(mov_ctx_t *ctx, mov_atom_t atom);
+
 static int parse_moof_box(mov_ctx_t *ctx, mov_atom_t atom);
 static int parse_mfhd_box(mov_ctx_t *ctx, mov_atom_t atom);
 static int parse_traf_box(mov_ctx_t *ctx, mov_atom_t atom);
@@ -54,33 +78,85 @@ static int parse_avcC_box(mov_ctx_t *ctx, mov_atom_t atom);  // avc
 static int parse_hvcC_box(mov_ctx_t *ctx, mov_atom_t atom);  // hevc
 static int parse_esds_box(mov_ctx_t *ctx, mov_atom_t atom);  // mp4a (aac)
 
-static const mov_box_handler_t mov_box_handlers[] = {
-    { MOV_BOX_TYPE('m','o','o','v'), parse_moov_box },
-    { MOV_BOX_TYPE('m','v','h','d'), parse_mvhd_box },
-    { MOV_BOX_TYPE('t','r','a','k'), parse_trak_box },
-    { MOV_BOX_TYPE('t','k','h','d'), parse_tkhd_box },
-    { MOV_BOX_TYPE('m','d','i','a'), parse_mdia_box },
-    { MOV_BOX_TYPE('m','d','h','d'), parse_mdhd_box },
-    { MOV_BOX_TYPE('h','d','l','r'), parse_hdlr_box },
-    { MOV_BOX_TYPE('m','i','n','f'), parse_minf_box },
-    { MOV_BOX_TYPE('s','t','b','l'), parse_stbl_box },
-    { MOV_BOX_TYPE('s','t','s','d'), parse_stsd_box },
-    { MOV_BOX_TYPE('s','t','t','s'), parse_stts_box },
-    { MOV_BOX_TYPE('c','t','t','s'), parse_ctts_box },
-    { MOV_BOX_TYPE('s','t','s','s'), parse_stss_box },
-    { MOV_BOX_TYPE('s','t','s','c'), parse_stsc_box },
-    { MOV_BOX_TYPE('s','t','s','z'), parse_stsz_box },
-    { MOV_BOX_TYPE('s','t','c','o'), parse_stco_box },
-    { MOV_BOX_TYPE('c','o','6','4'), parse_stco_box },
-
-    { MOV_BOX_TYPE('m','o','o','f'), parse_moof_box },
-    { MOV_BOX_TYPE('m','f','h','d'), parse_mfhd_box },
-    { MOV_BOX_TYPE('t','r','a','f'), parse_traf_box },
-    { MOV_BOX_TYPE('t','f','h','d'), parse_tfhd_box },
-    { MOV_BOX_TYPE('t','f','d','t'), parse_tfdt_box },
-    { MOV_BOX_TYPE('t','r','u','n'), parse_trun_box },
-
-    { 0, NULL }  // end
+// Allowed children of every container box we descend into, terminated by 0.
+// Boxes not listed under their parent are skipped without being parsed.
+static const uint32_t root_children[] = {
+    MOV_BOX_TYPE('m','o','o','v'),
+    MOV_BOX_TYPE('m','o','o','f'),
+    MOV_BOX_TYPE('m','f','r','a'),
+    MOV_BOX_TYPE('s','i','d','x'),
+    0
+};
+static const uint32_t moov_children[] = {
+    MOV_BOX_TYPE('m','v','h','d'),
+    MOV_BOX_TYPE('t','r','a','k'),
+    MOV_BOX_TYPE('m','v','e','x'),
+    0
+};
+static const uint32_t mvex_children[] = {
+    MOV_BOX_TYPE('t','r','e','x'),
+    0
+};
+static const uint32_t trak_children[] = {
+    MOV_BOX_TYPE('t','k','h','d'),
+    MOV_BOX_TYPE('m','d','i','a'),
+    0
+};
+static const uint32_t mdia_children[] = {
+    MOV_BOX_TYPE('m','d','h','d'),
+    MOV_BOX_TYPE('h','d','l','r'),
+    MOV_BOX_TYPE('m','i','n','f'),
+    0
+};
+static const uint32_t minf_children[] = {
+    MOV_BOX_TYPE('s','t','b','l'),
+    0
+};
+static const uint32_t stbl_children[] = {
+    MOV_BOX_TYPE('s','t','s','d'),
+    MOV_BOX_TYPE('s','t','t','s'),
+    MOV_BOX_TYPE('c','t','t','s'),
+    MOV_BOX_TYPE('s','t','s','s'),
+    MOV_BOX_TYPE('s','t','s','c'),
+    MOV_BOX_TYPE('s','t','s','z'),
+    MOV_BOX_TYPE('s','t','c','o'),
+    MOV_BOX_TYPE('c','o','6','4'),
+    0
+};
+static const uint32_t stsd_children[] = {
+    MOV_BOX_TYPE('a','v','c','1'),
+    MOV_BOX_TYPE('a','v','c','3'),
+    MOV_BOX_TYPE('h','v','c','1'),
+    MOV_BOX_TYPE('h','e','v','1'),
+    MOV_BOX_TYPE('m','p','4','a'),
+    0
+};
+static const uint32_t avc1_children[] = {
+    MOV_BOX_TYPE('a','v','c','C'),
+    0
+};
+static const uint32_t hvc1_children[] = {
+    MOV_BOX_TYPE('h','v','c','C'),
+    0
+};
+static const uint32_t mp4a_children[] = {
+    MOV_BOX_TYPE('e','s','d','s'),
+    0
+};
+static const uint32_t moof_children[] = {
+    MOV_BOX_TYPE('m','f','h','d'),
+    MOV_BOX_TYPE('t','r','a','f'),
+    0
+};
+static const uint32_t mfra_children[] = {
+    MOV_BOX_TYPE('t','f','r','a'),
+    0
+};
+static const uint32_t traf_children[] = {
+    MOV_BOX_TYPE('t','f','h','d'),
+    MOV_BOX_TYPE('t','f','d','t'),
+    MOV_BOX_TYPE('t','r','u','n'),
+    0
 };
 
 void print_dump_data(const char *prefix, void *data, uint32_t bytes)
@@ -92,10 +168,76 @@ void print_dump_data(const char *prefix, void *data, uint32_t bytes)
     printf("\n");
 }
 
-int parse_mov_file(const char *filename, mov_ctx_t *ctx)
+// Wall clock and CPU time of the calling thread, in microseconds.
+static void get_times_us(uint64_t *wall_us, uint64_t *cpu_us)
 {
-    int ret;
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    *wall_us = (uint64_t)(counter.QuadPart / frequency.QuadPart * 1000000 +
+        counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+
+    FILETIME creation, exit, kernel, user;
+    GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+    uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    *cpu_us = (k + u) / 10;     // 100 ns units
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *wall_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    *cpu_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
 
+// State at the start of a box, to profile it.
+typedef struct tag_box_profile {
+    int64_t pos;
+    uint64_t skipped_bytes;
+    uint64_t wall_us;
+    uint64_t cpu_us;
+} box_profile_t;
+
+static void profile_begin(mov_ctx_t *ctx, box_profile_t *profile, int64_t pos)
+{
+    if (!ctx->profile) {
+        return;
+    }
+    profile->pos = pos;
+    profile->skipped_bytes = ctx->skipped_bytes;
+    get_times_us(&profile->wall_us, &profile->cpu_us);
+}
+
+// Add time and bytes read since profile_begin() to the node, up to "pos".
+static void profile_end(mov_ctx_t *ctx, const box_profile_t *profile, int32_t node_index, int64_t pos)
+{
+    if (!ctx->profile || node_index < 0) {
+        return;
+    }
+    uint64_t wall_us, cpu_us;
+    get_times_us(&wall_us, &cpu_us);
+
+    mov_box_node_t *node = ctx->box_nodes + node_index;
+    uint64_t skipped = ctx->skipped_bytes - profile->skipped_bytes;
+    if (pos > profile->pos && (uint64_t)(pos - profile->pos) > skipped) {
+        node->bytes_read += (uint64_t)(pos - profile->pos) - skipped;
+    }
+    node->wall_us += wall_us - profile->wall_us;
+    node->cpu_us += cpu_us - profile->cpu_us;
+}
+
+// Record the entry count of the table box being parsed, for profiling.
+static void set_box_entry_count(mov_ctx_t *ctx, uint32_t entry_count)
+{
+    if (ctx->cur_box_node >= 0) {
+        ctx->box_nodes[ctx->cur_box_node].entry_count = entry_count;
+    }
+}
+
+int parse_mov_file(const char *filename, mov_ctx_t *ctx)
+{
     if (ctx->f != NULL) {
         printf("file stream is not null\n");
         return -1;
@@ -108,20 +250,848 @@ int parse_mov_file(const char *filename, mov_ctx_t *ctx)
     }
 
     // Get file size.
-    int64_t file_size;
     _fseeki64(ctx->f, 0, SEEK_END);
-    file_size = _ftelli64(ctx->f);
+    ctx->file_size = _ftelli64(ctx->f);
     _fseeki64(ctx->f, 0, SEEK_SET);
 
-    while ((ret = parse_common_box(ctx)) == 0) {
-        // Check for file end.
+    // In lazy mode, fragments are located through 'tfra' when the file has
+    // it, so the walk may stop at the first 'moof'.
+    parse_top_level_boxes(ctx, ctx->lazy);
+
+    if (!ctx->lazy) {
+        ctx->fragments_loaded = 1;
+    }
+
+    return 0;
+}
+
+static int parse_top_level_boxes(mov_ctx_t *ctx, int stop_at_fragment)
+{
+    int ret = 0;
+
+    ctx->cur_box_node = -1;
+    ctx->resume_pos = 0;
+    while (_ftelli64(ctx->f) + 8 <= ctx->file_size) {
+        // 'mfra' read through 'mfro' is already indexed.
+        if (ctx->mfra_offset && _ftelli64(ctx->f) == ctx->mfra_offset) {
+            break;
+        }
+
+        uint32_t node = ctx->box_node_count;
+        ret = parse_common_box(ctx, MOV_BOX_ROOT);
+        if (ret != 0) {
+            break;
+        }
+
         int64_t cur_file_pos = _ftelli64(ctx->f);
-        if (cur_file_pos + 8 > file_size) {
-            printf("file end reached. file size: %lld, cur pos: %lld\n", file_size, cur_file_pos);
+        if (stop_at_fragment && ctx->box_nodes[node].type == MOV_BOX_TYPE('m','o','o','f')) {
+            stop_at_fragment = 0;
+            if (mov_read_mfra(ctx) == 0) {
+                ctx->resume_pos = cur_file_pos;
+                printf("top-level parsing stopped at first fragment, pos: %lld\n", cur_file_pos);
+                return 0;
+            }
+            _fseeki64(ctx->f, cur_file_pos, SEEK_SET);
+        }
+
+        // Check for file end.
+        if (cur_file_pos + 8 > ctx->file_size) {
+            printf("file end reached. file size: %lld, cur pos: %lld\n", ctx->file_size, cur_file_pos);
+        }
+    }
+
+    return ret;
+}
+
+// Continue top-level parsing stopped by parse_top_level_boxes().
+static int resume_top_level_boxes(mov_ctx_t *ctx)
+{
+    if (ctx->resume_pos == 0) {
+        return 0;
+    }
+    _fseeki64(ctx->f, ctx->resume_pos, SEEK_SET);
+    return parse_top_level_boxes(ctx, 0);
+}
+
+// Call the handler of an indexed box, positioned at its content.
+static int parse_indexed_box(mov_ctx_t *ctx, int32_t node_index)
+{
+    mov_box_node_t *node = ctx->box_nodes + node_index;
+
+    mov_atom_t atom;
+    atom.type = node->type;
+    atom.size = node->size;
+    atom.content_pos = node->content_pos;
+    memcpy(atom.str_type, &atom.type, 4);
+    atom.str_type[4] = '\0';
+
+    mov_box_handler_func_t box_handler = get_box_handler(atom.type);
+    if (NULL == box_handler) {
+        return 0;
+    }
+
+    _fseeki64(ctx->f, atom.content_pos, SEEK_SET);
+    box_profile_t profile;
+    profile_begin(ctx, &profile, atom.content_pos);
+    ctx->cur_box_node = node_index;
+    int ret = box_handler(ctx, atom);
+    profile_end(ctx, &profile, node_index, _ftelli64(ctx->f));
+    ctx->cur_box_node = -1;
+    return ret;
+}
+
+// Decode the deferred children of 'stbl' of the track.
+static int load_sample_tables(mov_ctx_t *ctx, mov_track_t *track)
+{
+    if (track->tables_loaded || track->stbl_node <= 0) {
+        return 0;
+    }
+
+    // Children of 'stbl' directly follow it in the index.
+    mov_box_node_t *stbl = ctx->box_nodes + track->stbl_node;
+    int64_t stbl_end = stbl->content_pos + stbl->size;
+
+    ctx->cur_track = track;
+    for (uint32_t i = track->stbl_node + 1; i < ctx->box_node_count; ++i) {
+        mov_box_node_t *node = ctx->box_nodes + i;
+        if (node->offset < stbl->content_pos || node->offset >= stbl_end) {
+            break;
+        }
+        if (node->parent != track->stbl_node || node->type == MOV_BOX_TYPE('s','t','s','d')) {
+            continue;
+        }
+
+        int ret = parse_indexed_box(ctx, i);
+        if (ret != 0) {
+            printf("failed to load sample table of track %u\n", track->trackid);
+            return ret;
+        }
+    }
+    track->tables_loaded = 1;
+    return 0;
+}
+
+// Decode the deferred sample tables of all tracks.
+static int load_all_sample_tables(mov_ctx_t *ctx)
+{
+    for (int i = 0; i != ctx->track_count; ++i) {
+        if (!ctx->tracks[i].valid) {
+            continue;
+        }
+        int ret = load_sample_tables(ctx, ctx->tracks + i);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+// Drop samples read from 'moof' boxes. Samples of 'moov' are kept.
+static void reset_fragments(mov_ctx_t *ctx)
+{
+    for (int i = 0; i != ctx->track_count; ++i) {
+        mov_track_t *track = ctx->tracks + i;
+        if (track->fragment_count) {
+            track->samples.count = track->fragments[0].first_sample;
+            track->fragment_count = 0;
+        }
+        track->next_frag_dts = track->moov_end_dts;
+    }
+}
+
+int mov_load_track_tables(mov_ctx_t *ctx, mov_track_t *track)
+{
+    int ret;
+    mov_track_t *saved_track = ctx->cur_track;
+
+    ret = load_sample_tables(ctx, track);
+    if (ret != 0) {
+        ctx->cur_track = saved_track;
+        return ret;
+    }
+
+    if (!ctx->fragments_loaded) {
+        // Fragments mix all tracks, so they are loaded at once. Samples of
+        // 'moov' come first in every track.
+        ret = load_all_sample_tables(ctx);
+        if (ret == 0) {
+            ret = resume_top_level_boxes(ctx);
+        }
+        if (ret != 0) {
+            ctx->cur_track = saved_track;
+            return ret;
+        }
+
+        reset_fragments(ctx);
+        for (uint32_t i = 0; i < ctx->top_level_count; ++i) {
+            uint32_t node = ctx->top_level_nodes[i];
+            if (ctx->box_nodes[node].type != MOV_BOX_TYPE('m','o','o','f')) {
+                continue;
+            }
+
+            ret = parse_indexed_box(ctx, node);
+            if (ret != 0) {
+                printf("failed to load fragment at: %lld\n", ctx->box_nodes[node].offset);
+                ctx->cur_track = saved_track;
+                return ret;
+            }
+        }
+        ctx->fragments_loaded = 1;
+    }
+
+    ctx->cur_track = saved_track;
+    return 0;
+}
+
+// Clear the track, keeping buffers of sample tables and indexes.
+static void reset_track(mov_track_t *track)
+{
+    mov_track_t kept = *track;
+
+    // Parameter sets are small, and prefix sums are sized by their table.
+    free(track->sps);
+    free(track->pps);
+    free(track->vps);
+    free(track->decoder_config);
+    free(track->audio_specific_config);
+    free(track->stts_run_first_sample);
+    free(track->stts_run_first_dts);
+    free(track->ctts_run_first_sample);
+    free(track->stsc_run_first_sample);
+    mov_free_packed_index(&track->packed);
+
+    memset(track, 0, sizeof(*track));
+
+    track->stts_sample_counts = kept.stts_sample_counts;
+    track->stts_sample_deltas = kept.stts_sample_deltas;
+    track->stts_capacity = kept.stts_capacity;
+    track->ctts_sample_counts = kept.ctts_sample_counts;
+    track->ctts_sample_offsets = kept.ctts_sample_offsets;
+    track->ctts_capacity = kept.ctts_capacity;
+    track->sample_numbers = kept.sample_numbers;
+    track->sample_number_capacity = kept.sample_number_capacity;
+    track->stsc_first_chunk = kept.stsc_first_chunk;
+    track->stsc_sample_per_chunk = kept.stsc_sample_per_chunk;
+    track->stsc_sample_desc_index = kept.stsc_sample_desc_index;
+    track->stsc_capacity = kept.stsc_capacity;
+    track->sample_lengths = kept.sample_lengths;
+    track->sample_lengths_capacity = kept.sample_lengths_capacity;
+    track->chunk_offsets = kept.chunk_offsets;
+    track->chunk_offset_capacity = kept.chunk_offset_capacity;
+
+    track->samples = kept.samples;
+    track->samples.count = 0;
+    track->fragments = kept.fragments;
+    track->fragment_capacity = kept.fragment_capacity;
+    track->tfra_entries = kept.tfra_entries;
+    track->tfra_capacity = kept.tfra_capacity;
+}
+
+void mov_ctx_reset(mov_ctx_t *ctx)
+{
+    if (ctx->f) {
+        fclose(ctx->f);
+    }
+    for (int i = 0; i != ctx->track_capacity; ++i) {
+        reset_track(ctx->tracks + i);
+    }
+
+    mov_ctx_t kept = *ctx;
+    memset(ctx, 0, sizeof(*ctx));
+
+    ctx->lazy = kept.lazy;
+    ctx->profile = kept.profile;
+    ctx->box_nodes = kept.box_nodes;
+    ctx->box_node_capacity = kept.box_node_capacity;
+    ctx->top_level_nodes = kept.top_level_nodes;
+    ctx->top_level_capacity = kept.top_level_capacity;
+    ctx->segments = kept.segments;
+    ctx->segment_capacity = kept.segment_capacity;
+    ctx->nested_sidx = kept.nested_sidx;
+    ctx->nested_sidx_capacity = kept.nested_sidx_capacity;
+    ctx->tracks = kept.tracks;
+    ctx->track_capacity = kept.track_capacity;
+}
+
+void mov_ctx_free(mov_ctx_t *ctx)
+{
+    mov_ctx_reset(ctx);
+
+    for (int i = 0; i != ctx->track_capacity; ++i) {
+        mov_track_t *track = ctx->tracks + i;
+        free(track->stts_sample_counts);
+        free(track->stts_sample_deltas);
+        free(track->ctts_sample_counts);
+        free(track->ctts_sample_offsets);
+        free(track->sample_numbers);
+        free(track->stsc_first_chunk);
+        free(track->stsc_sample_per_chunk);
+        free(track->stsc_sample_desc_index);
+        free(track->sample_lengths);
+        free(track->chunk_offsets);
+        mov_free_sample_index(&track->samples);
+        free(track->fragments);
+        free(track->tfra_entries);
+    }
+    free(ctx->tracks);
+    free(ctx->box_nodes);
+    free(ctx->top_level_nodes);
+    free(ctx->segments);
+    free(ctx->nested_sidx);
+
+    int lazy = ctx->lazy;
+    int profile = ctx->profile;
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->lazy = lazy;
+    ctx->profile = profile;
+}
+
+// Write the path of the node, like "moov/trak[2]/mdia". Boxes with siblings
+// of the same type get their 1-based position among them.
+static void write_box_path(const mov_ctx_t *ctx, int32_t node_index, const uint32_t *ordinals,
+    const uint8_t *repeated, FILE *out)
+{
+    const mov_box_node_t *node = ctx->box_nodes + node_index;
+    if (node->parent >= 0) {
+        write_box_path(ctx, node->parent, ordinals, repeated, out);
+        fputc('/', out);
+    }
+
+    char type[5];
+    memcpy(type, &node->type, 4);
+    type[4] = '\0';
+    for (int i = 0; i != 4; ++i) {
+        // Keep the JSON string valid.
+        if ((uint8_t)type[i] < 0x20 || type[i] == '"' || type[i] == '\\' || (uint8_t)type[i] >= 0x7F) {
+            type[i] = '_';
+        }
+    }
+    fputs(type, out);
+    if (repeated[node_index]) {
+        fprintf(out, "[%u]", ordinals[node_index]);
+    }
+}
+
+int mov_write_box_profile(mov_ctx_t *ctx, FILE *out)
+{
+    uint32_t count = ctx->box_node_count;
+
+    // Position of each box among siblings of its type, found through a hash
+    // table of (parent, type) keys, so thousands of 'moof' stay cheap.
+    uint32_t table_size = 64;
+    while (table_size < 2 * count) {
+        table_size *= 2;
+    }
+    int32_t *last = malloc(table_size * sizeof(int32_t));
+    uint32_t *ordinals = malloc((count + 1) * sizeof(uint32_t));
+    uint8_t *repeated = calloc(count + 1, 1);
+    if (!last || !ordinals || !repeated) {
+        printf("failed to allocate box profile\n");
+        free(last);
+        free(ordinals);
+        free(repeated);
+        return -1;
+    }
+    for (uint32_t i = 0; i != table_size; ++i) {
+        last[i] = -1;
+    }
+
+    for (uint32_t i = 0; i != count; ++i) {
+        const mov_box_node_t *node = ctx->box_nodes + i;
+        uint32_t h = ((uint32_t)node->parent * 2654435761u ^ node->type) & (table_size - 1);
+        while (last[h] >= 0 && (ctx->box_nodes[last[h]].parent != node->parent ||
+            ctx->box_nodes[last[h]].type != node->type)) {
+            h = (h + 1) & (table_size - 1);
+        }
+        if (last[h] >= 0) {
+            // Number the first one too.
+            ordinals[i] = ordinals[last[h]] + 1;
+            repeated[last[h]] = 1;
+            repeated[i] = 1;
+        } else {
+            ordinals[i] = 1;
+        }
+        last[h] = (int32_t)i;
+    }
+
+    fprintf(out, "{\n  \"file_size\": %lld,\n  \"boxes\": [", ctx->file_size);
+    for (uint32_t i = 0; i != count; ++i) {
+        const mov_box_node_t *node = ctx->box_nodes + i;
+        fprintf(out, "%s\n    {\"path\": \"", i ? "," : "");
+        write_box_path(ctx, (int32_t)i, ordinals, repeated, out);
+        fprintf(out, "\", \"offset\": %lld, \"size\": %lld, \"entries\": %u, \"bytes_read\": %llu, "
+            "\"wall_us\": %llu, \"cpu_us\": %llu}",
+            node->offset, node->size, node->entry_count, node->bytes_read, node->wall_us, node->cpu_us);
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    free(last);
+    free(ordinals);
+    free(repeated);
+    return ferror(out) ? -1 : 0;
+}
+
+int mov_read_mfra(mov_ctx_t *ctx)
+{
+    if (ctx->mfra_offset) {
+        return 0;
+    }
+    if (ctx->file_size < 16) {
+        return -1;
+    }
+
+    int ret = -1;
+    int64_t saved_pos = _ftelli64(ctx->f);
+    int32_t saved_node = ctx->cur_box_node;
+
+    // 'mfro' is the last box of the file and holds the size of 'mfra'.
+    _fseeki64(ctx->f, ctx->file_size - 16, SEEK_SET);
+    mov_atom_t atom = read_box_atom_head(ctx);
+    if (atom.type == MOV_BOX_TYPE('m','f','r','o') && atom.size == 8) {
+        read_int8_mov(ctx);     // version
+        read_int24_mov(ctx);    // flags
+        uint32_t mfra_size = read_int32_mov(ctx);
+
+        int64_t mfra_offset = ctx->file_size - mfra_size;
+        if (mfra_size >= 16 && mfra_offset >= 0) {
+            _fseeki64(ctx->f, mfra_offset, SEEK_SET);
+            read_int32_mov(ctx);
+            uint32_t type = read_box_type(ctx);
+            _fseeki64(ctx->f, mfra_offset, SEEK_SET);
+
+            if (type == MOV_BOX_TYPE('m','f','r','a')) {
+                ctx->cur_box_node = -1;
+                ret = parse_common_box(ctx, MOV_BOX_ROOT);
+                if (ret == 0) {
+                    ctx->mfra_offset = mfra_offset;
+                }
+            }
+        }
+    }
+
+    if (ret != 0) {
+        printf("no 'mfra' found through 'mfro'\n");
+    }
+    ctx->cur_box_node = saved_node;
+    _fseeki64(ctx->f, saved_pos, SEEK_SET);
+    return ret;
+}
+
+// @return Position in "top_level_nodes" of the first box at or after "offset".
+static uint32_t find_top_level_position(const mov_ctx_t *ctx, uint64_t offset)
+{
+    uint32_t lo = 0;
+    uint32_t hi = ctx->top_level_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if ((uint64_t)ctx->box_nodes[ctx->top_level_nodes[mid]].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Top-level boxes are mostly met in file order, 'mfra' read through 'mfro'
+// comes first.
+// @return 0 on success.
+static int add_top_level_node(mov_ctx_t *ctx, uint32_t node)
+{
+    if (ctx->top_level_count == ctx->top_level_capacity) {
+        uint32_t capacity = ctx->top_level_capacity ? 2 * ctx->top_level_capacity : 64;
+        uint32_t *nodes = realloc(ctx->top_level_nodes, capacity * sizeof(uint32_t));
+        if (NULL == nodes) {
+            printf("failed to grow top-level box index\n");
+            return -1;
+        }
+        ctx->top_level_nodes = nodes;
+        ctx->top_level_capacity = capacity;
+    }
+
+    uint32_t pos = find_top_level_position(ctx, ctx->box_nodes[node].offset);
+    memmove(ctx->top_level_nodes + pos + 1, ctx->top_level_nodes + pos,
+        (ctx->top_level_count - pos) * sizeof(uint32_t));
+    ctx->top_level_nodes[pos] = node;
+    ++ctx->top_level_count;
+    return 0;
+}
+
+// Find the top-level box at "offset" in the index, or index it when the
+// top-level walk has not reached it. Boxes indexed here are dropped by the
+// caller restoring "box_node_count", they are not added to "top_level_nodes".
+static int32_t find_top_level_box(mov_ctx_t *ctx, uint64_t offset)
+{
+    uint32_t pos = find_top_level_position(ctx, offset);
+    if (pos < ctx->top_level_count) {
+        uint32_t node = ctx->top_level_nodes[pos];
+        if ((uint64_t)ctx->box_nodes[node].offset == offset) {
+            return (int32_t)node;
+        }
+    }
+
+    _fseeki64(ctx->f, offset, SEEK_SET);
+    mov_atom_t atom = read_box_atom_head(ctx);
+    if (atom.type == 0) {
+        return -1;
+    }
+    ctx->cur_box_node = -1;
+    return add_box_node(ctx, atom, offset);
+}
+
+// Parse 'moof' boxes in [start, end) on top of the samples already read.
+static int read_fragments_in_range(mov_ctx_t *ctx, uint64_t start, uint64_t end)
+{
+    int ret = 0;
+    mov_track_t *saved_track = ctx->cur_track;
+
+    // Children of fragments read on demand are not kept in the index.
+    uint32_t node_count = ctx->box_node_count;
+    uint64_t pos = start;
+    while (pos + 8 <= end) {
+        int32_t node = find_top_level_box(ctx, pos);
+        if (node < 0) {
+            printf("no box at: %llu\n", pos);
+            ret = -1;
             break;
         }
+        if (ctx->box_nodes[node].type == MOV_BOX_TYPE('m','o','o','f')) {
+            ret = parse_indexed_box(ctx, node);
+            if (ret != 0) {
+                break;
+            }
+        }
+        pos = ctx->box_nodes[node].content_pos + ctx->box_nodes[node].size;
+    }
+    ctx->box_node_count = node_count;
+    ctx->cur_track = saved_track;
+    return ret;
+}
+
+int mov_read_fragment(mov_ctx_t *ctx, uint64_t moof_offset)
+{
+    int ret;
+    mov_track_t *saved_track = ctx->cur_track;
+
+    ret = load_all_sample_tables(ctx);
+    ctx->cur_track = saved_track;
+    if (ret != 0) {
+        return ret;
+    }
+
+    uint32_t node_count = ctx->box_node_count;
+    int32_t moof_node = find_top_level_box(ctx, moof_offset);
+    if (moof_node < 0 || ctx->box_nodes[moof_node].type != MOV_BOX_TYPE('m','o','o','f')) {
+        ctx->box_node_count = node_count;
+        printf("no 'moof' at: %llu\n", moof_offset);
+        return -1;
+    }
+    uint64_t moof_end = ctx->box_nodes[moof_node].content_pos + ctx->box_nodes[moof_node].size;
+    ctx->box_node_count = node_count;
+
+    reset_fragments(ctx);
+    ret = read_fragments_in_range(ctx, moof_offset, moof_end);
+    ctx->fragments_loaded = 0;
+    return ret;
+}
+
+int mov_read_segment(mov_ctx_t *ctx, uint32_t index)
+{
+    int ret;
+    mov_track_t *saved_track = ctx->cur_track;
+
+    if (index >= ctx->segment_count) {
+        printf("segment out of range: %u\n", index);
+        return -1;
+    }
+
+    ret = load_all_sample_tables(ctx);
+    ctx->cur_track = saved_track;
+    if (ret != 0) {
+        return ret;
+    }
+
+    mov_segment_t *segment = ctx->segments + index;
+    reset_fragments(ctx);
+    ret = read_fragments_in_range(ctx, segment->offset, segment->offset + segment->size);
+    ctx->fragments_loaded = 0;
+    return ret;
+}
+
+static void sleep_ms(uint32_t ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+// Read type and total size of the top-level box at "pos", without
+// parsing it. The box may extend past current file size.
+// @return 0 on success, -1 if its header is not written yet.
+static int peek_top_level_box(mov_ctx_t *ctx, uint64_t pos, uint32_t *type, uint64_t *size)
+{
+    if (pos + 8 > (uint64_t)ctx->file_size) {
+        return -1;
+    }
+    _fseeki64(ctx->f, pos, SEEK_SET);
+    uint64_t box_size = read_int32_mov(ctx);
+    *type = read_box_type(ctx);
+    if (box_size == 1) {
+        if (pos + 16 > (uint64_t)ctx->file_size) {
+            return -1;
+        }
+        box_size = read_int64_mov(ctx);
+    }
+    if (box_size == 0) {
+        // Box extends to the end of file. Wait for the writer to finish it.
+        box_size = UINT64_MAX;
+    }
+    *size = box_size;
+    return 0;
+}
+
+int mov_follow_file(const char *filename, mov_ctx_t *ctx, uint32_t poll_interval_ms,
+    uint32_t idle_timeout_ms, mov_fragment_callback_t callback, void *opaque)
+{
+    int ret = 0;
+
+    if (ctx->f != NULL) {
+        printf("file stream is not null\n");
+        return -1;
+    }
+
+    ctx->f = fopen(filename, "rb");
+    if (!ctx->f) {
+        printf("failed to open file: %s\n", filename);
+        return -1;
+    }
+
+    // Track indexes only ever hold the fragment being reported.
+    ctx->fragments_loaded = 1;
+    ctx->cur_box_node = -1;
+
+    uint64_t pos = 0;
+    uint32_t idle_ms = 0;
+    for (;;) {
+        _fseeki64(ctx->f, 0, SEEK_END);
+        ctx->file_size = _ftelli64(ctx->f);
+
+        uint32_t type = 0;
+        uint64_t size;
+        uint64_t end = UINT64_MAX;
+        if (peek_top_level_box(ctx, pos, &type, &size) == 0 && size <= UINT64_MAX - pos) {
+            end = pos + size;
+        }
+
+        // A 'moof' is reported once its 'mdat' is complete as well.
+        uint64_t data_end = end;
+        if (end <= (uint64_t)ctx->file_size && type == MOV_BOX_TYPE('m','o','o','f')) {
+            uint32_t next_type;
+            uint64_t next_size;
+            if (peek_top_level_box(ctx, end, &next_type, &next_size) != 0) {
+                data_end = UINT64_MAX;
+            } else if (next_type == MOV_BOX_TYPE('m','d','a','t')) {
+                data_end = next_size <= UINT64_MAX - end ? end + next_size : UINT64_MAX;
+            }
+        }
+
+        if (end > (uint64_t)ctx->file_size || data_end > (uint64_t)ctx->file_size) {
+            if (idle_timeout_ms && idle_ms >= idle_timeout_ms) {
+                printf("file not grown for %u ms, stop following at: %llu\n", idle_ms, pos);
+                break;
+            }
+            sleep_ms(poll_interval_ms);
+            idle_ms += poll_interval_ms;
+            continue;
+        }
+        idle_ms = 0;
+
+        if (type == MOV_BOX_TYPE('m','o','o','f')) {
+            mov_track_t *saved_track = ctx->cur_track;
+            ret = load_all_sample_tables(ctx);
+            ctx->cur_track = saved_track;
+            if (ret != 0) {
+                break;
+            }
+
+            reset_fragments(ctx);
+            ret = read_fragments_in_range(ctx, pos, end);
+            if (ret != 0) {
+                printf("failed to read fragment at: %llu\n", pos);
+                break;
+            }
+            uint64_t moof_offset = pos;
+            pos = data_end;
+            ctx->resume_pos = pos;
+
+            if (callback && callback(ctx, moof_offset, opaque) != 0) {
+                break;
+            }
+        } else if (type == MOV_BOX_TYPE('m','d','a','t')) {
+            // Media data is not indexed, the index would grow with the recording.
+            pos = end;
+        } else {
+            _fseeki64(ctx->f, pos, SEEK_SET);
+            ret = parse_common_box(ctx, MOV_BOX_ROOT);
+            if (ret != 0) {
+                break;
+            }
+            pos = end;
+        }
+        ctx->resume_pos = pos;
+    }
+
+    return ret;
+}
+
+// Read the decode time of the track from 'tfhd' and 'tfdt' of a 'moof',
+// without parsing its runs.
+// @return 0 on success, 1 if the fragment does not carry the track.
+static int peek_fragment_time(mov_ctx_t *ctx, const mov_box_node_t *moof, uint32_t trackid, uint64_t *time)
+{
+    int64_t moof_end = moof->content_pos + moof->size;
+    int64_t pos = moof->content_pos;
+    while (pos + 8 <= moof_end) {
+        _fseeki64(ctx->f, pos, SEEK_SET);
+        mov_atom_t atom = read_box_atom_head(ctx);
+        if (atom.size < 0 || atom.content_pos + atom.size > moof_end) {
+            printf("bad box in 'moof' at: %lld\n", pos);
+            return -1;
+        }
+
+        if (atom.type == MOV_BOX_TYPE('t','r','a','f')) {
+            // 'tfhd' comes first in 'traf'.
+            int64_t traf_end = atom.content_pos + atom.size;
+            int64_t child = atom.content_pos;
+            int is_track = 0;
+            while (child + 8 <= traf_end) {
+                _fseeki64(ctx->f, child, SEEK_SET);
+                mov_atom_t sub = read_box_atom_head(ctx);
+                if (sub.size < 0 || sub.content_pos + sub.size > traf_end) {
+                    printf("bad box in 'traf' at: %lld\n", child);
+                    return -1;
+                }
+                if (sub.type == MOV_BOX_TYPE('t','f','h','d')) {
+                    read_int32_mov(ctx);    // version and flags
+                    if (read_int32_mov(ctx) != trackid) {
+                        break;
+                    }
+                    is_track = 1;
+                } else if (is_track && sub.type == MOV_BOX_TYPE('t','f','d','t')) {
+                    uint8_t version = read_int8_mov(ctx);
+                    read_int24_mov(ctx);
+                    *time = 1 == version ? read_int64_mov(ctx) : read_int32_mov(ctx);
+                    return 0;
+                }
+                child = sub.content_pos + sub.size;
+            }
+            if (is_track) {
+                printf("no 'tfdt' of track %u in 'moof' at: %lld\n", trackid, moof->offset);
+                return -1;
+            }
+        }
+        pos = atom.content_pos + atom.size;
+    }
+    return 1;
+}
+
+int mov_seek_fragment(mov_ctx_t *ctx, mov_track_t *track, uint64_t time, uint64_t *moof_offset)
+{
+    int ret;
+    uint64_t offset;
+
+    if (track->tfra_count) {
+        // Last random access point at or before "time".
+        uint32_t lo = 0;
+        uint32_t hi = track->tfra_count;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (track->tfra_entries[mid].time <= time) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        offset = track->tfra_entries[lo ? lo - 1 : 0].moof_offset;
+    } else {
+        // Without 'tfra', probe top-level 'moof' boxes by decode time.
+        ret = resume_top_level_boxes(ctx);
+        if (ret != 0) {
+            return ret;
+        }
+
+        uint32_t moof_count = 0;
+        uint32_t *moof_nodes = malloc((ctx->top_level_count + 1) * sizeof(uint32_t));
+        if (NULL == moof_nodes) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < ctx->top_level_count; ++i) {
+            uint32_t node = ctx->top_level_nodes[i];
+            if (ctx->box_nodes[node].type == MOV_BOX_TYPE('m','o','o','f')) {
+                moof_nodes[moof_count++] = node;
+            }
+        }
+        if (moof_count == 0) {
+            free(moof_nodes);
+            printf("no fragment in file\n");
+            return -1;
+        }
+
+        // Fragments of the track in [lo, hi) are not compared yet, the ones
+        // before start at or before "time", the ones after start later.
+        // Fragments without the track are skipped, they bound nothing.
+        uint32_t lo = 0;
+        uint32_t hi = moof_count;
+        uint32_t found = moof_count;
+        uint64_t frag_time = 0;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            uint32_t k = mid;
+            ret = 1;
+            while (k < hi && (ret = peek_fragment_time(ctx, &ctx->box_nodes[moof_nodes[k]], track->trackid, &frag_time)) == 1) {
+                ++k;
+            }
+            if (ret < 0) {
+                free(moof_nodes);
+                return ret;
+            }
+            if (k == hi || frag_time > time) {
+                hi = mid;
+            } else {
+                found = k;
+                lo = k + 1;
+            }
+        }
+
+        // Before the first fragment of the track, start with it.
+        for (uint32_t k = 0; found == moof_count && k < moof_count; ++k) {
+            ret = peek_fragment_time(ctx, &ctx->box_nodes[moof_nodes[k]], track->trackid, &frag_time);
+            if (ret < 0) {
+                free(moof_nodes);
+                return ret;
+            }
+            if (ret == 0) {
+                found = k;
+            }
+        }
+        if (found == moof_count) {
+            free(moof_nodes);
+            printf("no fragment of track: %u\n", track->trackid);
+            return -1;
+        }
+        offset = ctx->box_nodes[moof_nodes[found]].offset;
+        free(moof_nodes);
     }
 
+    ret = mov_read_fragment(ctx, offset);
+    if (ret != 0) {
+        return ret;
+    }
+    if (moof_offset) {
+        *moof_offset = offset;
+    }
     return 0;
 }
 
@@ -163,36 +1133,183 @@ static mov_atom_t read_box_atom_head(mov_ctx_t *ctx)
         atom.size = size;
         atom.size -= 8;
     }
-
-    return atom;
+    atom.content_pos = _ftelli64(ctx->f);
+
+    return atom;
+}
+
+static mov_box_handler_func_t get_box_handler(uint32_t box_type)
+{
+    switch (box_type) {
+    case MOV_BOX_TYPE('m','o','o','v'): return parse_moov_box;
+    case MOV_BOX_TYPE('m','v','h','d'): return parse_mvhd_box;
+    case MOV_BOX_TYPE('t','r','a','k'): return parse_trak_box;
+    case MOV_BOX_TYPE('t','k','h','d'): return parse_tkhd_box;
+    case MOV_BOX_TYPE('m','d','i','a'): return parse_mdia_box;
+    case MOV_BOX_TYPE('m','d','h','d'): return parse_mdhd_box;
+    case MOV_BOX_TYPE('h','d','l','r'): return parse_hdlr_box;
+    case MOV_BOX_TYPE('m','i','n','f'): return parse_minf_box;
+    case MOV_BOX_TYPE('s','t','b','l'): return parse_stbl_box;
+    case MOV_BOX_TYPE('s','t','s','d'): return parse_stsd_box;
+    case MOV_BOX_TYPE('s','t','t','s'): return parse_stts_box;
+    case MOV_BOX_TYPE('c','t','t','s'): return parse_ctts_box;
+    case MOV_BOX_TYPE('s','t','s','s'): return parse_stss_box;
+    case MOV_BOX_TYPE('s','t','s','c'): return parse_stsc_box;
+    case MOV_BOX_TYPE('s','t','s','z'): return parse_stsz_box;
+    case MOV_BOX_TYPE('s','t','c','o'): return parse_stco_box;
+    case MOV_BOX_TYPE('c','o','6','4'): return parse_stco_box;
+
+    case MOV_BOX_TYPE('a','v','c','1'): return parse_visual_sample_entry;
+    case MOV_BOX_TYPE('a','v','c','3'): return parse_visual_sample_entry;
+    case MOV_BOX_TYPE('h','v','c','1'): return parse_visual_sample_entry;
+    case MOV_BOX_TYPE('h','e','v','1'): return parse_visual_sample_entry;
+    case MOV_BOX_TYPE('m','p','4','a'): return parse_audio_sample_entry;
+    case MOV_BOX_TYPE('a','v','c','C'): return parse_avcC_box;
+    case MOV_BOX_TYPE('h','v','c','C'): return parse_hvcC_box;
+    case MOV_BOX_TYPE('e','s','d','s'): return parse_esds_box;
+
+    case MOV_BOX_TYPE('m','v','e','x'): return parse_mvex_box;
+    case MOV_BOX_TYPE('t','r','e','x'): return parse_trex_box;
+    case MOV_BOX_TYPE('m','o','o','f'): return parse_moof_box;
+    case MOV_BOX_TYPE('m','f','h','d'): return parse_mfhd_box;
+    case MOV_BOX_TYPE('t','r','a','f'): return parse_traf_box;
+    case MOV_BOX_TYPE('t','f','h','d'): return parse_tfhd_box;
+    case MOV_BOX_TYPE('t','f','d','t'): return parse_tfdt_box;
+    case MOV_BOX_TYPE('t','r','u','n'): return parse_trun_box;
+
+    case MOV_BOX_TYPE('s','i','d','x'): return parse_sidx_box;
+    case MOV_BOX_TYPE('m','f','r','a'): return parse_mfra_box;
+    case MOV_BOX_TYPE('t','f','r','a'): return parse_tfra_box;
+    default: return NULL;
+    }
+}
+
+static const uint32_t *get_allowed_children(uint32_t parent_type)
+{
+    switch (parent_type) {
+    case MOV_BOX_ROOT: return root_children;
+    case MOV_BOX_TYPE('m','o','o','v'): return moov_children;
+    case MOV_BOX_TYPE('t','r','a','k'): return trak_children;
+    case MOV_BOX_TYPE('m','v','e','x'): return mvex_children;
+    case MOV_BOX_TYPE('m','d','i','a'): return mdia_children;
+    case MOV_BOX_TYPE('m','i','n','f'): return minf_children;
+    case MOV_BOX_TYPE('s','t','b','l'): return stbl_children;
+    case MOV_BOX_TYPE('s','t','s','d'): return stsd_children;
+    case MOV_BOX_TYPE('a','v','c','1'): return avc1_children;
+    case MOV_BOX_TYPE('a','v','c','3'): return avc1_children;
+    case MOV_BOX_TYPE('h','v','c','1'): return hvc1_children;
+    case MOV_BOX_TYPE('h','e','v','1'): return hvc1_children;
+    case MOV_BOX_TYPE('m','p','4','a'): return mp4a_children;
+    case MOV_BOX_TYPE('m','o','o','f'): return moof_children;
+    case MOV_BOX_TYPE('t','r','a','f'): return traf_children;
+    case MOV_BOX_TYPE('m','f','r','a'): return mfra_children;
+    default: return NULL;
+    }
+}
+
+static int is_child_box_allowed(uint32_t parent_type, uint32_t box_type)
+{
+    const uint32_t *children = get_allowed_children(parent_type);
+    if (NULL == children) {
+        return 0;
+    }
+    for (int i = 0; children[i]; ++i) {
+        if (children[i] == box_type) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
-static const mov_box_handler_t *get_box_handler(uint32_t box_type)
+static int32_t add_box_node(mov_ctx_t *ctx, mov_atom_t atom, int64_t start_pos)
 {
-    for (int i = 0; mov_box_handlers[i].type; ++i) {
-        if (mov_box_handlers[i].type == box_type) {
-            return mov_box_handlers + i;
+    if (ctx->box_node_count == ctx->box_node_capacity) {
+        uint32_t capacity = ctx->box_node_capacity ? 2 * ctx->box_node_capacity : 64;
+        mov_box_node_t *nodes = realloc(ctx->box_nodes, capacity * sizeof(mov_box_node_t));
+        if (NULL == nodes) {
+            printf("failed to grow box index\n");
+            return -1;
         }
+        ctx->box_nodes = nodes;
+        ctx->box_node_capacity = capacity;
+    }
+
+    mov_box_node_t *node = ctx->box_nodes + ctx->box_node_count;
+    node->type = atom.type;
+    node->parent = ctx->cur_box_node;
+    node->offset = start_pos;
+    node->content_pos = atom.content_pos;
+    node->size = atom.size;
+    node->entry_count = 0;
+    node->bytes_read = 0;
+    node->wall_us = 0;
+    node->cpu_us = 0;
+    return (int32_t)ctx->box_node_count++;
+}
+
+// Boxes of every fragment would grow the index with the length of a
+// recording. Only top-level boxes and boxes outside 'moof' are indexed,
+// unless the index is used for lazy loading or profiling.
+static int is_box_indexed(mov_ctx_t *ctx, int32_t parent_node)
+{
+    if (ctx->lazy || ctx->profile || parent_node == -1) {
+        return 1;
     }
-    return NULL;
+    return parent_node >= 0 && ctx->box_nodes[parent_node].type != MOV_BOX_TYPE('m','o','o','f');
 }
 
-static int parse_common_box(mov_ctx_t *ctx)
+// In lazy mode, sample tables and fragments are only indexed here.
+static int is_deferred_box(mov_ctx_t *ctx, uint32_t parent_type, uint32_t box_type)
 {
-    int ret;
+    if (!ctx->lazy) {
+        return 0;
+    }
+    if (parent_type == MOV_BOX_TYPE('s','t','b','l')) {
+        return box_type != MOV_BOX_TYPE('s','t','s','d');
+    }
+    return parent_type == MOV_BOX_ROOT && box_type == MOV_BOX_TYPE('m','o','o','f');
+}
+
+static int parse_common_box(mov_ctx_t *ctx, uint32_t parent_type)
+{
+    int ret = 0;
+    int64_t start_pos = _ftelli64(ctx->f);
+    box_profile_t profile;
+    profile_begin(ctx, &profile, start_pos);
     mov_atom_t atom = read_box_atom_head(ctx);
 
     printf("box encountered: %s\n", atom.str_type);
     //printf("  box start file pos: %lld\n", start_pos);
 
-    int64_t content_start_pos = _ftelli64(ctx->f);
+    int64_t content_start_pos = atom.content_pos;
 
     printf("  box size: %lld\n", atom.size);
 
-    // Find parse function for current box.
-    const mov_box_handler_t *box_handler = get_box_handler(atom.type);
-    if (box_handler) {
-        ret = box_handler->box_handler_func(ctx, atom);
+    int32_t parent_node = ctx->cur_box_node;
+    if (is_box_indexed(ctx, parent_node)) {
+        ctx->cur_box_node = add_box_node(ctx, atom, start_pos);
+        if (ctx->cur_box_node < 0 ||
+            (parent_node == -1 && add_top_level_node(ctx, (uint32_t)ctx->cur_box_node) != 0)) {
+            ctx->cur_box_node = parent_node;
+            return -1;
+        }
+    } else {
+        ctx->cur_box_node = MOV_BOX_NODE_NONE;
+    }
+
+    // Find parse function for current box. Only boxes the schema allows
+    // inside current parent are parsed, the rest are skipped as a whole
+    // without looking up a handler, known box or not.
+    mov_box_handler_func_t box_handler = NULL;
+    if (is_child_box_allowed(parent_type, atom.type)) {
+        box_handler = get_box_handler(atom.type);
+    }
+
+    if (box_handler && is_deferred_box(ctx, parent_type, atom.type)) {
+        ret = skip_bytes_mov(ctx, atom.size);
+        printf("  mov box deferred: %s\n", atom.str_type);
+    } else if (box_handler) {
+        ret = box_handler(ctx, atom);
     } else {
         // Skip this box.
         ret = skip_bytes_mov(ctx, atom.size);
@@ -203,23 +1320,29 @@ static int parse_common_box(mov_ctx_t *ctx)
     }
 
     int64_t cur_pos = _ftelli64(ctx->f);
+    profile_end(ctx, &profile, ctx->cur_box_node, cur_pos);
     if (cur_pos - content_start_pos != atom.size) {
         printf("  box parsing incomplete! type: %s, remaining size: %lld. Seek forcely.\n",
             atom.str_type, content_start_pos + atom.size - cur_pos);
+        if (content_start_pos + atom.size > cur_pos) {
+            ctx->skipped_bytes += content_start_pos + atom.size - cur_pos;
+        }
         _fseeki64(ctx->f, content_start_pos + atom.size, SEEK_SET);
     }
 
     //printf("  current file pos: %lld\n", _ftelli64(ctx->f));
 
+    ctx->cur_box_node = parent_node;
     return ret;
 }
 
+// Parse children of "atom" from current file position to the end of "atom".
 static int parse_sub_boxes(mov_ctx_t *ctx, mov_atom_t atom)
 {
     int ret;
-    int64_t end_pos = _ftelli64(ctx->f) + atom.size;
-    while (_ftelli64(ctx->f) < end_pos) {
-        ret = parse_common_box(ctx);
+    int64_t end_pos = atom.content_pos + atom.size;
+    while (_ftelli64(ctx->f) + 8 <= end_pos) {
+        ret = parse_common_box(ctx, atom.type);
         if (ret != 0) {
             printf("parse_sub_boxes failed.\n");
             return ret;
@@ -334,16 +1457,20 @@ static int parse_tkhd_box(mov_ctx_t *ctx, mov_atom_t atom)
 
     printf("  width: %d, height: %d\n", width, height);
 
-    // Create new track.
+    // Create new track. Tracks kept by mov_ctx_reset() are reused.
+    if (ctx->track_capacity <= (int)trackid) {
+        mov_track_t *tracks = realloc(ctx->tracks, (trackid + 1) * sizeof(mov_track_t));
+        if (NULL == tracks) {
+            printf("  failed to allocate track: %u\n", trackid);
+            return -1;
+        }
+        memset(tracks + ctx->track_capacity, 0,
+            (trackid + 1 - ctx->track_capacity) * sizeof(mov_track_t));
+        ctx->tracks = tracks;
+        ctx->track_capacity = trackid + 1;
+    }
     if (ctx->track_count <= (int)trackid) {
-        void *old_tracks = ctx->tracks;
-        int old_count = ctx->track_count;
-
-        ctx->tracks = calloc(trackid + 1, sizeof(mov_track_t));
         ctx->track_count = trackid + 1;
-        memset(ctx->tracks, 0, ctx->track_count * sizeof(mov_track_t));
-        memcpy(ctx->tracks, old_tracks, old_count * sizeof(mov_track_t));
-        free(old_tracks);
     }
     ctx->cur_track = ctx->tracks + trackid;
     ctx->cur_track->valid = 1;
@@ -448,118 +1575,113 @@ static int parse_minf_box(mov_ctx_t *ctx, mov_atom_t atom)
 static int parse_stbl_box(mov_ctx_t *ctx, mov_atom_t atom)
 {
     //printf("start parsing 'minf'\n");
-    return parse_sub_boxes(ctx, atom);
+    ctx->cur_track->stbl_node = ctx->cur_box_node;
+
+    int ret = parse_sub_boxes(ctx, atom);
+    ctx->cur_track->tables_loaded = !ctx->lazy;
+    return ret;
 }
 
 static int parse_stsd_box(mov_ctx_t *ctx, mov_atom_t atom)
 {
-    int ret = 0;
-
     if (NULL == ctx->cur_track) {
         printf("  NO track is current!\n");
         return -1;
     }
-    mov_track_t *cur_track = ctx->cur_track;
 
     read_int8_mov(ctx);     // version
     read_int24_mov(ctx);    // flags
 
     uint32_t entry_count = read_int32_mov(ctx);
+    set_box_entry_count(ctx, entry_count);
+    printf("  stsd entry_count: %u\n", entry_count);
 
-    for (int i = 0; i != entry_count; ++i) {
-        if (cur_track->is_video) {
-            mov_atom_t video_entry_atom = read_box_atom_head(ctx);
-            memcpy(cur_track->codec_format, &video_entry_atom.type, 4);
-            cur_track->codec_format[4] = '\0';
-
-            // SampleEntry
-            skip_bytes_mov(ctx, 6 * sizeof(uint8_t));
-            uint16_t data_ref_index = read_int16_mov(ctx);
-
-            // VisualSampleEntry
-            read_int16_mov(ctx);    // pre_defined
-            read_int16_mov(ctx);    // reserved
-            skip_bytes_mov(ctx, 3 * sizeof(uint32_t));  // pre_defined
-            uint16_t width = read_int16_mov(ctx);
-            uint16_t height = read_int16_mov(ctx);
-            read_int32_mov(ctx);    // horiz resolution
-            read_int32_mov(ctx);    // verti resolution
-            read_int32_mov(ctx);    // reserved
-            read_int16_mov(ctx);    // frame count
-
-            read_bytes_mov(ctx, 32, cur_track->compressor_name);
-            cur_track->compressor_name[32] = '\0';
-
-            uint16_t depth = read_int16_mov(ctx);
-            read_int16_mov(ctx);    // pre-defined
-
-            // ISO/IEC 14496-15
-            // read avc configuration.
-            if (strncmp(cur_track->codec_format, "avc1", 4) == 0) {
-                // read "avcC" Box
-                mov_atom_t avcC_atom = read_box_atom_head(ctx);
-                if (strncmp("avcC", avcC_atom.str_type, 4) == 0) {
-                    ret = parse_avcC_box(ctx, avcC_atom);
-                } else {
-                    printf("  NOT 'avcC' box!\n");
-                }
-                
-                // maybe skip the rest. depends on outer box seek.
-                printf("  may have remaining data not parsed. currently skipping.\n");
-            } else if (strncmp(cur_track->codec_format, "hvc1", 4) == 0) {
-                mov_atom_t hevC_atom = read_box_atom_head(ctx);
-                printf("  hvc1 sub-box type: %s\n", hevC_atom.str_type);
-
-                if (strncmp("hvcC", hevC_atom.str_type, 4) == 0) {
-                    ret = parse_hvcC_box(ctx, hevC_atom);
-                } else {
-                    printf("  NOT 'avcC' box!\n");
-                }
-            } else {
-                printf("  currently not supported. video codec format: %s\n",
-                    cur_track->codec_format);
-            }
-        } else if (cur_track->is_audio) {
-            mov_atom_t audio_entry_atom = read_box_atom_head(ctx);
-            memcpy(cur_track->codec_format, &audio_entry_atom.type, 4);
-            cur_track->codec_format[4] = '\0';
-
-            // SampleEntry
-            skip_bytes_mov(ctx, 6 * sizeof(uint8_t));
-            uint16_t data_ref_index = read_int16_mov(ctx);
-
-            // AudioSampleEntry
-            skip_bytes_mov(ctx, 2 * sizeof(uint32_t));
-            uint16_t channel_count = read_int16_mov(ctx);
-            uint16_t sample_size = read_int16_mov(ctx);
-            read_int16_mov(ctx);    // predefined
-            read_int16_mov(ctx);    // reserved
-            uint32_t sample_rate = read_int32_mov(ctx) >> 16;
-
-            cur_track->channel_count = channel_count;
-            cur_track->audio_sample_size = sample_size;
-            cur_track->audio_sample_rate = sample_rate;
-
-            // ISO/IEC 14496-14
-            if (strncmp("mp4a", cur_track->codec_format, 4) == 0) {
-                mov_atom_t esds_atom = read_box_atom_head(ctx);
-                if (strncmp("esds", esds_atom.str_type, 4) == 0) {
-                    ret = parse_esds_box(ctx, esds_atom);
-                    if (ret != 0) {
-                        printf(" failed to parse 'esds' box");
-                    }
-                } else {
-                    printf("  unrecognized sub-box of 'mp4a'\n");
-                }
-            }
+    // Sample entries are boxes themselves.
+    return parse_sub_boxes(ctx, atom);
+}
 
-            printf("  audio sample size: %hu, sample rate: %hu, channel_count: %hu\n",
-                cur_track->audio_sample_size, cur_track->audio_sample_rate,
-                cur_track->channel_count);
-        }
+static int parse_visual_sample_entry(mov_ctx_t *ctx, mov_atom_t atom)
+{
+    mov_track_t *cur_track = ctx->cur_track;
+    if (!cur_track->is_video) {
+        printf("  visual sample entry in non-video track: %s\n", atom.str_type);
+        return 0;
     }
 
-    return 0;
+    memcpy(cur_track->codec_format, &atom.type, 4);
+    cur_track->codec_format[4] = '\0';
+
+    // SampleEntry
+    skip_bytes_mov(ctx, 6 * sizeof(uint8_t));
+    uint16_t data_ref_index = read_int16_mov(ctx);
+    cur_track->data_ref_index = data_ref_index;
+
+    // VisualSampleEntry
+    read_int16_mov(ctx);    // pre_defined
+    read_int16_mov(ctx);    // reserved
+    skip_bytes_mov(ctx, 3 * sizeof(uint32_t));  // pre_defined
+    uint16_t width = read_int16_mov(ctx);
+    uint16_t height = read_int16_mov(ctx);
+    read_int32_mov(ctx);    // horiz resolution
+    read_int32_mov(ctx);    // verti resolution
+    read_int32_mov(ctx);    // reserved
+    read_int16_mov(ctx);    // frame count
+
+    read_bytes_mov(ctx, 32, cur_track->compressor_name);
+    cur_track->compressor_name[32] = '\0';
+
+    uint16_t depth = read_int16_mov(ctx);
+    read_int16_mov(ctx);    // pre-defined
+    cur_track->depth = depth;
+
+    // ISO/IEC 14496-15. "avcC" or "hvcC" follows, with other optional boxes.
+    return parse_sub_boxes(ctx, atom);
+}
+
+static int parse_audio_sample_entry(mov_ctx_t *ctx, mov_atom_t atom)
+{
+    mov_track_t *cur_track = ctx->cur_track;
+    if (!cur_track->is_audio) {
+        printf("  audio sample entry in non-audio track: %s\n", atom.str_type);
+        return 0;
+    }
+
+    memcpy(cur_track->codec_format, &atom.type, 4);
+    cur_track->codec_format[4] = '\0';
+
+    // SampleEntry
+    skip_bytes_mov(ctx, 6 * sizeof(uint8_t));
+    uint16_t data_ref_index = read_int16_mov(ctx);
+    cur_track->data_ref_index = data_ref_index;
+
+    // AudioSampleEntry
+    skip_bytes_mov(ctx, 2 * sizeof(uint32_t));
+    uint16_t channel_count = read_int16_mov(ctx);
+    uint16_t sample_size = read_int16_mov(ctx);
+    read_int16_mov(ctx);    // predefined
+    read_int16_mov(ctx);    // reserved
+    uint32_t sample_rate = read_int32_mov(ctx) >> 16;
+
+    cur_track->channel_count = channel_count;
+    cur_track->audio_sample_size = sample_size;
+    cur_track->audio_sample_rate = sample_rate;
+
+    printf("  audio sample size: %hu, sample rate: %u, channel_count: %hu\n",
+        cur_track->audio_sample_size, cur_track->audio_sample_rate,
+        cur_track->channel_count);
+
+    // ISO/IEC 14496-14. "esds" follows.
+    return parse_sub_boxes(ctx, atom);
+}
+
+// Reuse a table buffer kept by mov_ctx_reset() if it is large enough.
+static void *reuse_table(void *table, uint32_t capacity, uint32_t count, size_t entry_size)
+{
+    if (table && count <= capacity) {
+        return table;
+    }
+    free(table);
+    return malloc(count ? count * entry_size : 1);
 }
 
 static int parse_stts_box(mov_ctx_t *ctx, mov_atom_t atom)
@@ -570,16 +1692,31 @@ static int parse_stts_box(mov_ctx_t *ctx, mov_atom_t atom)
     read_int24_mov(ctx);    // flags
 
     uint32_t entry_count = read_int32_mov(ctx);
+    set_box_entry_count(ctx, entry_count);
     cur_track->stts_entry_count = entry_count;
-    cur_track->stts_sample_counts = calloc(entry_count, sizeof(uint32_t));
-    cur_track->stts_sample_deltas = calloc(entry_count, sizeof(uint32_t));
+    cur_track->stts_sample_counts = reuse_table(cur_track->stts_sample_counts,
+        cur_track->stts_capacity, entry_count, sizeof(uint32_t));
+    cur_track->stts_sample_deltas = reuse_table(cur_track->stts_sample_deltas,
+        cur_track->stts_capacity, entry_count, sizeof(uint32_t));
+    cur_track->stts_capacity = MOV_MAX(cur_track->stts_capacity, entry_count);
+    if (!cur_track->stts_sample_counts || !cur_track->stts_sample_deltas) {
+        printf("  failed to allocate stts\n");
+        return -1;
+    }
 
-    for (int i = 0; i != entry_count; ++i) {
-        uint32_t sample_count = read_int32_mov(ctx);
-        uint32_t sample_delta = read_int32_mov(ctx);
+    uint32_t *columns[] = { cur_track->stts_sample_counts, cur_track->stts_sample_deltas };
+    if (read_int32_columns(ctx->f, columns, 2, entry_count) != 0) {
+        printf("  stts truncated\n");
+    }
 
-        cur_track->stts_sample_counts[i] = sample_count;
-        cur_track->stts_sample_deltas[i] = sample_delta;
+    // Fragments without 'tfdt' follow the samples of 'moov'.
+    uint64_t end_dts = 0;
+    for (uint32_t i = 0; i != entry_count; ++i) {
+        end_dts += (uint64_t)cur_track->stts_sample_counts[i] * cur_track->stts_sample_deltas[i];
+    }
+    cur_track->moov_end_dts = end_dts;
+    if (cur_track->fragment_count == 0) {
+        cur_track->next_frag_dts = end_dts;
     }
 
     printf("  stts entry_count: %u\n", entry_count);
@@ -600,17 +1737,22 @@ static int parse_ctts_box(mov_ctx_t *ctx, mov_atom_t atom)
     read_int24_mov(ctx);    // flags
 
     uint32_t entry_count = read_int32_mov(ctx);
+    set_box_entry_count(ctx, entry_count);
 
     cur_track->ctts_entry_count = entry_count;
-    cur_track->ctts_sample_counts = calloc(entry_count, sizeof(uint32_t));
-    cur_track->ctts_sample_offsets = calloc(entry_count, sizeof(uint32_t));
-
-    for (int i = 0; i != entry_count; ++i) {
-        uint32_t sample_count = read_int32_mov(ctx);
-        uint32_t sample_offset = read_int32_mov(ctx);
+    cur_track->ctts_sample_counts = reuse_table(cur_track->ctts_sample_counts,
+        cur_track->ctts_capacity, entry_count, sizeof(uint32_t));
+    cur_track->ctts_sample_offsets = reuse_table(cur_track->ctts_sample_offsets,
+        cur_track->ctts_capacity, entry_count, sizeof(uint32_t));
+    cur_track->ctts_capacity = MOV_MAX(cur_track->ctts_capacity, entry_count);
+    if (!cur_track->ctts_sample_counts || !cur_track->ctts_sample_offsets) {
+        printf("  failed to allocate ctts\n");
+        return -1;
+    }
 
-        cur_track->ctts_sample_counts[i] = sample_count;
-        cur_track->ctts_sample_offsets[i] = sample_offset;
+    uint32_t *columns[] = { cur_track->ctts_sample_counts, cur_track->ctts_sample_offsets };
+    if (read_int32_columns(ctx->f, columns, 2, entry_count) != 0) {
+        printf("  ctts truncated\n");
     }
 
     printf("  ctts entry count: %u\n", entry_count);
@@ -628,14 +1770,18 @@ static int parse_stss_box(mov_ctx_t *ctx, mov_atom_t atom)
     read_int24_mov(ctx);    // flags
 
     uint32_t entry_count = read_int32_mov(ctx);
+    set_box_entry_count(ctx, entry_count);
     ctx->cur_track->sample_number_count = entry_count;
-    ctx->cur_track->sample_numbers = calloc(entry_count, sizeof(uint32_t));
-
-    for (int i = 0; i != entry_count; ++i) {
-        uint32_t sample_number = read_int32_mov(ctx);
-        ctx->cur_track->sample_numbers[i] = sample_number;
+    ctx->cur_track->sample_numbers = reuse_table(ctx->cur_track->sample_numbers,
+        ctx->cur_track->sample_number_capacity, entry_count, sizeof(uint32_t));
+    ctx->cur_track->sample_number_capacity = MOV_MAX(ctx->cur_track->sample_number_capacity, entry_count);
+    if (!ctx->cur_track->sample_numbers) {
+        printf("  failed to allocate stss\n");
+        return -1;
+    }
 
-        //printf("  stss sample number: %u\n", sample_number);
+    if (read_int32_array(ctx->f, ctx->cur_track->sample_numbers, entry_count) != 0) {
+        printf("  stss truncated\n");
     }
 
     printf("  stss sample number count: %u\n", entry_count);
@@ -652,19 +1798,28 @@ static int parse_stsc_box(mov_ctx_t *ctx, mov_atom_t atom)
     read_int24_mov(ctx);    // flags
 
     uint32_t entry_count = read_int32_mov(ctx);
+    set_box_entry_count(ctx, entry_count);
     cur_track->stsc_count = entry_count;
-    cur_track->stsc_first_chunk = calloc(entry_count, sizeof(uint32_t));
-    cur_track->stsc_sample_per_chunk = calloc(entry_count, sizeof(uint32_t));
-    cur_track->stsc_sample_desc_index = calloc(entry_count, sizeof(uint32_t));
-
-    for (int i = 0; i != entry_count; ++i) {
-        uint32_t first_chunk = read_int32_mov(ctx);
-        uint32_t samples_per_chunk = read_int32_mov(ctx);
-        uint32_t sample_desc_index = read_int32_mov(ctx);
+    cur_track->stsc_first_chunk = reuse_table(cur_track->stsc_first_chunk,
+        cur_track->stsc_capacity, entry_count, sizeof(uint32_t));
+    cur_track->stsc_sample_per_chunk = reuse_table(cur_track->stsc_sample_per_chunk,
+        cur_track->stsc_capacity, entry_count, sizeof(uint32_t));
+    cur_track->stsc_sample_desc_index = reuse_table(cur_track->stsc_sample_desc_index,
+        cur_track->stsc_capacity, entry_count, sizeof(uint32_t));
+    cur_track->stsc_capacity = MOV_MAX(cur_track->stsc_capacity, entry_count);
+    if (!cur_track->stsc_first_chunk || !cur_track->stsc_sample_per_chunk ||
+        !cur_track->stsc_sample_desc_index) {
+        printf("  failed to allocate stsc\n");
+        return -1;
+    }
 
-        cur_track->stsc_first_chunk[i] = first_chunk;
-        cur_track->stsc_sample_per_chunk[i] = samples_per_chunk;
-        cur_track->stsc_sample_desc_index[i] = sample_desc_index;
+    uint32_t *columns[] = {
+        cur_track->stsc_first_chunk,
+        cur_track->stsc_sample_per_chunk,
+        cur_track->stsc_sample_desc_index
+    };
+    if (read_int32_columns(ctx->f, columns, 3, entry_count) != 0) {
+        printf("  stsc truncated\n");
     }
 
     printf("  stsc (Sample to Chunk) entry_count: %u (***)\n", entry_count);
@@ -688,17 +1843,21 @@ static int parse_stsz_box(mov_ctx_t *ctx, mov_atom_t atom)
 
     uint32_t sample_size = read_int32_mov(ctx);
     uint32_t sample_count = read_int32_mov(ctx);
+    set_box_entry_count(ctx, sample_count);
 
     // Allocate sample length array.
-    cur_track->sample_lengths = calloc(sample_count, sizeof(uint32_t));
+    cur_track->sample_lengths = reuse_table(cur_track->sample_lengths,
+        cur_track->sample_lengths_capacity, sample_count, sizeof(uint32_t));
+    cur_track->sample_lengths_capacity = MOV_MAX(cur_track->sample_lengths_capacity, sample_count);
     cur_track->sample_lengths_count = sample_count;
+    if (!cur_track->sample_lengths) {
+        printf("  failed to allocate stsz\n");
+        return -1;
+    }
 
     if (0 == sample_size) {
-        for (int i = 0; i != sample_count; ++i) {
-            uint32_t entry_size = read_int32_mov(ctx);
-            cur_track->sample_lengths[i] = entry_size;
-
-            //printf("  stsz, i=%d, entry_size=%u\n", i, entry_size);
+        if (read_int32_array(ctx->f, cur_track->sample_lengths, sample_count) != 0) {
+            printf("  stsz truncated\n");
         }
     } else {
         for (int i = 0; i != sample_count; ++i) {
@@ -719,6 +1878,7 @@ static int parse_stsz_box(mov_ctx_t *ctx, mov_atom_t atom)
 // Chunk Offset Box
 static int parse_stco_box(mov_ctx_t *ctx, mov_atom_t atom)
 {
+    int ret;
     mov_track_t *cur_track = ctx->cur_track;
 
     int use_large_offset = 0;
@@ -730,17 +1890,23 @@ static int parse_stco_box(mov_ctx_t *ctx, mov_atom_t atom)
     read_int24_mov(ctx);    // flags
 
     uint32_t entry_count = read_int32_mov(ctx);
-    cur_track->chunk_offsets = calloc(entry_count, sizeof(uint64_t));
+    set_box_entry_count(ctx, entry_count);
+    cur_track->chunk_offsets = reuse_table(cur_track->chunk_offsets,
+        cur_track->chunk_offset_capacity, entry_count, sizeof(uint64_t));
+    cur_track->chunk_offset_capacity = MOV_MAX(cur_track->chunk_offset_capacity, entry_count);
     cur_track->chunk_offset_count = entry_count;
+    if (!cur_track->chunk_offsets) {
+        printf("  failed to allocate %s\n", atom.str_type);
+        return -1;
+    }
 
-    for (int i = 0; i != entry_count; ++i) {
-        uint64_t offset;
-        if (use_large_offset) {
-            offset = read_int64_mov(ctx);
-        } else {
-            offset = read_int32_mov(ctx);
-        }
-        cur_track->chunk_offsets[i] = offset;
+    if (use_large_offset) {
+        ret = read_int64_array(ctx->f, cur_track->chunk_offsets, entry_count);
+    } else {
+        ret = read_int32_array_to_64(ctx->f, cur_track->chunk_offsets, entry_count);
+    }
+    if (ret != 0) {
+        printf("  %s truncated\n", atom.str_type);
     }
 
     printf("  %s (Chunk Offset) entry_count: %u (***)\n", atom.str_type, entry_count);
@@ -753,9 +1919,42 @@ static int parse_stco_box(mov_ctx_t *ctx, mov_atom_t atom)
     return 0;
 }
 
+static int parse_mvex_box(mov_ctx_t *ctx, mov_atom_t atom)
+{
+    return parse_sub_boxes(ctx, atom);
+}
+
+static int parse_trex_box(mov_ctx_t *ctx, mov_atom_t atom)
+{
+    read_int8_mov(ctx);     // version
+    read_int24_mov(ctx);    // flags
+
+    uint32_t trackid = read_int32_mov(ctx);
+    uint32_t default_sample_desc_index = read_int32_mov(ctx);
+    uint32_t default_sample_duration = read_int32_mov(ctx);
+    uint32_t default_sample_size = read_int32_mov(ctx);
+    uint32_t default_sample_flags = read_int32_mov(ctx);
+
+    printf("  trex track: %u, default duration: %u, size: %u, flags: 0x%08X\n", trackid,
+        default_sample_duration, default_sample_size, default_sample_flags);
+
+    mov_track_t *track = get_track_by_id(ctx, trackid);
+    if (NULL == track) {
+        printf("  trex of unknown track: %u\n", trackid);
+        return 0;
+    }
+
+    track->trex_default_sample_desc_index = default_sample_desc_index;
+    track->trex_default_sample_duration = default_sample_duration;
+    track->trex_default_sample_size = default_sample_size;
+    track->trex_default_sample_flags = default_sample_flags;
+    return 0;
+}
+
 static int parse_moof_box(mov_ctx_t *ctx, mov_atom_t atom)
 {
-    ctx->cur_moof_offset = _ftelli64(ctx->f) - 8;  // Normal atom header is assumed.
+    ctx->cur_moof_offset = ctx->box_nodes[ctx->cur_box_node].offset;
+    ctx->cur_moof_data_end = ctx->cur_moof_offset;
     return parse_sub_boxes(ctx, atom);
 }
 
@@ -772,23 +1971,39 @@ static int parse_mfhd_box(mov_ctx_t *ctx, mov_atom_t atom)
 
 static int parse_traf_box(mov_ctx_t *ctx, mov_atom_t atom)
 {
-    return parse_sub_boxes(ctx, atom);
+    int ret = parse_sub_boxes(ctx, atom);
+
+    // Unset current track pointer.
+    ctx->cur_track = NULL;
+    return ret;
 }
 
 static int parse_tfhd_box(mov_ctx_t *ctx, mov_atom_t atom)
 {
-    uint64_t data_offset = ctx->cur_moof_offset;
-
     read_int8_mov(ctx);     // version
     int tf_flags = read_int24_mov(ctx);    // flags
 
     uint32_t trackid = read_int32_mov(ctx);
+    mov_track_t *cur_track = get_track_by_id(ctx, trackid);
+    if (NULL == cur_track) {
+        printf("  tfhd of unknown track: %u\n", trackid);
+        ctx->cur_track = NULL;
+        return 0;
+    }
+
     uint64_t base_data_offset;
     uint32_t sample_desc_index;
     uint32_t default_sample_duration;
     uint32_t default_sample_size;
     uint32_t default_sample_flags;
 
+    // Without explicit base, the first traf starts from 'moof', others
+    // follow data of the previous traf.
+    uint64_t data_offset = ctx->cur_moof_data_end;
+    if (tf_flags & 0x020000) {
+        data_offset = ctx->cur_moof_offset;
+    }
+
     if (tf_flags & 0x000001) {
         base_data_offset = read_int64_mov(ctx);
         data_offset = base_data_offset;
@@ -801,7 +2016,7 @@ static int parse_tfhd_box(mov_ctx_t *ctx, mov_atom_t atom)
         sample_desc_index = read_int32_mov(ctx);
         printf("  sample_desc_index is: %u\n", sample_desc_index);
     } else {
-        sample_desc_index = 0;
+        sample_desc_index = cur_track->trex_default_sample_desc_index;
         printf("  sample_desc_index is not present\n");
     }
 
@@ -809,7 +2024,7 @@ static int parse_tfhd_box(mov_ctx_t *ctx, mov_atom_t atom)
         default_sample_duration = read_int32_mov(ctx);
         printf("  default_sample_duration is %u\n", default_sample_duration);
     } else {
-        default_sample_duration = 0;
+        default_sample_duration = cur_track->trex_default_sample_duration;
         printf("  default_sample_duration is not present\n");
     }
 
@@ -817,7 +2032,7 @@ static int parse_tfhd_box(mov_ctx_t *ctx, mov_atom_t atom)
         default_sample_size = read_int32_mov(ctx);
         printf("  default_sample_size is %u\n", default_sample_size);
     } else {
-        default_sample_size = 0;
+        default_sample_size = cur_track->trex_default_sample_size;
         printf("  default_sample_size is not present\n");
     }
 
@@ -825,16 +2040,15 @@ static int parse_tfhd_box(mov_ctx_t *ctx, mov_atom_t atom)
         default_sample_flags = read_int32_mov(ctx);
         printf("  default_sample_flags is %u\n", default_sample_flags);
     } else {
-        default_sample_flags = 0;
+        default_sample_flags = cur_track->trex_default_sample_flags;
         printf("  default_sample_flags is not present\n");
     }
 
     printf("  base_data_offset: %llu\n", base_data_offset);
 
-    mov_track_t *cur_track = get_track_by_id(ctx, trackid);
-    if (cur_track && cur_track->is_video) {
+    if (cur_track->is_video) {
         printf("  (video track)\n");
-    } else if (cur_track && cur_track->is_audio) {
+    } else if (cur_track->is_audio) {
         printf("  (audio track)\n");
     }
 
@@ -842,7 +2056,29 @@ static int parse_tfhd_box(mov_ctx_t *ctx, mov_atom_t atom)
     ctx->cur_track = cur_track;
 
     cur_track->cur_frag_offset = data_offset;
+    cur_track->cur_frag_data_end = data_offset;
+    cur_track->cur_frag_default_sample_duration = default_sample_duration;
     cur_track->cur_frag_default_sample_size = default_sample_size;
+    cur_track->cur_frag_default_sample_flags = default_sample_flags;
+
+    // New fragment of the track.
+    if (cur_track->fragment_count == cur_track->fragment_capacity) {
+        uint32_t capacity = cur_track->fragment_capacity ? 2 * cur_track->fragment_capacity : 16;
+        mov_fragment_t *fragments = realloc(cur_track->fragments, capacity * sizeof(mov_fragment_t));
+        if (NULL == fragments) {
+            printf("  failed to grow fragment table\n");
+            return -1;
+        }
+        cur_track->fragments = fragments;
+        cur_track->fragment_capacity = capacity;
+    }
+
+    mov_fragment_t *frag = cur_track->fragments + cur_track->fragment_count++;
+    memset(frag, 0, sizeof(*frag));
+    frag->moof_offset = ctx->cur_moof_offset;
+    frag->data_offset = data_offset;
+    frag->base_decode_time = cur_track->next_frag_dts;
+    frag->first_sample = cur_track->samples.count;
 
     return 0;
 }
@@ -861,28 +2097,248 @@ static int parse_tfdt_box(mov_ctx_t *ctx, mov_atom_t atom)
 
     printf("  base media decode time: %llu\n", base_decode_time);
 
+    mov_track_t *cur_track = ctx->cur_track;
+    if (cur_track && cur_track->fragment_count) {
+        cur_track->next_frag_dts = base_decode_time;
+        cur_track->fragments[cur_track->fragment_count - 1].base_decode_time = base_decode_time;
+    }
+
+    return 0;
+}
+
+static int add_segment(mov_ctx_t *ctx, const mov_segment_t *segment)
+{
+    if (ctx->segment_count == ctx->segment_capacity) {
+        uint32_t capacity = ctx->segment_capacity ? 2 * ctx->segment_capacity : 16;
+        mov_segment_t *segments = realloc(ctx->segments, capacity * sizeof(mov_segment_t));
+        if (NULL == segments) {
+            printf("  failed to grow segment table\n");
+            return -1;
+        }
+        ctx->segments = segments;
+        ctx->segment_capacity = capacity;
+    }
+    ctx->segments[ctx->segment_count++] = *segment;
+    return 0;
+}
+
+static int add_nested_sidx(mov_ctx_t *ctx, int64_t content_pos)
+{
+    if (ctx->nested_sidx_count == ctx->nested_sidx_capacity) {
+        uint32_t capacity = ctx->nested_sidx_capacity ? 2 * ctx->nested_sidx_capacity : 16;
+        int64_t *nested_sidx = realloc(ctx->nested_sidx, capacity * sizeof(int64_t));
+        if (NULL == nested_sidx) {
+            printf("  failed to grow sidx table\n");
+            return -1;
+        }
+        ctx->nested_sidx = nested_sidx;
+        ctx->nested_sidx_capacity = capacity;
+    }
+    ctx->nested_sidx[ctx->nested_sidx_count++] = content_pos;
+    return 0;
+}
+
+static int is_nested_sidx(const mov_ctx_t *ctx, int64_t content_pos)
+{
+    for (uint32_t i = 0; i != ctx->nested_sidx_count; ++i) {
+        if (ctx->nested_sidx[i] == content_pos) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Read 'sidx' content from current file position. Referenced 'sidx' boxes
+// are read in place, so segments are added in file order.
+static int read_sidx_content(mov_ctx_t *ctx, mov_atom_t atom, int depth)
+{
+    int ret;
+
+    uint8_t version = read_int8_mov(ctx);
+    read_int24_mov(ctx);    // flags
+
+    uint32_t reference_id = read_int32_mov(ctx);
+    uint32_t timescale = read_int32_mov(ctx);
+    uint64_t earliest_pts;
+    uint64_t first_offset;
+    if (0 == version) {
+        earliest_pts = read_int32_mov(ctx);
+        first_offset = read_int32_mov(ctx);
+    } else {
+        earliest_pts = read_int64_mov(ctx);
+        first_offset = read_int64_mov(ctx);
+    }
+    read_int16_mov(ctx);    // reserved
+    uint32_t reference_count = read_int16_mov(ctx);
+    if (depth == 0) {
+        set_box_entry_count(ctx, reference_count);
+    }
+
+    printf("  sidx reference id: %u, timescale: %u, reference count: %u\n",
+        reference_id, timescale, reference_count);
+
+    // Offsets are relative to the first byte after 'sidx'.
+    uint64_t offset = atom.content_pos + atom.size + first_offset;
+    uint64_t pts = earliest_pts;
+    for (uint32_t i = 0; i != reference_count; ++i) {
+        uint32_t b = read_int32_mov(ctx);
+        uint32_t duration = read_int32_mov(ctx);
+        uint32_t sap = read_int32_mov(ctx);
+
+        int reference_type = b >> 31;
+        uint32_t referenced_size = b & 0x7FFFFFFF;
+
+        if (reference_type && depth < 8) {
+            // Nested 'sidx'.
+            int64_t next_pos = _ftelli64(ctx->f);
+            _fseeki64(ctx->f, offset, SEEK_SET);
+            mov_atom_t sub_atom = read_box_atom_head(ctx);
+            if (sub_atom.type == MOV_BOX_TYPE('s','i','d','x')) {
+                ret = add_nested_sidx(ctx, sub_atom.content_pos);
+                if (ret == 0) {
+                    ret = read_sidx_content(ctx, sub_atom, depth + 1);
+                }
+                if (ret != 0) {
+                    return ret;
+                }
+            } else {
+                printf("  sidx reference is not a sidx: %s\n", sub_atom.str_type);
+            }
+            _fseeki64(ctx->f, next_pos, SEEK_SET);
+        } else if (!reference_type) {
+            mov_segment_t segment;
+            segment.offset = offset;
+            segment.size = referenced_size;
+            segment.earliest_pts = pts;
+            segment.duration = duration;
+            segment.timescale = timescale;
+            segment.reference_id = reference_id;
+            segment.starts_with_sap = sap >> 31;
+            segment.sap_type = (sap >> 28) & 0x7;
+            ret = add_segment(ctx, &segment);
+            if (ret != 0) {
+                return ret;
+            }
+        }
+
+        offset += referenced_size;
+        pts += duration;
+    }
+    return 0;
+}
+
+static int parse_sidx_box(mov_ctx_t *ctx, mov_atom_t atom)
+{
+    // 'sidx' boxes referenced by one already read are not read again.
+    // Others are, even within the range of a previous one, like the
+    // per-track 'sidx' boxes written back to back at the front.
+    if (is_nested_sidx(ctx, atom.content_pos)) {
+        printf("  sidx already indexed\n");
+        return skip_bytes_mov(ctx, atom.size);
+    }
+
+    uint32_t first_segment = ctx->segment_count;
+    int ret = read_sidx_content(ctx, atom, 0);
+    printf("  segment count: %u\n", ctx->segment_count - first_segment);
+    _fseeki64(ctx->f, atom.content_pos + atom.size, SEEK_SET);
+    return ret;
+}
+
+static int parse_mfra_box(mov_ctx_t *ctx, mov_atom_t atom)
+{
+    return parse_sub_boxes(ctx, atom);
+}
+
+// Read an unsigned integer of 1 to 4 bytes.
+static uint32_t read_sized_int_mov(mov_ctx_t *ctx, int bytes)
+{
+    switch (bytes) {
+    case 1: return read_int8_mov(ctx);
+    case 2: return read_int16_mov(ctx);
+    case 3: return read_int24_mov(ctx);
+    default: return read_int32_mov(ctx);
+    }
+}
+
+static int parse_tfra_box(mov_ctx_t *ctx, mov_atom_t atom)
+{
+    uint8_t version = read_int8_mov(ctx);
+    read_int24_mov(ctx);    // flags
+
+    uint32_t trackid = read_int32_mov(ctx);
+    uint32_t length_sizes = read_int32_mov(ctx);
+    uint32_t entry_count = read_int32_mov(ctx);
+    set_box_entry_count(ctx, entry_count);
+
+    int traf_number_bytes = ((length_sizes >> 4) & 0x3) + 1;
+    int trun_number_bytes = ((length_sizes >> 2) & 0x3) + 1;
+    int sample_number_bytes = (length_sizes & 0x3) + 1;
+
+    printf("  tfra track: %u, entry count: %u\n", trackid, entry_count);
+
+    mov_track_t *track = get_track_by_id(ctx, trackid);
+    if (NULL == track) {
+        printf("  tfra of unknown track: %u\n", trackid);
+        return 0;
+    }
+
+    mov_tfra_entry_t *entries = reuse_table(track->tfra_entries, track->tfra_capacity,
+        entry_count, sizeof(mov_tfra_entry_t));
+    track->tfra_entries = entries;
+    track->tfra_capacity = MOV_MAX(track->tfra_capacity, entry_count);
+    if (NULL == entries) {
+        track->tfra_count = 0;
+        printf("  failed to allocate tfra entries\n");
+        return -1;
+    }
+    track->tfra_count = entry_count;
+
+    for (uint32_t i = 0; i != entry_count; ++i) {
+        mov_tfra_entry_t *entry = entries + i;
+        if (1 == version) {
+            entry->time = read_int64_mov(ctx);
+            entry->moof_offset = read_int64_mov(ctx);
+        } else {
+            entry->time = read_int32_mov(ctx);
+            entry->moof_offset = read_int32_mov(ctx);
+        }
+        entry->traf_number = read_sized_int_mov(ctx, traf_number_bytes);
+        entry->trun_number = read_sized_int_mov(ctx, trun_number_bytes);
+        entry->sample_number = read_sized_int_mov(ctx, sample_number_bytes);
+    }
+
     return 0;
 }
 
 static int parse_trun_box(mov_ctx_t *ctx, mov_atom_t atom)
 {
+    int ret;
     mov_track_t *cur_track = ctx->cur_track;
+    if (NULL == cur_track || cur_track->fragment_count == 0) {
+        printf("  trun outside of a known track fragment\n");
+        return 0;
+    }
 
     uint8_t version = read_int8_mov(ctx);
     uint32_t tr_flags = read_int24_mov(ctx);
 
     uint32_t sample_count = read_int32_mov(ctx);
-    int32_t data_offset;
-    uint32_t first_sample_flags;
+    set_box_entry_count(ctx, sample_count);
+    uint64_t data_offset;
+    uint32_t first_sample_flags = 0;
     if (tr_flags & 0x000001) {
-        data_offset = read_int32_mov(ctx) + cur_track->cur_frag_offset;
+        int32_t offset = (int32_t)read_int32_mov(ctx);
+        data_offset = cur_track->cur_frag_offset + offset;
     } else {
-        data_offset = cur_track->cur_frag_offset;
+        // Follows the previous trun.
+        data_offset = cur_track->cur_frag_data_end;
         printf("  data_offset is not present\n");
     }
 
+    int have_first_flags = 0;
     if (tr_flags & 0x000004) {
         first_sample_flags = read_int32_mov(ctx);
+        have_first_flags = 1;
     } else {
         printf("  first_sample_flags is not present\n");
     }
@@ -912,48 +2368,59 @@ static int parse_trun_box(mov_ctx_t *ctx, mov_atom_t atom)
         printf("  sample_composition_time_offset is not present\n");
     }
 
-    // Allocate for new samples.
-    if (cur_track->trun_sample_capacity == 0) {
-        cur_track->trun_sample_sizes = calloc(sample_count, sizeof(uint32_t));
-        cur_track->trun_sample_offsets = calloc(sample_count, sizeof(uint64_t));
-        cur_track->trun_sample_capacity = sample_count;
-    } else {
-        uint32_t suitable_capacity = cur_track->trun_sample_capacity;
-        while (suitable_capacity < cur_track->trun_sample_count + sample_count) {
-            suitable_capacity = 2 * suitable_capacity;
-        }
-        if (suitable_capacity != cur_track->trun_sample_capacity) {
-            cur_track->trun_sample_sizes =
-                realloc(cur_track->trun_sample_sizes, suitable_capacity * sizeof(uint32_t));
-            cur_track->trun_sample_offsets =
-                realloc(cur_track->trun_sample_offsets, suitable_capacity * sizeof(uint64_t));
-            cur_track->trun_sample_capacity = suitable_capacity;
+    // Samples from 'moov' go before the fragments.
+    mov_sample_index_t *index = &cur_track->samples;
+    if (index->count == 0 && cur_track->sample_lengths_count) {
+        ret = mov_build_sample_index(cur_track);
+        if (ret != 0) {
+            return ret;
         }
+        cur_track->fragments[cur_track->fragment_count - 1].first_sample = index->count;
+    }
+
+    ret = mov_reserve_sample_index(index, index->count + sample_count);
+    if (ret != 0) {
+        return ret;
     }
 
-    uint32_t sample_duration;
-    uint32_t sample_size;
-    uint32_t sample_flags;
-    uint32_t sample_composition_time_offset;
+    mov_fragment_t *frag = cur_track->fragments + cur_track->fragment_count - 1;
+    uint32_t first_new_sample = index->count;
     uint64_t cur_sample_offset = data_offset;
-    for (int i = 0; i != sample_count; ++i) {
+    uint64_t dts = cur_track->next_frag_dts;
+    for (uint32_t i = 0; i != sample_count; ++i) {
+        uint32_t sample_duration = cur_track->cur_frag_default_sample_duration;
+        uint32_t sample_size = cur_track->cur_frag_default_sample_size;
+        uint32_t sample_flags = cur_track->cur_frag_default_sample_flags;
+        int32_t sample_composition_time_offset = 0;
+
         if (have_duration) sample_duration = read_int32_mov(ctx);
-        if (have_size) {
-            sample_size = read_int32_mov(ctx);
-        } else {
-            sample_size = cur_track->cur_frag_default_sample_size;
-        }
+        if (have_size) sample_size = read_int32_mov(ctx);
         if (have_flags) sample_flags = read_int32_mov(ctx);
-        if (have_ct_offset) sample_composition_time_offset = read_int32_mov(ctx);
+        if (have_ct_offset) sample_composition_time_offset = (int32_t)read_int32_mov(ctx);
+        if (i == 0 && have_first_flags) sample_flags = first_sample_flags;
 
-        cur_track->trun_sample_sizes[cur_track->trun_sample_count] = sample_size;
-        cur_track->trun_sample_offsets[cur_track->trun_sample_count] = cur_sample_offset;
+        uint32_t n = index->count++;
+        index->offsets[n] = cur_sample_offset;
+        index->sizes[n] = sample_size;
+        index->dts[n] = dts;
+        index->cts_offsets[n] = sample_composition_time_offset;
+        index->sync_flags[n] = (sample_flags & 0x00010000) == 0;  // sample_is_non_sync_sample
 
-        cur_track->trun_sample_count++;
         cur_sample_offset += sample_size;
+        dts += sample_duration;
     }
     printf("  sample count: %u\n", sample_count);
 
+    if (frag->sample_count == 0 && sample_count) {
+        frag->data_offset = data_offset;
+        frag->starts_with_sync = index->sync_flags[first_new_sample];
+    }
+    frag->sample_count += sample_count;
+
+    cur_track->next_frag_dts = dts;
+    cur_track->cur_frag_data_end = cur_sample_offset;
+    ctx->cur_moof_data_end = cur_sample_offset;
+
     return 0;
 }
 
@@ -1025,11 +2492,14 @@ static int parse_avcC_box(mov_ctx_t *ctx, mov_atom_t atom)
         free(buf);
         return ret;
     }
-    free(buf);
+    free(cur_track->decoder_config);
+    cur_track->decoder_config = buf;
+    cur_track->decoder_config_len = (uint32_t)atom.size;
 
     cur_track->sps_len = sps_len;
     cur_track->pps_len = pps_len;
-    cur_track->length_size = 4;     // Assume.
+    // lengthSizeMinusOne, after profile, compatibility and level.
+    cur_track->length_size = atom.size > 4 ? (buf[4] & 0x3) + 1 : 4;
 
     if (cur_track->sps_len) {
         print_dump_data("sps:", cur_track->sps, cur_track->sps_len);
@@ -1046,6 +2516,18 @@ static int parse_hvcC_box(mov_ctx_t *ctx, mov_atom_t atom)
     uint8_t b;
     mov_track_t *cur_track = ctx->cur_track;
 
+    // Keep the record as stored, then parse it field by field.
+    free(cur_track->decoder_config);
+    cur_track->decoder_config = malloc(atom.size);
+    if (NULL == cur_track->decoder_config || read_bytes_mov(ctx, atom.size, cur_track->decoder_config) != 0) {
+        printf("failed to read hevc decoder config data\n");
+        free(cur_track->decoder_config);
+        cur_track->decoder_config = NULL;
+        return -1;
+    }
+    cur_track->decoder_config_len = (uint32_t)atom.size;
+    _fseeki64(ctx->f, atom.content_pos, SEEK_SET);
+
     uint8_t config_version = read_int8_mov(ctx);
 
     // general_profile_space, general_tier_flag, general_profile_idc;
@@ -1096,6 +2578,7 @@ static int parse_hvcC_box(mov_ctx_t *ctx, mov_atom_t atom)
     uint8_t num_temp_layers = (b >> 3) & 0x7;
     uint8_t temp_id_nested = (b >> 2) & 0x1;
     uint8_t length_minus_one = b & 0x3;
+    cur_track->length_size = length_minus_one + 1;
 
     uint8_t num_arrays = read_int8_mov(ctx);
     for (int i = 0; i != num_arrays; ++i) {
@@ -1138,36 +2621,102 @@ static int parse_hvcC_box(mov_ctx_t *ctx, mov_atom_t atom)
     return 0;
 }
 
+// Read the tag and size of a descriptor (ISO/IEC 14496-1 8.3.3).
+// @return size of the descriptor header, 0 if truncated.
+static uint32_t read_descriptor_header(const uint8_t *data, uint32_t len, uint8_t *tag, uint32_t *size)
+{
+    if (len < 2) {
+        return 0;
+    }
+    *tag = data[0];
+    *size = 0;
+    for (uint32_t i = 1; i != 5 && i < len; ++i) {
+        *size = (*size << 7) | (data[i] & 0x7F);
+        if (!(data[i] & 0x80)) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
 static int parse_esds_box(mov_ctx_t *ctx, mov_atom_t atom)
 {
     // ESDBox for mp4a(aac)
 
-    uint8_t byte;
+    mov_track_t *cur_track = ctx->cur_track;
+    uint8_t tag;
+    uint32_t size;
+    uint32_t n;
 
     read_int8_mov(ctx);     // version
     read_int24_mov(ctx);    // flags
+    if (atom.size <= 4) {
+        return 0;
+    }
 
-    // ES_Descriptor. Refer to ISO/IEC 14496-1.
-    uint8_t tag = read_int8_mov(ctx);
+    uint32_t len = (uint32_t)(atom.size - 4);
+    uint8_t *buf = malloc(len);
+    if (NULL == buf || read_bytes_mov(ctx, len, buf) != 0) {
+        printf("failed to read esds\n");
+        free(buf);
+        return -1;
+    }
 
-    if (tag != 0x03) {
-        printf("  esds not-processed tag: %u\n", tag);
+    // ES_Descriptor. Refer to ISO/IEC 14496-1.
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + len;
+    n = read_descriptor_header(p, (uint32_t)(end - p), &tag, &size);
+    if (n == 0 || tag != 0x03 || size + n > (uint32_t)(end - p)) {
+        printf("  esds not-processed tag: %u\n", n ? tag : 0);
+        free(buf);
         return 0;
     }
-    printf("  esds first tag is 0x03 (ES_DescrTag)\n");
-    // 0x03: ES_DescrTag for ES_Descriptor
+    p += n;
+    end = p + size;
 
-    uint16_t es_id = read_int16_mov(ctx);
-    byte = read_int8_mov(ctx);
-    uint8_t stream_depend_flag = byte >> 7;
-    uint8_t url_flag = (byte >> 6) & 0x1;
-    uint8_t ocr_stream_flag = (byte >> 5) & 0x1;
-    uint8_t stream_priority = byte & 0x1F;
+    // ES_ID, then flags and the optional fields they announce.
+    if (end - p < 3) {
+        free(buf);
+        return 0;
+    }
+    uint8_t flags = p[2];
+    p += 3;
+    if (flags & 0x80) {     // streamDependenceFlag
+        p += 2;
+    }
+    if (flags & 0x40) {     // URL_Flag
+        p += p < end ? 1 + p[0] : 0;
+    }
+    if (flags & 0x20) {     // OCRstreamFlag
+        p += 2;
+    }
 
-    printf("  ES_Descriptor is not fully parsed now.\n");
-    if (atom.size > 4) {
-        skip_bytes_mov(ctx, atom.size - 4);
+    // DecoderConfigDescriptor, then its DecoderSpecificInfo.
+    while (p < end) {
+        n = read_descriptor_header(p, (uint32_t)(end - p), &tag, &size);
+        if (n == 0 || size > (uint32_t)(end - p) - n) {
+            break;
+        }
+        p += n;
+        if (tag == 0x04 && size >= 13) {
+            printf("  esds object type indication: 0x%02x\n", p[0]);
+            end = p + size;
+            p += 13;
+            continue;
+        }
+        if (tag == 0x05) {
+            free(cur_track->audio_specific_config);
+            cur_track->audio_specific_config = malloc(size ? size : 1);
+            if (cur_track->audio_specific_config) {
+                memcpy(cur_track->audio_specific_config, p, size);
+                cur_track->audio_specific_config_len = size;
+                print_dump_data("  AudioSpecificConfig:", (void *)p, size);
+            }
+            break;
+        }
+        p += size;
     }
 
+    free(buf);
     return 0;
 }
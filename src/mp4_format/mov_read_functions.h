@@ -5,3 +5,60 @@
 // @return 0 on success.
 int parse_mov_file(const char *filename, mov_ctx_t *ctx);
 
+// Called by mov_follow_file() for each complete 'moof' and its 'mdat'. Track
+// indexes hold the samples of this fragment only.
+// @return 0 to keep following.
+typedef int (*mov_fragment_callback_t)(mov_ctx_t *ctx, uint64_t moof_offset, void *opaque);
+
+// Parse a file still being written. Top-level boxes are parsed once fully
+// written, a partially written trailing box is waited for. The file size is
+// polled every "poll_interval_ms". Stops when the callback asks to, or when
+// the file has not grown for "idle_timeout_ms" (0 to follow forever).
+// @return 0 on success.
+int mov_follow_file(const char *filename, mov_ctx_t *ctx, uint32_t poll_interval_ms,
+    uint32_t idle_timeout_ms, mov_fragment_callback_t callback, void *opaque);
+
+// Close the file and clear everything parsed, so the context can parse
+// another file. Buffers of tables, indexes and tracks are kept with their
+// capacity and reused by the next parse. "lazy" is kept as well.
+void mov_ctx_reset(mov_ctx_t *ctx);
+
+// Release everything held by the context. The context itself is not freed.
+void mov_ctx_free(mov_ctx_t *ctx);
+
+// Decode sample tables of the track, and fragments of the file, if they were
+// deferred by lazy parsing. Nothing is done if already loaded.
+// @return 0 on success.
+int mov_load_track_tables(mov_ctx_t *ctx, mov_track_t *track);
+
+
+// Write the time and bytes spent on each box as JSON, with the path of the
+// box, its offset, content size and entry count of tables. Boxes are
+// recorded when "profile" of the context is set before parsing. Deferred
+// boxes include their later loading.
+// @return 0 on success.
+int mov_write_box_profile(mov_ctx_t *ctx, FILE *out);
+
+// Load 'tfra' tables of all tracks through 'mfro' at the file end.
+// Done by parse_mov_file() in lazy mode, which then stops walking the file
+// at the first 'moof'.
+// @return 0 on success, -1 if the file has no 'mfra'.
+int mov_read_mfra(mov_ctx_t *ctx);
+
+// Parse only the 'moof' at "moof_offset". Previously loaded fragment samples
+// are dropped, so each track index holds samples of this fragment only.
+// @return 0 on success.
+int mov_read_fragment(mov_ctx_t *ctx, uint64_t moof_offset);
+
+// Parse only the fragments of 'sidx' segment "index" (see "segments" of
+// the context). Each track index then holds the samples of this segment
+// only, starting from fragments[0].first_sample.
+// @return 0 on success.
+int mov_read_segment(mov_ctx_t *ctx, uint32_t index);
+
+// Find the fragment of the track presented at "time" (track timescale), and
+// read it with mov_read_fragment(). 'tfra' is used when present, otherwise
+// a binary search over top-level 'moof' boxes, on the 'tfdt' of the track
+// read from their headers. Fragments without the track are skipped.
+// @return 0 on success.
+int mov_seek_fragment(mov_ctx_t *ctx, mov_track_t *track, uint64_t time, uint64_t *moof_offset);
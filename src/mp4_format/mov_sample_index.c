@@ -0,0 +1,402 @@
+#include "mov_sample_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Tables are not used once indexed. Their buffers stay allocated, to be
+// reused by the next file through mov_ctx_reset(), and are freed by
+// mov_ctx_free(). Prefix sums are sized by their table, they go.
+static void clear_sample_tables(mov_track_t *track)
+{
+    free(track->stts_run_first_sample);
+    free(track->stts_run_first_dts);
+    free(track->ctts_run_first_sample);
+    free(track->stsc_run_first_sample);
+    track->stts_run_first_sample = NULL;
+    track->stts_run_first_dts = NULL;
+    track->ctts_run_first_sample = NULL;
+    track->stsc_run_first_sample = NULL;
+
+    track->stts_entry_count = 0;
+    track->ctts_entry_count = 0;
+    track->sample_number_count = 0;
+    track->stsc_count = 0;
+    track->sample_lengths_count = 0;
+    track->chunk_offset_count = 0;
+}
+
+int mov_build_sample_index(mov_track_t *track)
+{
+    mov_sample_index_t *index = &track->samples;
+    uint32_t count = track->sample_lengths_count;
+
+    if (index->count) {
+        return 0;
+    }
+
+    // Buffers kept by mov_ctx_reset() are reused when large enough.
+    if (count > index->capacity || NULL == index->offsets) {
+        mov_free_sample_index(index);
+        index->offsets = malloc(count * sizeof(uint64_t));
+        index->sizes = malloc(count * sizeof(uint32_t));
+        index->dts = malloc(count * sizeof(uint64_t));
+        index->cts_offsets = malloc(count * sizeof(int32_t));
+        index->sync_flags = malloc(count * sizeof(uint8_t));
+        if (count && (!index->offsets || !index->sizes || !index->dts ||
+            !index->cts_offsets || !index->sync_flags)) {
+            printf("failed to allocate sample index of %u samples\n", count);
+            mov_free_sample_index(index);
+            return -1;
+        }
+        index->capacity = count;
+    }
+    memset(index->cts_offsets, 0, count * sizeof(int32_t));
+
+    memcpy(index->sizes, track->sample_lengths, count * sizeof(uint32_t));
+
+    // stsc + stco: walk every run of chunks once.
+    uint32_t sample = 0;
+    for (uint32_t i = 0; i < track->stsc_count && sample < count; ++i) {
+        uint32_t first_chunk = track->stsc_first_chunk[i] - 1;
+        uint32_t end_chunk = track->chunk_offset_count;
+        if (i + 1 < track->stsc_count && track->stsc_first_chunk[i + 1] - 1 < end_chunk) {
+            end_chunk = track->stsc_first_chunk[i + 1] - 1;
+        }
+
+        for (uint32_t chunk = first_chunk; chunk < end_chunk && sample < count; ++chunk) {
+            uint64_t offset = track->chunk_offsets[chunk];
+            for (uint32_t j = 0; j < track->stsc_sample_per_chunk[i] && sample < count; ++j) {
+                index->offsets[sample] = offset;
+                offset += index->sizes[sample];
+                ++sample;
+            }
+        }
+    }
+    if (sample != count) {
+        printf("chunks cover %u of %u samples\n", sample, count);
+        count = sample;
+    }
+
+    // stts
+    uint64_t dts = 0;
+    sample = 0;
+    for (uint32_t i = 0; i < track->stts_entry_count; ++i) {
+        for (uint32_t j = 0; j < track->stts_sample_counts[i] && sample < count; ++j) {
+            index->dts[sample++] = dts;
+            dts += track->stts_sample_deltas[i];
+        }
+    }
+    for (; sample < count; ++sample) {
+        index->dts[sample] = dts;
+    }
+
+    // ctts. Offsets of version 1 are signed.
+    sample = 0;
+    for (uint32_t i = 0; i < track->ctts_entry_count; ++i) {
+        for (uint32_t j = 0; j < track->ctts_sample_counts[i] && sample < count; ++j) {
+            index->cts_offsets[sample++] = (int32_t)track->ctts_sample_offsets[i];
+        }
+    }
+
+    // stss. Every sample is a sync sample without it.
+    if (track->sample_number_count) {
+        memset(index->sync_flags, 0, count);
+        for (uint32_t i = 0; i < track->sample_number_count; ++i) {
+            uint32_t number = track->sample_numbers[i];
+            if (number >= 1 && number <= count) {
+                index->sync_flags[number - 1] = 1;
+            }
+        }
+    } else {
+        memset(index->sync_flags, 1, count);
+    }
+
+    index->count = count;
+    clear_sample_tables(track);
+
+    printf("sample index built for track %u, sample count: %u\n", track->trackid, count);
+    return 0;
+}
+
+void mov_free_sample_index(mov_sample_index_t *index)
+{
+    free(index->offsets);
+    free(index->sizes);
+    free(index->dts);
+    free(index->cts_offsets);
+    free(index->sync_flags);
+    memset(index, 0, sizeof(*index));
+}
+
+int mov_reserve_sample_index(mov_sample_index_t *index, uint32_t count)
+{
+    if (count <= index->capacity) {
+        return 0;
+    }
+
+    uint32_t capacity = index->capacity ? index->capacity : 256;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+
+    void *offsets = realloc(index->offsets, capacity * sizeof(uint64_t));
+    if (offsets) index->offsets = offsets;
+    void *sizes = realloc(index->sizes, capacity * sizeof(uint32_t));
+    if (sizes) index->sizes = sizes;
+    void *dts = realloc(index->dts, capacity * sizeof(uint64_t));
+    if (dts) index->dts = dts;
+    void *cts_offsets = realloc(index->cts_offsets, capacity * sizeof(int32_t));
+    if (cts_offsets) index->cts_offsets = cts_offsets;
+    void *sync_flags = realloc(index->sync_flags, capacity * sizeof(uint8_t));
+    if (sync_flags) index->sync_flags = sync_flags;
+
+    if (!offsets || !sizes || !dts || !cts_offsets || !sync_flags) {
+        printf("failed to grow sample index to %u samples\n", capacity);
+        return -1;
+    }
+    index->capacity = capacity;
+    return 0;
+}
+
+void mov_get_sample(const mov_sample_index_t *index, uint32_t i, mov_sample_t *sample)
+{
+    sample->offset = index->offsets[i];
+    sample->size = index->sizes[i];
+    sample->dts = index->dts[i];
+    sample->cts_offset = index->cts_offsets[i];
+    sample->sync = index->sync_flags[i];
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static uint64_t get_varint(const uint8_t **pp)
+{
+    const uint8_t *p = *pp;
+    uint64_t v = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        v |= (uint64_t)(*p++ & 0x7F) << shift;
+        shift += 7;
+    }
+    v |= (uint64_t)(*p++) << shift;
+    *pp = p;
+    return v;
+}
+
+static uint64_t zigzag_encode(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static int64_t zigzag_decode(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+int mov_build_packed_index(mov_track_t *track)
+{
+    mov_packed_index_t *index = &track->packed;
+    uint32_t count = track->sample_lengths_count;
+
+    if (index->count) {
+        return 0;
+    }
+    if (count && (track->stsc_count == 0 || track->chunk_offset_count == 0)) {
+        printf("no chunk data to build packed index\n");
+        return -1;
+    }
+
+    // Constant sizes and durations are stored once.
+    index->const_size = count ? track->sample_lengths[0] : 0;
+    for (uint32_t i = 1; i < count && index->const_size; ++i) {
+        if (track->sample_lengths[i] != index->const_size) {
+            index->const_size = 0;
+        }
+    }
+    index->const_delta = track->stts_entry_count ? track->stts_sample_deltas[0] : 0;
+    for (uint32_t i = 1; i < track->stts_entry_count && index->const_delta; ++i) {
+        if (track->stts_sample_deltas[i] != index->const_delta) {
+            index->const_delta = 0;
+        }
+    }
+    index->cts_unit = 0;
+    if (track->ctts_entry_count) {
+        index->cts_unit = index->const_delta ? index->const_delta : 1;
+        for (uint32_t i = 0; i < track->ctts_entry_count && index->cts_unit != 1; ++i) {
+            if ((int32_t)track->ctts_sample_offsets[i] % (int32_t)index->cts_unit) {
+                index->cts_unit = 1;
+            }
+        }
+    }
+    index->all_sync = track->sample_number_count == 0;
+
+    uint32_t block_count = (count + MOV_PACKED_BLOCK_SIZE - 1) >> MOV_PACKED_BLOCK_SHIFT;
+    uint32_t data_capacity = count * 4 + 64;
+    index->block_offsets = malloc(block_count * sizeof(uint64_t) + 1);
+    index->block_dts = malloc(block_count * sizeof(uint64_t) + 1);
+    index->block_data_pos = malloc(block_count * sizeof(uint32_t) + 1);
+    index->sync_bits = calloc((count + 7) / 8 + 1, 1);
+    index->data = malloc(data_capacity);
+    if (!index->block_offsets || !index->block_dts || !index->block_data_pos ||
+        !index->sync_bits || !index->data) {
+        printf("failed to allocate packed index of %u samples\n", count);
+        mov_free_packed_index(index);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < track->sample_number_count; ++i) {
+        uint32_t number = track->sample_numbers[i];
+        if (number >= 1 && number <= count) {
+            index->sync_bits[(number - 1) >> 3] |= 1 << ((number - 1) & 7);
+        }
+    }
+
+    // Walk stsc/stco, stts and ctts runs together with the samples.
+    uint32_t stsc_idx = 0;
+    uint32_t chunk = 0;         // 1-based, 0 before the first chunk.
+    uint32_t left_in_chunk = 0;
+    uint32_t stts_idx = 0;
+    uint32_t stts_left = track->stts_entry_count ? track->stts_sample_counts[0] : 0;
+    uint32_t ctts_idx = 0;
+    uint32_t ctts_left = track->ctts_entry_count ? track->ctts_sample_counts[0] : 0;
+
+    uint64_t offset = 0;
+    uint64_t expected_offset = 0;
+    uint64_t dts = 0;
+    uint32_t data_size = 0;
+    uint32_t sample;
+    for (sample = 0; sample < count; ++sample) {
+        while (left_in_chunk == 0 && chunk < track->chunk_offset_count) {
+            ++chunk;
+            while (stsc_idx + 1 < track->stsc_count && track->stsc_first_chunk[stsc_idx + 1] <= chunk) {
+                ++stsc_idx;
+            }
+            left_in_chunk = track->stsc_sample_per_chunk[stsc_idx];
+            offset = track->chunk_offsets[chunk - 1];
+        }
+        if (left_in_chunk == 0) {
+            printf("chunks cover %u of %u samples\n", sample, count);
+            break;
+        }
+        --left_in_chunk;
+
+        while (stts_left == 0 && stts_idx + 1 < track->stts_entry_count) {
+            stts_left = track->stts_sample_counts[++stts_idx];
+        }
+        uint32_t duration = stts_left ? track->stts_sample_deltas[stts_idx] : 0;
+        if (stts_left) {
+            --stts_left;
+        }
+
+        while (ctts_left == 0 && ctts_idx + 1 < track->ctts_entry_count) {
+            ctts_left = track->ctts_sample_counts[++ctts_idx];
+        }
+        int32_t cts_offset = ctts_left ? (int32_t)track->ctts_sample_offsets[ctts_idx] : 0;
+        if (ctts_left) {
+            --ctts_left;
+        }
+
+        if ((sample & (MOV_PACKED_BLOCK_SIZE - 1)) == 0) {
+            uint32_t block = sample >> MOV_PACKED_BLOCK_SHIFT;
+            index->block_offsets[block] = offset;
+            index->block_dts[block] = dts;
+            index->block_data_pos[block] = data_size;
+            expected_offset = offset;
+        }
+
+        // At most four varints per sample.
+        if (data_size + 40 > data_capacity) {
+            uint8_t *data = realloc(index->data, data_capacity * 2);
+            if (NULL == data) {
+                printf("failed to grow packed index\n");
+                mov_free_packed_index(index);
+                return -1;
+            }
+            index->data = data;
+            data_capacity *= 2;
+        }
+
+        uint32_t size = track->sample_lengths[sample];
+        uint8_t *p = index->data + data_size;
+        if (!index->const_size) {
+            p = put_varint(p, size);
+        }
+        p = put_varint(p, zigzag_encode((int64_t)(offset - expected_offset)));
+        if (!index->const_delta) {
+            p = put_varint(p, duration);
+        }
+        if (index->cts_unit) {
+            p = put_varint(p, zigzag_encode(cts_offset / (int32_t)index->cts_unit));
+        }
+        data_size = (uint32_t)(p - index->data);
+
+        offset += size;
+        expected_offset = offset;
+        dts += duration;
+    }
+
+    index->count = sample;
+    index->block_count = (sample + MOV_PACKED_BLOCK_SIZE - 1) >> MOV_PACKED_BLOCK_SHIFT;
+    index->data_size = data_size;
+    clear_sample_tables(track);
+
+    uint64_t bytes = data_size + (uint64_t)index->block_count * 20 + (sample + 7) / 8;
+    printf("packed index built for track %u, sample count: %u, bytes: %llu (flat: %llu)\n",
+        track->trackid, sample, bytes, (uint64_t)sample * 25);
+    return 0;
+}
+
+void mov_free_packed_index(mov_packed_index_t *index)
+{
+    free(index->block_offsets);
+    free(index->block_dts);
+    free(index->block_data_pos);
+    free(index->data);
+    free(index->sync_bits);
+    memset(index, 0, sizeof(*index));
+}
+
+void mov_packed_cursor_seek(mov_packed_cursor_t *cursor, const mov_packed_index_t *index,
+    uint32_t sample)
+{
+    mov_sample_t skipped;
+
+    cursor->index = index;
+    cursor->sample = sample & ~(MOV_PACKED_BLOCK_SIZE - 1);
+    while (cursor->sample < sample && mov_packed_cursor_next(cursor, &skipped) == 0) {
+    }
+}
+
+int mov_packed_cursor_next(mov_packed_cursor_t *cursor, mov_sample_t *sample)
+{
+    const mov_packed_index_t *index = cursor->index;
+    uint32_t n = cursor->sample;
+
+    if (n >= index->count) {
+        return -1;
+    }
+
+    // Restart from the checkpoint at each block boundary.
+    if ((n & (MOV_PACKED_BLOCK_SIZE - 1)) == 0) {
+        uint32_t block = n >> MOV_PACKED_BLOCK_SHIFT;
+        cursor->pos = index->data + index->block_data_pos[block];
+        cursor->next_offset = index->block_offsets[block];
+        cursor->next_dts = index->block_dts[block];
+    }
+
+    const uint8_t *p = cursor->pos;
+    sample->size = index->const_size ? index->const_size : (uint32_t)get_varint(&p);
+    sample->offset = cursor->next_offset + zigzag_decode(get_varint(&p));
+    sample->dts = cursor->next_dts;
+    uint32_t duration = index->const_delta ? index->const_delta : (uint32_t)get_varint(&p);
+    sample->cts_offset = index->cts_unit ?
+        (int32_t)zigzag_decode(get_varint(&p)) * (int32_t)index->cts_unit : 0;
+    sample->sync = index->all_sync || (index->sync_bits[n >> 3] >> (n & 7)) & 1;
+
+    cursor->pos = p;
+    cursor->next_offset = sample->offset + sample->size;
+    cursor->next_dts = sample->dts + duration;
+    cursor->sample = n + 1;
+    return 0;
+}
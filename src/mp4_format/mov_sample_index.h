@@ -0,0 +1,40 @@
+#pragma once
+
+#include "mov_defs.h"
+
+// Build the per-sample index from stts/ctts/stss/stsc/stsz/stco of the track,
+// then empty those tables, keeping their buffers. Tables must be loaded already.
+// @return 0 on success.
+int mov_build_sample_index(mov_track_t *track);
+
+void mov_free_sample_index(mov_sample_index_t *index);
+
+// Grow the index so it can hold "count" samples, existing samples are kept.
+// @return 0 on success.
+int mov_reserve_sample_index(mov_sample_index_t *index, uint32_t count);
+
+// @param i 0-based sample index.
+void mov_get_sample(const mov_sample_index_t *index, uint32_t i, mov_sample_t *sample);
+
+// Build the compressed index from the sample tables of the track, then
+// empty those tables, keeping their buffers. Tables must be loaded already.
+// @return 0 on success.
+int mov_build_packed_index(mov_track_t *track);
+
+void mov_free_packed_index(mov_packed_index_t *index);
+
+// Sequential reader of a packed index.
+typedef struct tag_mov_packed_cursor {
+    const mov_packed_index_t *index;
+    uint32_t sample;            // Next sample to decode (0-based).
+    const uint8_t *pos;         // Next byte in index->data.
+    uint64_t next_offset;
+    uint64_t next_dts;
+} mov_packed_cursor_t;
+
+// Position the cursor at "sample" (0-based). Decodes at most one block.
+void mov_packed_cursor_seek(mov_packed_cursor_t *cursor, const mov_packed_index_t *index,
+    uint32_t sample);
+
+// @return 0 on success, -1 when no more sample.
+int mov_packed_cursor_next(mov_packed_cursor_t *cursor, mov_sample_t *sample);
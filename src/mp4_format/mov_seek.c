@@ -0,0 +1,214 @@
+#include "mov_seek.h"
+#include "mov_read_functions.h"
+#include "mov_table_cursor.h"
+
+#include <stdlib.h>
+
+static uint32_t upper_run_u64(const uint64_t *values, uint32_t count, uint64_t v)
+{
+    uint32_t lo = 0;
+    uint32_t hi = count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (values[mid] <= v) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static uint64_t get_sample_dts(const mov_track_t *track, uint32_t sample)
+{
+    if (track->stts_entry_count == 0) {
+        return 0;
+    }
+    uint32_t run = mov_find_run(track->stts_run_first_sample, track->stts_entry_count, sample);
+    return track->stts_run_first_dts[run] +
+        (uint64_t)(sample - track->stts_run_first_sample[run]) * track->stts_sample_deltas[run];
+}
+
+static int32_t get_sample_cts_offset(const mov_track_t *track, uint32_t sample)
+{
+    if (track->ctts_entry_count == 0) {
+        return 0;
+    }
+    uint32_t run = mov_find_run(track->ctts_run_first_sample, track->ctts_entry_count, sample);
+    return (int32_t)track->ctts_sample_offsets[run];
+}
+
+// Snap "sample" (0-based) to a sync sample with 'stss'.
+// @return 0 on success, -1 if there is no sync sample on that side.
+static int snap_to_sync_sample(const mov_track_t *track, mov_seek_mode_t mode, uint32_t *sample)
+{
+    if (mode == MOV_SEEK_ANY || track->sample_number_count == 0) {
+        return 0;
+    }
+
+    // Sample numbers in 'stss' are 1-based and increasing.
+    uint32_t number = *sample + 1;
+    uint32_t i = mov_find_run(track->sample_numbers, track->sample_number_count, number);
+    if (mode == MOV_SEEK_SYNC_BEFORE) {
+        if (track->sample_numbers[i] > number) {
+            return -1;
+        }
+        *sample = track->sample_numbers[i] - 1;
+        return 0;
+    }
+
+    if (track->sample_numbers[i] < number) {
+        if (++i == track->sample_number_count) {
+            return -1;
+        }
+    }
+    *sample = track->sample_numbers[i] - 1;
+    return 0;
+}
+
+// Locate "sample" (0-based) through stsc, stco and stsz. Prefix sums must
+// be built.
+// @return 0 on success.
+static int locate_in_tables(const mov_track_t *track, uint32_t sample, mov_seek_result_t *result)
+{
+    mov_stsc_cursor_t stsc;
+    if (mov_stsc_cursor_seek(&stsc, track, sample) != 0) {
+        printf("no chunk holds sample %u\n", sample);
+        return -1;
+    }
+
+    result->sample = sample;
+    result->dts = get_sample_dts(track, sample);
+    result->cts_offset = get_sample_cts_offset(track, sample);
+    result->chunk = stsc.chunk;
+    result->chunk_offset = track->chunk_offsets[stsc.chunk];
+    result->offset_in_chunk = (uint32_t)(stsc.offset - result->chunk_offset);
+    result->size = track->sample_lengths[sample];
+    return 0;
+}
+
+// A flattened index has one "chunk" per sample.
+static void fill_from_index(const mov_sample_index_t *index, uint32_t sample, mov_seek_result_t *result)
+{
+    result->sample = sample;
+    result->dts = index->dts[sample];
+    result->cts_offset = index->cts_offsets[sample];
+    result->chunk = sample;
+    result->chunk_offset = index->offsets[sample];
+    result->offset_in_chunk = 0;
+    result->size = index->sizes[sample];
+}
+
+static int seek_in_index(const mov_sample_index_t *index, uint64_t target_dts,
+    mov_seek_mode_t mode, mov_seek_result_t *result)
+{
+    if (index->count == 0) {
+        return -1;
+    }
+
+    uint32_t sample = upper_run_u64(index->dts, index->count, target_dts);
+    if (mode == MOV_SEEK_SYNC_BEFORE) {
+        while (sample > 0 && !index->sync_flags[sample]) {
+            --sample;
+        }
+        if (!index->sync_flags[sample]) {
+            return -1;
+        }
+    } else if (mode == MOV_SEEK_SYNC_AFTER) {
+        if (index->dts[sample] < target_dts) {
+            ++sample;
+        }
+        while (sample < index->count && !index->sync_flags[sample]) {
+            ++sample;
+        }
+        if (sample == index->count) {
+            return -1;
+        }
+    }
+
+    fill_from_index(index, sample, result);
+    return 0;
+}
+
+int mov_seek(mov_ctx_t *ctx, mov_track_t *track, uint64_t time, mov_seek_mode_t mode,
+    mov_seek_result_t *result)
+{
+    int ret = mov_load_track_tables(ctx, track);
+    if (ret != 0) {
+        return ret;
+    }
+
+    // Presentation time of a sample is dts + cts offset. The offset of the
+    // first sample is the composition delay of the whole track.
+    if (track->samples.count) {
+        uint64_t shift = track->samples.cts_offsets[0] > 0 ? track->samples.cts_offsets[0] : 0;
+        return seek_in_index(&track->samples, time > shift ? time - shift : 0, mode, result);
+    }
+
+    uint32_t count = track->sample_lengths_count;
+    if (count == 0 || track->stts_entry_count == 0 || track->stsc_count == 0) {
+        printf("no sample table to seek in, track %u\n", track->trackid);
+        return -1;
+    }
+
+    ret = mov_build_run_prefix_sums(track);
+    if (ret != 0) {
+        printf("failed to allocate run prefix sums\n");
+        return ret;
+    }
+
+    int32_t first_cts_offset = get_sample_cts_offset(track, 0);
+    uint64_t shift = first_cts_offset > 0 ? first_cts_offset : 0;
+    uint64_t target_dts = time > shift ? time - shift : 0;
+
+    // Last sample decoded not after target_dts.
+    uint32_t run = upper_run_u64(track->stts_run_first_dts, track->stts_entry_count, target_dts);
+    uint32_t delta = track->stts_sample_deltas[run];
+    uint64_t in_run = delta ? (target_dts - track->stts_run_first_dts[run]) / delta : 0;
+    if (in_run >= track->stts_sample_counts[run]) {
+        in_run = track->stts_sample_counts[run] ? track->stts_sample_counts[run] - 1 : 0;
+    }
+    uint32_t sample = track->stts_run_first_sample[run] + (uint32_t)in_run;
+    if (mode == MOV_SEEK_SYNC_AFTER && get_sample_dts(track, sample) < target_dts) {
+        ++sample;
+    }
+    if (sample >= count) {
+        if (mode == MOV_SEEK_SYNC_AFTER) {
+            return -1;
+        }
+        sample = count - 1;
+    }
+
+    ret = snap_to_sync_sample(track, mode, &sample);
+    if (ret != 0) {
+        return ret;
+    }
+
+    return locate_in_tables(track, sample, result);
+}
+
+int mov_locate_sample(mov_ctx_t *ctx, mov_track_t *track, uint32_t sample, mov_seek_result_t *result)
+{
+    int ret = mov_load_track_tables(ctx, track);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (track->samples.count) {
+        if (sample >= track->samples.count) {
+            return -1;
+        }
+        fill_from_index(&track->samples, sample, result);
+        return 0;
+    }
+
+    if (sample >= track->sample_lengths_count || track->stsc_count == 0) {
+        return -1;
+    }
+    ret = mov_build_run_prefix_sums(track);
+    if (ret != 0) {
+        printf("failed to allocate run prefix sums\n");
+        return ret;
+    }
+    return locate_in_tables(track, sample, result);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "mov_defs.h"
+
+typedef enum mov_seek_mode_t
+{
+    MOV_SEEK_SYNC_BEFORE,       // Sync sample at or before the time, none if the first one is after.
+    MOV_SEEK_SYNC_AFTER,        // Sync sample at or after the time.
+    MOV_SEEK_ANY,               // Sample at the time, sync or not.
+} mov_seek_mode_t;
+
+typedef struct tag_mov_seek_result {
+    uint32_t sample;            // 0-based sample number.
+    uint64_t dts;
+    int32_t cts_offset;
+    uint32_t chunk;             // 0-based chunk number.
+    uint64_t chunk_offset;      // File offset of the chunk.
+    uint32_t offset_in_chunk;   // Sample data is at chunk_offset + offset_in_chunk.
+    uint32_t size;
+} mov_seek_result_t;
+
+// Locate the sample presented at "time" (in the track timescale).
+// Works on the run-length tables directly, nothing is expanded per sample.
+// Presentation time is approximated as the decoding time shifted by the
+// composition offset of the first sample, the delay of the whole track.
+// With reordered frames the sample found may differ by up to the reorder
+// depth from the one actually presented at "time".
+// If the track already has a flattened index, the index is searched and
+// "chunk" is the sample itself.
+// @return 0 on success, -1 if no sample found.
+int mov_seek(mov_ctx_t *ctx, mov_track_t *track, uint64_t time, mov_seek_mode_t mode,
+    mov_seek_result_t *result);
+
+// Locate "sample" (0-based) of the track, from the run-length tables like
+// mov_seek(), or from the flattened index if built.
+// @return 0 on success, -1 if there is no such sample.
+int mov_locate_sample(mov_ctx_t *ctx, mov_track_t *track, uint32_t sample, mov_seek_result_t *result);
@@ -0,0 +1,292 @@
+#include "mov_segmenter.h"
+#include "mov_read_functions.h"
+#include "mov_sample_index.h"
+#include "mov_copy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// 'styp' of every media segment.
+static const uint8_t styp_box[] = {
+    0, 0, 0, 24, 's', 't', 'y', 'p',
+    'm', 's', 'd', 'h', 0, 0, 0, 0,     // major_brand, minor_version
+    'm', 's', 'd', 'h', 'c', 'm', 'f', 's',
+};
+
+static uint64_t sample_dts(const mov_track_t *track, uint32_t index)
+{
+    return track->samples.dts[index];
+}
+
+// End of the last sample, which lasts as long as the one before.
+static uint64_t track_end(const mov_track_t *track)
+{
+    uint32_t n = track->samples.count;
+    if (n == 0) {
+        return 0;
+    }
+    uint64_t last = sample_dts(track, n - 1);
+    return n > 1 ? last + (last - sample_dts(track, n - 2)) : last;
+}
+
+static int add_track(mov_segmenter_t *segmenter, mov_track_t *track)
+{
+    int ret;
+    mov_segmenter_track_t *t = segmenter->tracks + segmenter->track_count;
+    memset(t, 0, sizeof(*t));
+    t->track = track;
+
+    ret = mov_load_track_tables(segmenter->ctx, track);
+    if (ret == 0) {
+        ret = mov_build_sample_index(track);
+    }
+    if (ret != 0) {
+        printf("failed to index track %u\n", track->trackid);
+        return ret;
+    }
+
+    mov_writer_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.fragmented = 1;
+    mov_writer_open(&t->writer, NULL, &config);
+
+    mov_writer_track_config_t track_config;
+    memset(&track_config, 0, sizeof(track_config));
+    track_config.timescale = track->timescale;
+    track_config.is_video = track->is_video;
+    memcpy(track_config.codec_format, track->codec_format, sizeof(track_config.codec_format));
+    track_config.width = (uint16_t)track->width;
+    track_config.height = (uint16_t)track->height;
+    track_config.channel_count = track->channel_count;
+    track_config.sample_rate = track->audio_sample_rate;
+    if (track->is_video) {
+        track_config.decoder_config = track->decoder_config;
+        track_config.decoder_config_len = track->decoder_config_len;
+    } else {
+        track_config.decoder_config = track->audio_specific_config;
+        track_config.decoder_config_len = track->audio_specific_config_len;
+    }
+    if (mov_writer_add_track(&t->writer, &track_config) < 0) {
+        mov_writer_close(&t->writer);
+        return -1;
+    }
+
+    ++segmenter->track_count;
+    return 0;
+}
+
+// Cut "primary" at sync samples, then every other track at the same times.
+static int cut_segments(mov_segmenter_t *segmenter, int primary, uint32_t target_duration_ms)
+{
+    mov_track_t *p = segmenter->tracks[primary].track;
+    uint64_t target = (uint64_t)target_duration_ms * p->timescale / 1000;
+
+    // Segment start times, in the primary timescale.
+    uint64_t *starts = malloc((p->samples.count + 1) * sizeof(uint64_t));
+    if (NULL == starts) {
+        printf("failed to allocate segments\n");
+        return -1;
+    }
+    uint32_t count = 0;
+    for (uint32_t i = 0; i != p->samples.count; ++i) {
+        uint64_t dts = sample_dts(p, i);
+        if (count == 0 || (p->samples.sync_flags[i] && dts - starts[count - 1] >= target)) {
+            starts[count++] = dts;
+        }
+    }
+    if (count == 0) {
+        starts[count++] = 0;
+    }
+    segmenter->segment_count = count;
+
+    for (int i = 0; i != segmenter->track_count; ++i) {
+        mov_segmenter_track_t *t = segmenter->tracks + i;
+        mov_track_t *track = t->track;
+        t->first_samples = malloc((count + 1) * sizeof(uint32_t));
+        if (NULL == t->first_samples) {
+            printf("failed to allocate segments\n");
+            free(starts);
+            return -1;
+        }
+
+        // First sample decoded at or after the segment start.
+        uint32_t sample = 0;
+        t->first_samples[0] = 0;
+        for (uint32_t k = 1; k != count; ++k) {
+            while (sample < track->samples.count &&
+                sample_dts(track, sample) * p->timescale < starts[k] * track->timescale) {
+                ++sample;
+            }
+            t->first_samples[k] = sample;
+        }
+        t->first_samples[count] = track->samples.count;
+
+        // A period without samples of the track would be a fragment without
+        // 'traf'. It is merged into the next one, segments stay cut on
+        // period boundaries.
+        t->segment_count = 0;
+        for (uint32_t k = 1; k <= count; ++k) {
+            if (t->first_samples[k] != t->first_samples[t->segment_count]) {
+                t->first_samples[++t->segment_count] = t->first_samples[k];
+            }
+        }
+
+        uint64_t total_bytes = 0;
+        for (uint32_t k = 0; k != t->segment_count; ++k) {
+            uint64_t bytes = 0;
+            for (uint32_t j = t->first_samples[k]; j != t->first_samples[k + 1]; ++j) {
+                bytes += track->samples.sizes[j];
+            }
+            total_bytes += bytes;
+
+            uint64_t start, duration;
+            mov_segmenter_get_segment_time(segmenter, i, k, &start, &duration);
+            if (duration) {
+                uint64_t bitrate = bytes * 8 * track->timescale / duration;
+                if (bitrate > t->max_bitrate) {
+                    t->max_bitrate = (uint32_t)bitrate;
+                }
+            }
+        }
+        uint64_t end = track_end(track);
+        if (end) {
+            t->avg_bitrate = (uint32_t)(total_bytes * 8 * track->timescale / end);
+        }
+    }
+
+    free(starts);
+    return 0;
+}
+
+int mov_segmenter_init(mov_segmenter_t *segmenter, mov_ctx_t *ctx, uint32_t target_duration_ms)
+{
+    memset(segmenter, 0, sizeof(*segmenter));
+    segmenter->ctx = ctx;
+    segmenter->tracks = calloc(ctx->track_count + 1, sizeof(mov_segmenter_track_t));
+    if (NULL == segmenter->tracks) {
+        printf("failed to allocate segmenter tracks\n");
+        return -1;
+    }
+
+    int primary = -1;
+    for (int i = 0; i != ctx->track_count; ++i) {
+        mov_track_t *track = ctx->tracks + i;
+        if (!track->valid || (!track->is_video && !track->is_audio)) {
+            continue;
+        }
+        if (track->fragment_count) {
+            printf("fragmented file is not supported\n");
+            return -1;
+        }
+        if (add_track(segmenter, track) != 0) {
+            printf("track %u is skipped\n", track->trackid);
+            continue;
+        }
+        if (primary < 0 && track->is_video) {
+            primary = segmenter->track_count - 1;
+        }
+    }
+    if (segmenter->track_count == 0) {
+        printf("no track to segment\n");
+        return -1;
+    }
+
+    return cut_segments(segmenter, primary < 0 ? 0 : primary, target_duration_ms);
+}
+
+void mov_segmenter_get_segment_time(const mov_segmenter_t *segmenter, int track, uint32_t index,
+    uint64_t *start, uint64_t *duration)
+{
+    const mov_segmenter_track_t *t = segmenter->tracks + track;
+    uint32_t first = t->first_samples[index];
+    uint32_t next = t->first_samples[index + 1];
+
+    *start = sample_dts(t->track, first);
+    uint64_t end = next < t->track->samples.count ? sample_dts(t->track, next) : track_end(t->track);
+    *duration = end - *start;
+}
+
+int mov_segmenter_write_init(mov_segmenter_t *segmenter, int track, FILE *out)
+{
+    uint8_t *data;
+    size_t size;
+
+    int ret = mov_writer_build_header(&segmenter->tracks[track].writer, &data, &size);
+    if (ret != 0) {
+        return ret;
+    }
+    if (fwrite(data, 1, size, out) != size) {
+        printf("failed to write init segment\n");
+        ret = -1;
+    }
+    free(data);
+    return ret;
+}
+
+int mov_segmenter_write_segment(mov_segmenter_t *segmenter, int track, uint32_t index, FILE *out)
+{
+    int ret;
+    mov_segmenter_track_t *t = segmenter->tracks + track;
+    const mov_sample_index_t *samples = &t->track->samples;
+
+    if (index >= t->segment_count) {
+        printf("invalid segment: %u\n", index);
+        return -1;
+    }
+    uint32_t first = t->first_samples[index];
+    uint32_t count = t->first_samples[index + 1] - first;
+
+    mov_writer_sample_t *frag = malloc((count + 1) * sizeof(mov_writer_sample_t));
+    if (NULL == frag) {
+        printf("failed to allocate segment samples\n");
+        return -1;
+    }
+    for (uint32_t i = 0; i != count; ++i) {
+        frag[i].data = NULL;
+        frag[i].size = samples->sizes[first + i];
+        frag[i].dts = samples->dts[first + i];
+        frag[i].cts_offset = samples->cts_offsets[first + i];
+        frag[i].sync = samples->sync_flags[first + i];
+    }
+
+    uint8_t *header;
+    size_t header_size;
+    // The last segment ends with the track, its last sample lasting as long
+    // as the one before.
+    int64_t next_dts = first + count < samples->count ? (int64_t)samples->dts[first + count] : (int64_t)track_end(t->track);
+    ret = mov_writer_build_fragment(&t->writer, 0, index + 1, frag, count, next_dts, &header, &header_size);
+    free(frag);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (fwrite(styp_box, 1, sizeof(styp_box), out) != sizeof(styp_box) ||
+        fwrite(header, 1, header_size, out) != header_size) {
+        printf("failed to write segment header\n");
+        free(header);
+        return -1;
+    }
+    free(header);
+
+    // Samples stored back to back are copied in one range.
+    uint32_t i = first;
+    while (i != first + count && ret == 0) {
+        uint64_t offset = samples->offsets[i];
+        uint64_t size = 0;
+        do {
+            size += samples->sizes[i++];
+        } while (i != first + count && samples->offsets[i] == offset + size);
+        ret = mov_copy_range(segmenter->ctx->f, offset, size, out);
+    }
+    return ret;
+}
+
+void mov_segmenter_free(mov_segmenter_t *segmenter)
+{
+    for (int i = 0; i != segmenter->track_count; ++i) {
+        mov_writer_close(&segmenter->tracks[i].writer);
+        free(segmenter->tracks[i].first_samples);
+    }
+    free(segmenter->tracks);
+    memset(segmenter, 0, sizeof(*segmenter));
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "mov_defs.h"
+#include "mov_writer.h"
+
+// CMAF segmentation of a progressive file, cheap enough to serve segments
+// on request. Each video or audio track becomes a CMAF track of its own: an
+// initialization segment, then one 'moof'/'mdat' segment per period.
+// Periods start at sync samples of the first video track, and every track is
+// cut at the same times, so segments of all tracks line up. A track without
+// samples in a period has its next segment span it. Sample data is copied
+// from the source file by byte range.
+
+typedef struct tag_mov_segmenter_track {
+    mov_track_t *track;
+    mov_writer_t writer;        // Only builds boxes, of a single track.
+    uint32_t segment_count;     // Periods without samples of the track are merged into the next one.
+    uint32_t *first_samples;    // Per segment, index of its first sample. One more for the end.
+    uint32_t max_bitrate;       // Peak over segments, in bits per second.
+    uint32_t avg_bitrate;
+} mov_segmenter_track_t;
+
+typedef struct tag_mov_segmenter {
+    mov_ctx_t *ctx;
+    mov_segmenter_track_t *tracks;
+    int track_count;
+    uint32_t segment_count;     // Periods, segments of the track may be fewer.
+} mov_segmenter_t;
+
+// Index the video and audio tracks of "ctx", and cut them into segments
+// of at least "target_duration_ms", up to the next sync sample.
+// @return 0 on success.
+int mov_segmenter_init(mov_segmenter_t *segmenter, mov_ctx_t *ctx, uint32_t target_duration_ms);
+
+// Decoding time of the first sample and duration of segment "index", in the
+// track timescale. Segments of a track are numbered up to its "segment_count".
+void mov_segmenter_get_segment_time(const mov_segmenter_t *segmenter, int track, uint32_t index,
+    uint64_t *start, uint64_t *duration);
+
+// @return 0 on success.
+int mov_segmenter_write_init(mov_segmenter_t *segmenter, int track, FILE *out);
+
+// Write 'styp', 'moof' and 'mdat' of segment "index" of the track.
+// @return 0 on success.
+int mov_segmenter_write_segment(mov_segmenter_t *segmenter, int track, uint32_t index, FILE *out);
+
+void mov_segmenter_free(mov_segmenter_t *segmenter);
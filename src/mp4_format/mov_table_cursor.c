@@ -0,0 +1,292 @@
+#include "mov_table_cursor.h"
+
+#include <stdlib.h>
+
+// Prefix sums over the run-length tables, so a sample or a time can be
+// located by binary search. Built once per track.
+int mov_build_run_prefix_sums(mov_track_t *track)
+{
+    if (track->stts_entry_count && NULL == track->stts_run_first_sample) {
+        track->stts_run_first_sample = malloc(track->stts_entry_count * sizeof(uint32_t));
+        track->stts_run_first_dts = malloc(track->stts_entry_count * sizeof(uint64_t));
+        if (!track->stts_run_first_sample || !track->stts_run_first_dts) {
+            // Both or none, the next call builds them again.
+            free(track->stts_run_first_sample);
+            free(track->stts_run_first_dts);
+            track->stts_run_first_sample = NULL;
+            track->stts_run_first_dts = NULL;
+            return -1;
+        }
+
+        uint32_t sample = 0;
+        uint64_t dts = 0;
+        for (uint32_t i = 0; i != track->stts_entry_count; ++i) {
+            track->stts_run_first_sample[i] = sample;
+            track->stts_run_first_dts[i] = dts;
+            sample += track->stts_sample_counts[i];
+            dts += (uint64_t)track->stts_sample_counts[i] * track->stts_sample_deltas[i];
+        }
+    }
+
+    if (track->ctts_entry_count && NULL == track->ctts_run_first_sample) {
+        track->ctts_run_first_sample = malloc(track->ctts_entry_count * sizeof(uint32_t));
+        if (!track->ctts_run_first_sample) {
+            return -1;
+        }
+
+        uint32_t sample = 0;
+        for (uint32_t i = 0; i != track->ctts_entry_count; ++i) {
+            track->ctts_run_first_sample[i] = sample;
+            sample += track->ctts_sample_counts[i];
+        }
+    }
+
+    if (track->stsc_count && NULL == track->stsc_run_first_sample) {
+        track->stsc_run_first_sample = malloc(track->stsc_count * sizeof(uint32_t));
+        if (!track->stsc_run_first_sample) {
+            return -1;
+        }
+
+        uint32_t sample = 0;
+        for (uint32_t i = 0; i != track->stsc_count; ++i) {
+            track->stsc_run_first_sample[i] = sample;
+            if (i + 1 != track->stsc_count) {
+                sample += (track->stsc_first_chunk[i + 1] - track->stsc_first_chunk[i]) *
+                    track->stsc_sample_per_chunk[i];
+            }
+        }
+    }
+
+    return 0;
+}
+
+uint32_t mov_find_run(const uint32_t *values, uint32_t count, uint32_t v)
+{
+    uint32_t lo = 0;
+    uint32_t hi = count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (values[mid] <= v) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int mov_stts_cursor_seek(mov_stts_cursor_t *cursor, const mov_track_t *track, uint32_t sample)
+{
+    uint32_t count = track->stts_entry_count;
+
+    cursor->track = track;
+    cursor->sample = sample;
+    if (count) {
+        // Runs without samples share their first sample with the next run,
+        // the last of them is the one holding the sample.
+        uint32_t run = mov_find_run(track->stts_run_first_sample, count, sample);
+        uint32_t in_run = sample - track->stts_run_first_sample[run];
+        if (in_run < track->stts_sample_counts[run]) {
+            cursor->run = run;
+            cursor->left = track->stts_sample_counts[run] - in_run - 1;
+            cursor->delta = track->stts_sample_deltas[run];
+            cursor->dts = track->stts_run_first_dts[run] + (uint64_t)in_run * cursor->delta;
+            return 0;
+        }
+    }
+
+    cursor->run = count;
+    cursor->left = 0;
+    cursor->delta = 0;
+    cursor->dts = count ? track->stts_run_first_dts[count - 1] +
+        (uint64_t)track->stts_sample_counts[count - 1] * track->stts_sample_deltas[count - 1] : 0;
+    return -1;
+}
+
+int mov_stts_cursor_next(mov_stts_cursor_t *cursor)
+{
+    const mov_track_t *track = cursor->track;
+
+    ++cursor->sample;
+    cursor->dts += cursor->delta;
+    if (cursor->left) {
+        --cursor->left;
+        return 0;
+    }
+
+    if (cursor->run != track->stts_entry_count) {
+        ++cursor->run;
+    }
+    while (cursor->run != track->stts_entry_count && track->stts_sample_counts[cursor->run] == 0) {
+        ++cursor->run;
+    }
+    if (cursor->run == track->stts_entry_count) {
+        cursor->delta = 0;
+        return -1;
+    }
+    cursor->left = track->stts_sample_counts[cursor->run] - 1;
+    cursor->delta = track->stts_sample_deltas[cursor->run];
+    return 0;
+}
+
+int mov_ctts_cursor_seek(mov_ctts_cursor_t *cursor, const mov_track_t *track, uint32_t sample)
+{
+    uint32_t count = track->ctts_entry_count;
+
+    cursor->track = track;
+    cursor->sample = sample;
+    if (count) {
+        uint32_t run = mov_find_run(track->ctts_run_first_sample, count, sample);
+        uint32_t in_run = sample - track->ctts_run_first_sample[run];
+        if (in_run < track->ctts_sample_counts[run]) {
+            cursor->run = run;
+            cursor->left = track->ctts_sample_counts[run] - in_run - 1;
+            // Offsets of version 1 are signed.
+            cursor->cts_offset = (int32_t)track->ctts_sample_offsets[run];
+            return 0;
+        }
+    }
+
+    cursor->run = count;
+    cursor->left = 0;
+    cursor->cts_offset = 0;
+    return -1;
+}
+
+int mov_ctts_cursor_next(mov_ctts_cursor_t *cursor)
+{
+    const mov_track_t *track = cursor->track;
+
+    ++cursor->sample;
+    if (cursor->left) {
+        --cursor->left;
+        return 0;
+    }
+
+    if (cursor->run != track->ctts_entry_count) {
+        ++cursor->run;
+    }
+    while (cursor->run != track->ctts_entry_count && track->ctts_sample_counts[cursor->run] == 0) {
+        ++cursor->run;
+    }
+    if (cursor->run == track->ctts_entry_count) {
+        cursor->cts_offset = 0;
+        return -1;
+    }
+    cursor->left = track->ctts_sample_counts[cursor->run] - 1;
+    cursor->cts_offset = (int32_t)track->ctts_sample_offsets[cursor->run];
+    return 0;
+}
+
+// First chunk (0-based) after the chunks of stsc entry "run".
+static uint32_t get_run_chunk_end(const mov_track_t *track, uint32_t run)
+{
+    uint32_t end = track->chunk_offset_count;
+    if (run + 1 < track->stsc_count && track->stsc_first_chunk[run + 1] - 1 < end) {
+        end = track->stsc_first_chunk[run + 1] - 1;
+    }
+    return end;
+}
+
+int mov_stsc_cursor_seek(mov_stsc_cursor_t *cursor, const mov_track_t *track, uint32_t sample)
+{
+    cursor->track = track;
+    cursor->sample = sample;
+    if (track->stsc_count == 0 || sample >= track->sample_lengths_count) {
+        return -1;
+    }
+
+    uint32_t run = mov_find_run(track->stsc_run_first_sample, track->stsc_count, sample);
+    uint32_t per_chunk = track->stsc_sample_per_chunk[run];
+    if (per_chunk == 0) {
+        return -1;
+    }
+    uint32_t in_run = sample - track->stsc_run_first_sample[run];
+    cursor->run = run;
+    cursor->chunk = track->stsc_first_chunk[run] - 1 + in_run / per_chunk;
+    cursor->chunk_end = get_run_chunk_end(track, run);
+    cursor->in_chunk = in_run % per_chunk;
+    if (cursor->chunk >= cursor->chunk_end) {
+        return -1;
+    }
+
+    // Samples before this one in the chunk, at most a chunk of them.
+    cursor->offset = track->chunk_offsets[cursor->chunk];
+    for (uint32_t i = sample - cursor->in_chunk; i != sample; ++i) {
+        cursor->offset += track->sample_lengths[i];
+    }
+    return 0;
+}
+
+int mov_stsc_cursor_next(mov_stsc_cursor_t *cursor)
+{
+    const mov_track_t *track = cursor->track;
+
+    cursor->offset += track->sample_lengths[cursor->sample];
+    if (++cursor->sample >= track->sample_lengths_count) {
+        return -1;
+    }
+    if (++cursor->in_chunk < track->stsc_sample_per_chunk[cursor->run]) {
+        return 0;
+    }
+
+    // First chunk of the next run with samples.
+    cursor->in_chunk = 0;
+    ++cursor->chunk;
+    while (cursor->chunk >= cursor->chunk_end || track->stsc_sample_per_chunk[cursor->run] == 0) {
+        if (++cursor->run >= track->stsc_count) {
+            return -1;
+        }
+        cursor->chunk = track->stsc_first_chunk[cursor->run] - 1;
+        cursor->chunk_end = get_run_chunk_end(track, cursor->run);
+    }
+    cursor->offset = track->chunk_offsets[cursor->chunk];
+    return 0;
+}
+
+void mov_table_cursor_seek(mov_table_cursor_t *cursor, const mov_track_t *track, uint32_t sample)
+{
+    cursor->track = track;
+    cursor->sample = sample;
+    cursor->valid = mov_stsc_cursor_seek(&cursor->stsc, track, sample) == 0;
+    mov_stts_cursor_seek(&cursor->stts, track, sample);
+    mov_ctts_cursor_seek(&cursor->ctts, track, sample);
+
+    // Sample numbers in 'stss' are 1-based and increasing.
+    cursor->sync_pos = 0;
+    if (track->sample_number_count) {
+        uint32_t i = mov_find_run(track->sample_numbers, track->sample_number_count, sample);
+        cursor->sync_pos = track->sample_numbers[i] <= sample ? i + 1 : i;
+    }
+}
+
+int mov_table_cursor_next(mov_table_cursor_t *cursor, mov_sample_t *sample)
+{
+    const mov_track_t *track = cursor->track;
+    if (!cursor->valid) {
+        return -1;
+    }
+
+    sample->offset = cursor->stsc.offset;
+    sample->size = track->sample_lengths[cursor->sample];
+    sample->dts = cursor->stts.dts;
+    sample->cts_offset = cursor->ctts.cts_offset;
+
+    // Every sample is a sync sample without 'stss'.
+    sample->sync = 1;
+    if (track->sample_number_count) {
+        uint32_t number = cursor->sample + 1;
+        while (cursor->sync_pos < track->sample_number_count &&
+            track->sample_numbers[cursor->sync_pos] < number) {
+            ++cursor->sync_pos;
+        }
+        sample->sync = cursor->sync_pos < track->sample_number_count &&
+            track->sample_numbers[cursor->sync_pos] == number;
+    }
+
+    ++cursor->sample;
+    cursor->valid = mov_stsc_cursor_next(&cursor->stsc) == 0;
+    mov_stts_cursor_next(&cursor->stts);
+    mov_ctts_cursor_next(&cursor->ctts);
+    return 0;
+}
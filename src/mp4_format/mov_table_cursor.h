@@ -0,0 +1,84 @@
+#pragma once
+
+#include "mov_defs.h"
+
+// Cursors over the run-length sample tables. A cursor stands on one sample,
+// moves to the next one in amortized O(1), and is positioned anywhere in
+// O(log runs) through prefix sums of the runs. Nothing is expanded per
+// sample, memory stays proportional to the number of runs.
+//
+// Tables must be loaded, and prefix sums built with
+// mov_build_run_prefix_sums() before seeking.
+
+// Build prefix sums of the stts, ctts and stsc runs, once per track.
+// @return 0 on success.
+int mov_build_run_prefix_sums(mov_track_t *track);
+
+// @return Index of the last element of "values" not greater than "v", or 0.
+uint32_t mov_find_run(const uint32_t *values, uint32_t count, uint32_t v);
+
+typedef struct tag_mov_stts_cursor {
+    const mov_track_t *track;
+    uint32_t sample;            // 0-based sample at the cursor.
+    uint32_t run;
+    uint32_t left;              // Samples of the run after "sample".
+    uint64_t dts;
+    uint32_t delta;             // Duration of the sample, 0 past the table.
+} mov_stts_cursor_t;
+
+// Samples past the table keep the end time of the table.
+// @return 0 on success, -1 if the sample is past the table.
+int mov_stts_cursor_seek(mov_stts_cursor_t *cursor, const mov_track_t *track, uint32_t sample);
+
+// @return 0 on success, -1 if the next sample is past the table.
+int mov_stts_cursor_next(mov_stts_cursor_t *cursor);
+
+typedef struct tag_mov_ctts_cursor {
+    const mov_track_t *track;
+    uint32_t sample;
+    uint32_t run;
+    uint32_t left;
+    int32_t cts_offset;         // 0 past the table, or without 'ctts'.
+} mov_ctts_cursor_t;
+
+// @return 0 on success, -1 if the sample is past the table.
+int mov_ctts_cursor_seek(mov_ctts_cursor_t *cursor, const mov_track_t *track, uint32_t sample);
+
+// @return 0 on success, -1 if the next sample is past the table.
+int mov_ctts_cursor_next(mov_ctts_cursor_t *cursor);
+
+// Walks stsc, and follows stco and stsz for the file offset of samples.
+typedef struct tag_mov_stsc_cursor {
+    const mov_track_t *track;
+    uint32_t sample;
+    uint32_t run;
+    uint32_t chunk;             // 0-based chunk holding the sample.
+    uint32_t chunk_end;         // First chunk after the run.
+    uint32_t in_chunk;          // Samples before this one in the chunk.
+    uint64_t offset;            // File offset of the sample.
+} mov_stsc_cursor_t;
+
+// @return 0 on success, -1 if no chunk holds the sample.
+int mov_stsc_cursor_seek(mov_stsc_cursor_t *cursor, const mov_track_t *track, uint32_t sample);
+
+// @return 0 on success, -1 if no chunk holds the next sample, the cursor
+// must be positioned again then.
+int mov_stsc_cursor_next(mov_stsc_cursor_t *cursor);
+
+// Sequential reader of whole samples from the tables, like
+// mov_packed_cursor_t for a packed index.
+typedef struct tag_mov_table_cursor {
+    const mov_track_t *track;
+    uint32_t sample;            // Next sample to decode (0-based).
+    int valid;                  // "sample" is held by a chunk.
+    mov_stts_cursor_t stts;
+    mov_ctts_cursor_t ctts;
+    mov_stsc_cursor_t stsc;
+    uint32_t sync_pos;          // First entry of 'stss' not before "sample".
+} mov_table_cursor_t;
+
+// Position the cursor at "sample" (0-based).
+void mov_table_cursor_seek(mov_table_cursor_t *cursor, const mov_track_t *track, uint32_t sample);
+
+// @return 0 on success, -1 when no more sample.
+int mov_table_cursor_next(mov_table_cursor_t *cursor, mov_sample_t *sample);
@@ -0,0 +1,142 @@
+#include "mov_thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+typedef struct tag_thread_start {
+    void (*func)(void *arg);
+    void *arg;
+} thread_start_t;
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID param)
+#else
+static void *thread_main(void *param)
+#endif
+{
+    thread_start_t start = *(thread_start_t *)param;
+    free(param);
+    start.func(start.arg);
+    return 0;
+}
+
+int mov_thread_create(mov_thread_t *thread, void (*func)(void *arg), void *arg)
+{
+    thread_start_t *start = malloc(sizeof(thread_start_t));
+    if (NULL == start) {
+        printf("failed to allocate thread\n");
+        return -1;
+    }
+    start->func = func;
+    start->arg = arg;
+
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, thread_main, start, 0, NULL);
+    if (NULL == *thread) {
+#else
+    if (pthread_create(thread, NULL, thread_main, start) != 0) {
+#endif
+        printf("failed to create thread\n");
+        free(start);
+        return -1;
+    }
+    return 0;
+}
+
+void mov_thread_join(mov_thread_t *thread)
+{
+#ifdef _WIN32
+    WaitForSingleObject(*thread, INFINITE);
+    CloseHandle(*thread);
+#else
+    pthread_join(*thread, NULL);
+#endif
+}
+
+int mov_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int count = (int)info.dwNumberOfProcessors;
+#else
+    int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return count > 0 ? count : 1;
+}
+
+void mov_mutex_init(mov_mutex_t *mutex)
+{
+#ifdef _WIN32
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void mov_mutex_destroy(mov_mutex_t *mutex)
+{
+#ifdef _WIN32
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+void mov_mutex_lock(mov_mutex_t *mutex)
+{
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+void mov_mutex_unlock(mov_mutex_t *mutex)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+void mov_cond_init(mov_cond_t *cond)
+{
+#ifdef _WIN32
+    InitializeConditionVariable(cond);
+#else
+    pthread_cond_init(cond, NULL);
+#endif
+}
+
+void mov_cond_destroy(mov_cond_t *cond)
+{
+#ifdef _WIN32
+    (void)cond;
+#else
+    pthread_cond_destroy(cond);
+#endif
+}
+
+void mov_cond_wait(mov_cond_t *cond, mov_mutex_t *mutex)
+{
+#ifdef _WIN32
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+void mov_cond_broadcast(mov_cond_t *cond)
+{
+#ifdef _WIN32
+    WakeAllConditionVariable(cond);
+#else
+    pthread_cond_broadcast(cond);
+#endif
+}
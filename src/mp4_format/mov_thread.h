@@ -0,0 +1,35 @@
+#pragma once
+
+// Threads, mutexes and condition variables of Windows or POSIX.
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef HANDLE mov_thread_t;
+typedef CRITICAL_SECTION mov_mutex_t;
+typedef CONDITION_VARIABLE mov_cond_t;
+#else
+#include <pthread.h>
+
+typedef pthread_t mov_thread_t;
+typedef pthread_mutex_t mov_mutex_t;
+typedef pthread_cond_t mov_cond_t;
+#endif
+
+// Run "func(arg)" on a new thread.
+// @return 0 on success.
+int mov_thread_create(mov_thread_t *thread, void (*func)(void *arg), void *arg);
+void mov_thread_join(mov_thread_t *thread);
+
+// Number of logical processors, at least 1.
+int mov_cpu_count(void);
+
+void mov_mutex_init(mov_mutex_t *mutex);
+void mov_mutex_destroy(mov_mutex_t *mutex);
+void mov_mutex_lock(mov_mutex_t *mutex);
+void mov_mutex_unlock(mov_mutex_t *mutex);
+
+void mov_cond_init(mov_cond_t *cond);
+void mov_cond_destroy(mov_cond_t *cond);
+void mov_cond_wait(mov_cond_t *cond, mov_mutex_t *mutex);
+void mov_cond_broadcast(mov_cond_t *cond);
@@ -0,0 +1,1239 @@
+#include "mov_writer.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#define MOVIE_TIMESCALE 1000
+
+// Pending sample data is written once either limit is reached.
+#define WRITER_MAX_IOV 1024
+#define WRITER_MAX_PENDING_BYTES (8 * 1024 * 1024)
+#define WRITER_MOVE_BLOCK (1024 * 1024)
+
+// 'trun' sample flags.
+#define SAMPLE_FLAGS_SYNC 0x02000000        // sample_depends_on = 2
+#define SAMPLE_FLAGS_NON_SYNC 0x01010000    // sample_depends_on = 1, sample_is_non_sync_sample
+
+// Memory buffer boxes are built in, before being written.
+typedef struct tag_box_buffer {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    int failed;                 // An allocation failed, content is incomplete.
+} box_buffer_t;
+
+static void put_bytes(box_buffer_t *b, const void *data, size_t size)
+{
+    if (b->failed) {
+        return;
+    }
+    if (b->size + size > b->capacity) {
+        size_t capacity = b->capacity ? b->capacity : 4096;
+        while (capacity < b->size + size) {
+            capacity *= 2;
+        }
+        uint8_t *p = realloc(b->data, capacity);
+        if (NULL == p) {
+            b->failed = 1;
+            return;
+        }
+        b->data = p;
+        b->capacity = capacity;
+    }
+    if (size) {
+        memcpy(b->data + b->size, data, size);
+    }
+    b->size += size;
+}
+
+static void put_zeros(box_buffer_t *b, size_t size)
+{
+    static const uint8_t zeros[32] = { 0 };
+    while (size) {
+        size_t n = size < sizeof(zeros) ? size : sizeof(zeros);
+        put_bytes(b, zeros, n);
+        size -= n;
+    }
+}
+
+static void put_u8(box_buffer_t *b, uint8_t v)
+{
+    put_bytes(b, &v, 1);
+}
+
+static void put_u16(box_buffer_t *b, uint16_t v)
+{
+    uint8_t p[2] = { (uint8_t)(v >> 8), (uint8_t)v };
+    put_bytes(b, p, 2);
+}
+
+static void put_u32(box_buffer_t *b, uint32_t v)
+{
+    uint8_t p[4] = { (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v };
+    put_bytes(b, p, 4);
+}
+
+static void put_u64(box_buffer_t *b, uint64_t v)
+{
+    put_u32(b, (uint32_t)(v >> 32));
+    put_u32(b, (uint32_t)v);
+}
+
+static void set_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+// @return position of the box, to be given to end_box().
+static size_t begin_box(box_buffer_t *b, const char *type)
+{
+    size_t start = b->size;
+    put_u32(b, 0);
+    put_bytes(b, type, 4);
+    return start;
+}
+
+static size_t begin_full_box(box_buffer_t *b, const char *type, uint8_t version, uint32_t flags)
+{
+    size_t start = begin_box(b, type);
+    put_u32(b, ((uint32_t)version << 24) | (flags & 0xFFFFFF));
+    return start;
+}
+
+static void end_box(box_buffer_t *b, size_t start)
+{
+    if (!b->failed) {
+        set_u32(b->data + start, (uint32_t)(b->size - start));
+    }
+}
+
+// Grow "*array" to "capacity" elements.
+// @return 0 on success.
+static int resize_array(void *array, uint32_t capacity, size_t elem_size)
+{
+    void **p = array;
+    void *data = realloc(*p, (size_t)capacity * elem_size);
+    if (NULL == data) {
+        printf("failed to allocate writer table of %u entries\n", capacity);
+        return -1;
+    }
+    *p = data;
+    return 0;
+}
+
+static uint32_t next_capacity(uint32_t capacity)
+{
+    return capacity ? capacity * 2 : 256;
+}
+
+static int write_data(mov_writer_t *writer, const void *data, size_t size)
+{
+    if (size && fwrite(data, 1, size, writer->f) != size) {
+        printf("failed to write %zu bytes\n", size);
+        return -1;
+    }
+    writer->pos += size;
+    return 0;
+}
+
+// Queue data to be written by write_pending(). Counted in "pos" already.
+static int queue_data(mov_writer_t *writer, const uint8_t *data, uint32_t size)
+{
+    if (writer->pending_count == writer->pending_capacity) {
+        uint32_t capacity = next_capacity(writer->pending_capacity);
+        if (resize_array(&writer->pending, capacity, sizeof(mov_writer_data_t)) != 0) {
+            return -1;
+        }
+        writer->pending_capacity = capacity;
+    }
+    writer->pending[writer->pending_count].data = data;
+    writer->pending[writer->pending_count].size = size;
+    ++writer->pending_count;
+    writer->pending_bytes += size;
+    writer->pos += size;
+    return 0;
+}
+
+// Write all queued data, in as few system calls as possible.
+static int write_pending(mov_writer_t *writer)
+{
+#ifdef _WIN32
+    for (uint32_t i = 0; i != writer->pending_count; ++i) {
+        mov_writer_data_t *d = writer->pending + i;
+        if (d->size && fwrite(d->data, 1, d->size, writer->f) != d->size) {
+            printf("failed to write sample data\n");
+            return -1;
+        }
+    }
+#else
+    if (writer->pending_count == 0) {
+        return 0;
+    }
+    if (fflush(writer->f) != 0) {
+        printf("failed to flush output\n");
+        return -1;
+    }
+
+    int fd = fileno(writer->f);
+    struct iovec iov[WRITER_MAX_IOV];
+    uint32_t next = 0;
+    while (next < writer->pending_count) {
+        int n = 0;
+        for (; n != WRITER_MAX_IOV && next + n < writer->pending_count; ++n) {
+            iov[n].iov_base = (void *)writer->pending[next + n].data;
+            iov[n].iov_len = writer->pending[next + n].size;
+        }
+        next += n;
+
+        // writev() may stop short, go on from where it stopped.
+        int first = 0;
+        while (first < n) {
+            ssize_t written = writev(fd, iov + first, n - first);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                printf("failed to write sample data, errno: %d\n", errno);
+                return -1;
+            }
+            while (first < n && (size_t)written >= iov[first].iov_len) {
+                written -= iov[first].iov_len;
+                ++first;
+            }
+            if (first < n) {
+                iov[first].iov_base = (uint8_t *)iov[first].iov_base + written;
+                iov[first].iov_len -= written;
+            }
+        }
+    }
+
+    // The stream did not see the data written to its descriptor.
+    _fseeki64(writer->f, writer->pos, SEEK_SET);
+#endif
+
+    writer->pending_count = 0;
+    writer->pending_bytes = 0;
+    return 0;
+}
+
+static int add_fragment_sample(mov_writer_track_t *track, const mov_writer_sample_t *sample);
+
+static int is_avc(const mov_writer_track_config_t *config)
+{
+    return 0 == memcmp(config->codec_format, "avc1", 4) || 0 == memcmp(config->codec_format, "avc3", 4);
+}
+
+static int is_hevc(const mov_writer_track_config_t *config)
+{
+    return 0 == memcmp(config->codec_format, "hvc1", 4) || 0 == memcmp(config->codec_format, "hev1", 4);
+}
+
+static int is_aac(const mov_writer_track_config_t *config)
+{
+    return 0 == memcmp(config->codec_format, "mp4a", 4);
+}
+
+static const uint32_t aac_sample_rates[] = {
+    96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350,
+};
+
+// AudioSpecificConfig of AAC LC, for tracks given without one.
+static void make_audio_specific_config(const mov_writer_track_config_t *config, uint8_t asc[2])
+{
+    uint8_t index = 4;      // 44100
+    for (uint8_t i = 0; i != sizeof(aac_sample_rates) / sizeof(aac_sample_rates[0]); ++i) {
+        if (aac_sample_rates[i] == config->sample_rate) {
+            index = i;
+        }
+    }
+    uint16_t v = (2 << 11) | (index << 7) | ((config->channel_count & 0xF) << 3);
+    asc[0] = (uint8_t)(v >> 8);
+    asc[1] = (uint8_t)v;
+}
+
+int mov_writer_open(mov_writer_t *writer, const char *filename, const mov_writer_config_t *config)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->config = *config;
+    writer->last_chunk_track = -1;
+    writer->primary_track = -1;
+
+    if (NULL == filename) {
+        return 0;
+    }
+    // Read back when media data is moved behind 'moov'.
+    writer->f = fopen(filename, "w+b");
+    if (NULL == writer->f) {
+        printf("failed to open output file: %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+int mov_writer_add_track(mov_writer_t *writer, const mov_writer_track_config_t *config)
+{
+    if (writer->header_written) {
+        printf("tracks must be added before samples are written\n");
+        return -1;
+    }
+    if (0 == config->timescale) {
+        printf("track timescale is 0\n");
+        return -1;
+    }
+    if (config->is_video ? !is_avc(config) && !is_hevc(config) : !is_aac(config)) {
+        printf("unsupported codec format to write: %.4s\n", config->codec_format);
+        return -1;
+    }
+
+    mov_writer_track_t *tracks = realloc(writer->tracks, (writer->track_count + 1) * sizeof(mov_writer_track_t));
+    if (NULL == tracks) {
+        printf("failed to allocate writer track\n");
+        return -1;
+    }
+    writer->tracks = tracks;
+
+    mov_writer_track_t *track = tracks + writer->track_count;
+    memset(track, 0, sizeof(*track));
+    track->config = *config;
+    if (config->decoder_config_len) {
+        track->decoder_config = malloc(config->decoder_config_len);
+        if (NULL == track->decoder_config) {
+            printf("failed to allocate decoder config\n");
+            return -1;
+        }
+        memcpy(track->decoder_config, config->decoder_config, config->decoder_config_len);
+    } else if (!config->is_video) {
+        track->decoder_config = malloc(2);
+        if (NULL == track->decoder_config) {
+            printf("failed to allocate decoder config\n");
+            return -1;
+        }
+        make_audio_specific_config(config, track->decoder_config);
+        track->config.decoder_config_len = 2;
+    }
+    track->config.decoder_config = track->decoder_config;
+
+    if (writer->primary_track < 0 && config->is_video) {
+        writer->primary_track = writer->track_count;
+    }
+    return writer->track_count++;
+}
+
+static void put_ftyp(box_buffer_t *b, int fragmented)
+{
+    size_t ftyp = begin_box(b, "ftyp");
+    put_bytes(b, "isom", 4);
+    put_u32(b, 0x200);          // minor_version
+    put_bytes(b, "isom", 4);
+    put_bytes(b, fragmented ? "iso6" : "iso2", 4);
+    put_bytes(b, "mp41", 4);
+    end_box(b, ftyp);
+}
+
+static void put_matrix(box_buffer_t *b)
+{
+    static const uint32_t unity[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+    for (int i = 0; i != 9; ++i) {
+        put_u32(b, unity[i]);
+    }
+}
+
+// Track duration in the media timescale.
+static uint64_t track_duration(const mov_writer_track_t *track)
+{
+    if (0 == track->sample_count) {
+        return 0;
+    }
+    return track->last_dts - track->first_dts + track->last_delta;
+}
+
+static void put_mvhd(box_buffer_t *b, mov_writer_t *writer, uint64_t duration)
+{
+    uint8_t version = duration > UINT32_MAX;
+    size_t mvhd = begin_full_box(b, "mvhd", version, 0);
+    if (version) {
+        put_u64(b, 0);          // creation_time
+        put_u64(b, 0);          // modification_time
+        put_u32(b, MOVIE_TIMESCALE);
+        put_u64(b, duration);
+    } else {
+        put_u32(b, 0);
+        put_u32(b, 0);
+        put_u32(b, MOVIE_TIMESCALE);
+        put_u32(b, (uint32_t)duration);
+    }
+    put_u32(b, 0x00010000);     // rate
+    put_u16(b, 0x0100);         // volume
+    put_zeros(b, 10);           // reserved
+    put_matrix(b);
+    put_zeros(b, 24);           // pre_defined
+    put_u32(b, writer->track_count + 1);    // next_track_ID
+    end_box(b, mvhd);
+}
+
+static void put_tkhd(box_buffer_t *b, const mov_writer_track_t *track, uint32_t track_id, uint64_t duration)
+{
+    uint8_t version = duration > UINT32_MAX;
+    size_t tkhd = begin_full_box(b, "tkhd", version, 0x3);     // track_enabled | track_in_movie
+    if (version) {
+        put_u64(b, 0);
+        put_u64(b, 0);
+        put_u32(b, track_id);
+        put_u32(b, 0);
+        put_u64(b, duration);
+    } else {
+        put_u32(b, 0);
+        put_u32(b, 0);
+        put_u32(b, track_id);
+        put_u32(b, 0);
+        put_u32(b, (uint32_t)duration);
+    }
+    put_zeros(b, 8);            // reserved
+    put_u16(b, 0);              // layer
+    put_u16(b, 0);              // alternate_group
+    put_u16(b, track->config.is_video ? 0 : 0x0100);   // volume
+    put_u16(b, 0);
+    put_matrix(b);
+    put_u32(b, (uint32_t)track->config.width << 16);
+    put_u32(b, (uint32_t)track->config.height << 16);
+    end_box(b, tkhd);
+}
+
+static void put_mdhd(box_buffer_t *b, const mov_writer_track_t *track, uint64_t duration)
+{
+    uint8_t version = duration > UINT32_MAX;
+    size_t mdhd = begin_full_box(b, "mdhd", version, 0);
+    if (version) {
+        put_u64(b, 0);
+        put_u64(b, 0);
+        put_u32(b, track->config.timescale);
+        put_u64(b, duration);
+    } else {
+        put_u32(b, 0);
+        put_u32(b, 0);
+        put_u32(b, track->config.timescale);
+        put_u32(b, (uint32_t)duration);
+    }
+    put_u16(b, 0x55C4);         // language: "und"
+    put_u16(b, 0);
+    end_box(b, mdhd);
+}
+
+static void put_hdlr(box_buffer_t *b, const mov_writer_track_t *track)
+{
+    const char *name = track->config.is_video ? "VideoHandler" : "SoundHandler";
+    size_t hdlr = begin_full_box(b, "hdlr", 0, 0);
+    put_u32(b, 0);              // pre_defined
+    put_bytes(b, track->config.is_video ? "vide" : "soun", 4);
+    put_zeros(b, 12);           // reserved
+    put_bytes(b, name, strlen(name) + 1);
+    end_box(b, hdlr);
+}
+
+// Descriptor sizes are always coded on 4 bytes, so they are known upfront.
+static void put_descriptor(box_buffer_t *b, uint8_t tag, uint32_t size)
+{
+    put_u8(b, tag);
+    put_u8(b, 0x80 | ((size >> 21) & 0x7F));
+    put_u8(b, 0x80 | ((size >> 14) & 0x7F));
+    put_u8(b, 0x80 | ((size >> 7) & 0x7F));
+    put_u8(b, size & 0x7F);
+}
+
+static void put_esds(box_buffer_t *b, const mov_writer_track_t *track)
+{
+    uint32_t asc_len = track->config.decoder_config_len;
+    uint32_t dec_specific_size = asc_len ? 5 + asc_len : 0;
+    uint32_t dec_config_size = 13 + dec_specific_size;
+    uint32_t es_size = 3 + 5 + dec_config_size + 5 + 1;
+
+    size_t esds = begin_full_box(b, "esds", 0, 0);
+
+    put_descriptor(b, 0x03, es_size);       // ES_DescrTag
+    put_u16(b, 0);              // ES_ID
+    put_u8(b, 0);               // no dependency, URL or OCR stream
+
+    put_descriptor(b, 0x04, dec_config_size);   // DecoderConfigDescrTag
+    put_u8(b, 0x40);            // objectTypeIndication: Audio ISO/IEC 14496-3
+    put_u8(b, (0x05 << 2) | 1); // streamType: AudioStream, upStream = 0, reserved = 1
+    put_zeros(b, 3);            // bufferSizeDB
+    put_u32(b, 0);              // maxBitrate
+    put_u32(b, 0);              // avgBitrate
+
+    if (asc_len) {
+        put_descriptor(b, 0x05, asc_len);   // DecSpecificInfoTag
+        put_bytes(b, track->config.decoder_config, asc_len);
+    }
+
+    put_descriptor(b, 0x06, 1);             // SLConfigDescrTag
+    put_u8(b, 0x02);            // predefined: reserved for use in MP4 files
+
+    end_box(b, esds);
+}
+
+static void put_sample_entry(box_buffer_t *b, const mov_writer_track_t *track)
+{
+    const mov_writer_track_config_t *config = &track->config;
+
+    size_t entry = begin_box(b, config->codec_format);
+    put_zeros(b, 6);            // reserved
+    put_u16(b, 1);              // data_reference_index
+
+    if (config->is_video) {
+        put_zeros(b, 16);       // pre_defined, reserved
+        put_u16(b, config->width);
+        put_u16(b, config->height);
+        put_u32(b, 0x00480000); // horizresolution: 72 dpi
+        put_u32(b, 0x00480000); // vertresolution
+        put_u32(b, 0);          // reserved
+        put_u16(b, 1);          // frame_count
+        put_zeros(b, 32);       // compressorname
+        put_u16(b, 0x0018);     // depth
+        put_u16(b, 0xFFFF);     // pre_defined = -1
+
+        size_t box = begin_box(b, is_avc(config) ? "avcC" : "hvcC");
+        put_bytes(b, config->decoder_config, config->decoder_config_len);
+        end_box(b, box);
+    } else {
+        put_zeros(b, 8);        // reserved
+        put_u16(b, config->channel_count);
+        put_u16(b, 16);         // samplesize
+        put_u32(b, 0);          // pre_defined, reserved
+        put_u32(b, config->sample_rate << 16);
+        put_esds(b, track);
+    }
+
+    end_box(b, entry);
+}
+
+static void put_stbl(box_buffer_t *b, const mov_writer_track_t *track, int fragmented)
+{
+    size_t stbl = begin_box(b, "stbl");
+
+    size_t stsd = begin_full_box(b, "stsd", 0, 0);
+    put_u32(b, 1);
+    put_sample_entry(b, track);
+    end_box(b, stsd);
+
+    // Tables stay empty in fragmented files, as no sample is counted.
+    size_t stts = begin_full_box(b, "stts", 0, 0);
+    put_u32(b, track->stts_count);
+    for (uint32_t i = 0; i != track->stts_count; ++i) {
+        put_u32(b, track->stts_sample_counts[i]);
+        put_u32(b, track->stts_sample_deltas[i]);
+    }
+    end_box(b, stts);
+
+    if (track->has_cts) {
+        uint8_t version = 0;
+        for (uint32_t i = 0; i != track->ctts_count; ++i) {
+            if (track->ctts_sample_offsets[i] < 0) {
+                version = 1;
+            }
+        }
+        size_t ctts = begin_full_box(b, "ctts", version, 0);
+        put_u32(b, track->ctts_count);
+        for (uint32_t i = 0; i != track->ctts_count; ++i) {
+            put_u32(b, track->ctts_sample_counts[i]);
+            put_u32(b, (uint32_t)track->ctts_sample_offsets[i]);
+        }
+        end_box(b, ctts);
+    }
+
+    if (!fragmented && track->sync_count != track->sample_count) {
+        size_t stss = begin_full_box(b, "stss", 0, 0);
+        put_u32(b, track->sync_count);
+        for (uint32_t i = 0; i != track->sync_count; ++i) {
+            put_u32(b, track->sync_samples[i]);
+        }
+        end_box(b, stss);
+    }
+
+    // Chunks with the same sample count share an entry.
+    uint32_t stsc_count = 0;
+    for (uint32_t i = 0; i != track->chunk_count; ++i) {
+        stsc_count += i == 0 || track->chunk_sample_counts[i] != track->chunk_sample_counts[i - 1];
+    }
+    size_t stsc = begin_full_box(b, "stsc", 0, 0);
+    put_u32(b, stsc_count);
+    for (uint32_t i = 0; i != track->chunk_count; ++i) {
+        if (i == 0 || track->chunk_sample_counts[i] != track->chunk_sample_counts[i - 1]) {
+            put_u32(b, i + 1);  // first_chunk
+            put_u32(b, track->chunk_sample_counts[i]);
+            put_u32(b, 1);      // sample_description_index
+        }
+    }
+    end_box(b, stsc);
+
+    uint32_t size_count = fragmented ? 0 : track->sample_count;
+    uint32_t const_size = size_count ? track->sizes[0] : 0;
+    for (uint32_t i = 1; i < size_count && const_size; ++i) {
+        if (track->sizes[i] != const_size) {
+            const_size = 0;
+        }
+    }
+    size_t stsz = begin_full_box(b, "stsz", 0, 0);
+    put_u32(b, const_size);
+    put_u32(b, size_count);
+    if (0 == const_size) {
+        for (uint32_t i = 0; i != size_count; ++i) {
+            put_u32(b, track->sizes[i]);
+        }
+    }
+    end_box(b, stsz);
+
+    int large = track->chunk_count && track->chunk_offsets[track->chunk_count - 1] > UINT32_MAX;
+    size_t stco = begin_full_box(b, large ? "co64" : "stco", 0, 0);
+    put_u32(b, track->chunk_count);
+    for (uint32_t i = 0; i != track->chunk_count; ++i) {
+        if (large) {
+            put_u64(b, track->chunk_offsets[i]);
+        } else {
+            put_u32(b, (uint32_t)track->chunk_offsets[i]);
+        }
+    }
+    end_box(b, stco);
+
+    end_box(b, stbl);
+}
+
+static void put_trak(box_buffer_t *b, mov_writer_t *writer, int index)
+{
+    const mov_writer_track_t *track = writer->tracks + index;
+    int fragmented = writer->config.fragmented;
+    uint64_t duration = fragmented ? 0 : track_duration(track);
+
+    size_t trak = begin_box(b, "trak");
+    put_tkhd(b, track, index + 1, duration * MOVIE_TIMESCALE / track->config.timescale);
+
+    size_t mdia = begin_box(b, "mdia");
+    put_mdhd(b, track, duration);
+    put_hdlr(b, track);
+
+    size_t minf = begin_box(b, "minf");
+    if (track->config.is_video) {
+        size_t vmhd = begin_full_box(b, "vmhd", 0, 1);
+        put_zeros(b, 8);        // graphicsmode, opcolor
+        end_box(b, vmhd);
+    } else {
+        size_t smhd = begin_full_box(b, "smhd", 0, 0);
+        put_zeros(b, 4);        // balance, reserved
+        end_box(b, smhd);
+    }
+
+    size_t dinf = begin_box(b, "dinf");
+    size_t dref = begin_full_box(b, "dref", 0, 0);
+    put_u32(b, 1);
+    end_box(b, begin_full_box(b, "url ", 0, 1));    // Data in this file.
+    end_box(b, dref);
+    end_box(b, dinf);
+
+    put_stbl(b, track, fragmented);
+    end_box(b, minf);
+    end_box(b, mdia);
+    end_box(b, trak);
+}
+
+static void put_moov(box_buffer_t *b, mov_writer_t *writer)
+{
+    uint64_t duration = 0;
+    if (!writer->config.fragmented) {
+        for (int i = 0; i != writer->track_count; ++i) {
+            const mov_writer_track_t *track = writer->tracks + i;
+            uint64_t d = track_duration(track) * MOVIE_TIMESCALE / track->config.timescale;
+            duration = d > duration ? d : duration;
+        }
+    }
+
+    size_t moov = begin_box(b, "moov");
+    put_mvhd(b, writer, duration);
+    for (int i = 0; i != writer->track_count; ++i) {
+        put_trak(b, writer, i);
+    }
+
+    if (writer->config.fragmented) {
+        size_t mvex = begin_box(b, "mvex");
+        for (int i = 0; i != writer->track_count; ++i) {
+            size_t trex = begin_full_box(b, "trex", 0, 0);
+            put_u32(b, i + 1);  // track_ID
+            put_u32(b, 1);      // default_sample_description_index
+            put_u32(b, 0);      // default_sample_duration
+            put_u32(b, 0);      // default_sample_size
+            put_u32(b, 0);      // default_sample_flags
+            end_box(b, trex);
+        }
+        end_box(b, mvex);
+    }
+    end_box(b, moov);
+}
+
+// Put 'ftyp', then 'moov' for fragmented files, or the reserved space and
+// 'mdat' header for progressive files.
+static void put_header(box_buffer_t *b, mov_writer_t *writer)
+{
+    put_ftyp(b, writer->config.fragmented);
+    if (writer->config.fragmented) {
+        put_moov(b, writer);
+        return;
+    }
+
+    if (writer->config.moov_reserve) {
+        uint32_t reserve = writer->config.moov_reserve < 8 ? 8 : writer->config.moov_reserve;
+        writer->reserve_offset = b->size;
+        end_box(b, begin_box(b, "free"));
+        put_zeros(b, reserve - 8);
+        end_box(b, writer->reserve_offset);
+    }
+
+    // 64-bit size, patched when closing.
+    writer->mdat_offset = b->size;
+    put_u32(b, 1);
+    put_bytes(b, "mdat", 4);
+    put_u64(b, 0);
+}
+
+static int write_header(mov_writer_t *writer)
+{
+    int ret;
+    box_buffer_t b = { 0 };
+
+    put_header(&b, writer);
+    if (b.failed) {
+        printf("failed to allocate file header\n");
+        free(b.data);
+        return -1;
+    }
+    ret = write_data(writer, b.data, b.size);
+    free(b.data);
+    writer->header_written = 1;
+
+    if (writer->primary_track < 0) {
+        writer->primary_track = 0;
+    }
+    return ret;
+}
+
+// Build 'moof' and the 'mdat' header of the samples gathered in the tracks.
+// Sample data goes right after, track by track. "next_dts" is the decoding
+// time of the sample after the fragment in track "next_track", -1 if
+// unknown. Otherwise the last sample lasts as long as the one before.
+static int build_fragment(mov_writer_t *writer, int next_track, int64_t next_dts, box_buffer_t *b)
+{
+    uint64_t payload = 0;
+    for (int i = 0; i != writer->track_count; ++i) {
+        mov_writer_track_t *track = writer->tracks + i;
+        for (uint32_t j = 0; j != track->frag_count; ++j) {
+            payload += track->frag_samples[j].size;
+        }
+    }
+
+    size_t *data_offset_pos = calloc(writer->track_count, sizeof(size_t));
+    if (NULL == data_offset_pos) {
+        printf("failed to allocate fragment\n");
+        return -1;
+    }
+
+    size_t moof = begin_box(b, "moof");
+    size_t mfhd = begin_full_box(b, "mfhd", 0, 0);
+    put_u32(b, writer->sequence_number);
+    end_box(b, mfhd);
+
+    for (int i = 0; i != writer->track_count; ++i) {
+        mov_writer_track_t *track = writer->tracks + i;
+        if (0 == track->frag_count) {
+            continue;
+        }
+
+        size_t traf = begin_box(b, "traf");
+        size_t tfhd = begin_full_box(b, "tfhd", 0, 0x020000);     // default-base-is-moof
+        put_u32(b, i + 1);
+        end_box(b, tfhd);
+
+        size_t tfdt = begin_full_box(b, "tfdt", 1, 0);
+        put_u64(b, track->frag_samples[0].dts);
+        end_box(b, tfdt);
+
+        // data-offset, sample-duration, -size, -flags and -composition-time-offset.
+        size_t trun = begin_full_box(b, "trun", 1, 0x000F01);
+        put_u32(b, track->frag_count);
+        data_offset_pos[i] = b->size;
+        put_u32(b, 0);
+        for (uint32_t j = 0; j != track->frag_count; ++j) {
+            const mov_writer_sample_t *sample = track->frag_samples + j;
+            uint32_t duration = track->last_delta;
+            if (j + 1 != track->frag_count) {
+                duration = (uint32_t)(sample[1].dts - sample->dts);
+            } else if (i == next_track && next_dts >= 0) {
+                duration = (uint32_t)(next_dts - sample->dts);
+            }
+            put_u32(b, duration);
+            put_u32(b, sample->size);
+            put_u32(b, sample->sync ? SAMPLE_FLAGS_SYNC : SAMPLE_FLAGS_NON_SYNC);
+            put_u32(b, (uint32_t)sample->cts_offset);
+        }
+        end_box(b, trun);
+        end_box(b, traf);
+    }
+    end_box(b, moof);
+
+    int large = payload + 8 > UINT32_MAX;
+    put_u32(b, large ? 1 : (uint32_t)(payload + 8));
+    put_bytes(b, "mdat", 4);
+    if (large) {
+        put_u64(b, payload + 16);
+    }
+
+    if (b->failed) {
+        printf("failed to allocate fragment\n");
+        free(data_offset_pos);
+        return -1;
+    }
+
+    // Sample data of each 'traf' follows the one before, right after 'moof'.
+    uint64_t data_offset = b->size - moof;
+    for (int i = 0; i != writer->track_count; ++i) {
+        mov_writer_track_t *track = writer->tracks + i;
+        if (track->frag_count) {
+            set_u32(b->data + data_offset_pos[i], (uint32_t)data_offset);
+        }
+        for (uint32_t j = 0; j != track->frag_count; ++j) {
+            data_offset += track->frag_samples[j].size;
+        }
+    }
+
+    free(data_offset_pos);
+    return 0;
+}
+
+// Write 'moof' and 'mdat' of the samples gathered for the fragment, see
+// build_fragment() for "next_dts" of the primary track.
+static int write_fragment(mov_writer_t *writer, int64_t next_dts)
+{
+    int ret;
+    box_buffer_t b = { 0 };
+
+    int empty = 1;
+    for (int i = 0; i != writer->track_count; ++i) {
+        empty &= 0 == writer->tracks[i].frag_count;
+    }
+    if (empty) {
+        return 0;
+    }
+
+    ++writer->sequence_number;
+    ret = build_fragment(writer, writer->primary_track, next_dts, &b);
+    if (ret == 0) {
+        ret = queue_data(writer, b.data, (uint32_t)b.size);
+    }
+    for (int i = 0; i != writer->track_count && ret == 0; ++i) {
+        mov_writer_track_t *track = writer->tracks + i;
+        for (uint32_t j = 0; j != track->frag_count && ret == 0; ++j) {
+            ret = queue_data(writer, track->frag_samples[j].data, track->frag_samples[j].size);
+        }
+        track->frag_count = 0;
+    }
+    if (ret == 0) {
+        ret = write_pending(writer);
+    }
+
+    free(b.data);
+    return ret;
+}
+
+int mov_writer_build_header(mov_writer_t *writer, uint8_t **data, size_t *size)
+{
+    box_buffer_t b = { 0 };
+
+    put_header(&b, writer);
+    if (b.failed) {
+        printf("failed to allocate file header\n");
+        free(b.data);
+        return -1;
+    }
+    *data = b.data;
+    *size = b.size;
+    return 0;
+}
+
+int mov_writer_build_fragment(mov_writer_t *writer, int track_index, uint32_t sequence_number,
+    const mov_writer_sample_t *samples, uint32_t count, int64_t next_dts, uint8_t **data, size_t *size)
+{
+    int ret = 0;
+    box_buffer_t b = { 0 };
+
+    if (track_index < 0 || track_index >= writer->track_count) {
+        printf("invalid writer track: %d\n", track_index);
+        return -1;
+    }
+
+    mov_writer_track_t *track = writer->tracks + track_index;
+    track->frag_count = 0;
+    for (uint32_t i = 0; i != count && ret == 0; ++i) {
+        ret = add_fragment_sample(track, samples + i);
+    }
+    // A single sample keeps the delta of the previous fragment.
+    if (count > 1) {
+        track->last_delta = (uint32_t)(samples[count - 1].dts - samples[count - 2].dts);
+    }
+    writer->sequence_number = sequence_number;
+
+    if (ret == 0) {
+        ret = build_fragment(writer, track_index, next_dts, &b);
+    }
+    track->frag_count = 0;
+    if (ret != 0) {
+        free(b.data);
+        return ret;
+    }
+    *data = b.data;
+    *size = b.size;
+    return 0;
+}
+
+static int add_stts_delta(mov_writer_track_t *track, uint32_t delta)
+{
+    if (track->stts_count && track->stts_sample_deltas[track->stts_count - 1] == delta) {
+        ++track->stts_sample_counts[track->stts_count - 1];
+        return 0;
+    }
+    if (track->stts_count == track->stts_capacity) {
+        uint32_t capacity = next_capacity(track->stts_capacity);
+        if (resize_array(&track->stts_sample_counts, capacity, sizeof(uint32_t)) != 0 ||
+            resize_array(&track->stts_sample_deltas, capacity, sizeof(uint32_t)) != 0) {
+            return -1;
+        }
+        track->stts_capacity = capacity;
+    }
+    track->stts_sample_counts[track->stts_count] = 1;
+    track->stts_sample_deltas[track->stts_count] = delta;
+    ++track->stts_count;
+    return 0;
+}
+
+// Add the sample to the progressive tables of the track. Its duration is
+// only known from the next sample, see "last_delta".
+static int add_table_sample(mov_writer_t *writer, mov_writer_track_t *track, const mov_writer_sample_t *sample)
+{
+    if (track->sample_count == track->size_capacity) {
+        uint32_t capacity = next_capacity(track->size_capacity);
+        if (resize_array(&track->sizes, capacity, sizeof(uint32_t)) != 0) {
+            return -1;
+        }
+        track->size_capacity = capacity;
+    }
+    track->sizes[track->sample_count] = sample->size;
+
+    if (track->sample_count && add_stts_delta(track, track->last_delta) != 0) {
+        return -1;
+    }
+
+    if (track->ctts_count && track->ctts_sample_offsets[track->ctts_count - 1] == sample->cts_offset) {
+        ++track->ctts_sample_counts[track->ctts_count - 1];
+    } else {
+        if (track->ctts_count == track->ctts_capacity) {
+            uint32_t capacity = next_capacity(track->ctts_capacity);
+            if (resize_array(&track->ctts_sample_counts, capacity, sizeof(uint32_t)) != 0 ||
+                resize_array(&track->ctts_sample_offsets, capacity, sizeof(int32_t)) != 0) {
+                return -1;
+            }
+            track->ctts_capacity = capacity;
+        }
+        track->ctts_sample_counts[track->ctts_count] = 1;
+        track->ctts_sample_offsets[track->ctts_count] = sample->cts_offset;
+        ++track->ctts_count;
+    }
+    track->has_cts |= sample->cts_offset != 0;
+
+    if (sample->sync) {
+        if (track->sync_count == track->sync_capacity) {
+            uint32_t capacity = next_capacity(track->sync_capacity);
+            if (resize_array(&track->sync_samples, capacity, sizeof(uint32_t)) != 0) {
+                return -1;
+            }
+            track->sync_capacity = capacity;
+        }
+        track->sync_samples[track->sync_count++] = track->sample_count + 1;
+    }
+
+    // A new chunk starts whenever data of another track came in between.
+    int index = (int)(track - writer->tracks);
+    if (writer->last_chunk_track != index) {
+        if (track->chunk_count == track->chunk_capacity) {
+            uint32_t capacity = next_capacity(track->chunk_capacity);
+            if (resize_array(&track->chunk_offsets, capacity, sizeof(uint64_t)) != 0 ||
+                resize_array(&track->chunk_sample_counts, capacity, sizeof(uint32_t)) != 0) {
+                return -1;
+            }
+            track->chunk_capacity = capacity;
+        }
+        track->chunk_offsets[track->chunk_count] = writer->pos;
+        track->chunk_sample_counts[track->chunk_count] = 0;
+        ++track->chunk_count;
+        writer->last_chunk_track = index;
+    }
+    ++track->chunk_sample_counts[track->chunk_count - 1];
+    return 0;
+}
+
+static int add_fragment_sample(mov_writer_track_t *track, const mov_writer_sample_t *sample)
+{
+    if (track->frag_count == track->frag_capacity) {
+        uint32_t capacity = next_capacity(track->frag_capacity);
+        if (resize_array(&track->frag_samples, capacity, sizeof(mov_writer_sample_t)) != 0) {
+            return -1;
+        }
+        track->frag_capacity = capacity;
+    }
+    track->frag_samples[track->frag_count++] = *sample;
+    return 0;
+}
+
+int mov_writer_write_sample(mov_writer_t *writer, int track_index, const mov_writer_sample_t *sample)
+{
+    int ret;
+    int flushed = 0;
+
+    if (NULL == writer->f) {
+        printf("writer has no output file\n");
+        return -1;
+    }
+    if (track_index < 0 || track_index >= writer->track_count) {
+        printf("invalid writer track: %d\n", track_index);
+        return -1;
+    }
+    if (!writer->header_written) {
+        ret = write_header(writer);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    mov_writer_track_t *track = writer->tracks + track_index;
+    if (track->sample_count) {
+        if (sample->dts < track->last_dts) {
+            printf("decoding time goes back in track %d: %llu\n", track_index + 1, sample->dts);
+            return -1;
+        }
+        track->last_delta = (uint32_t)(sample->dts - track->last_dts);
+    } else {
+        track->first_dts = sample->dts;
+    }
+
+    if (writer->config.fragmented) {
+        // Cut before a sync sample of the primary track, once long enough.
+        mov_writer_track_t *primary = writer->tracks + writer->primary_track;
+        if (track_index == writer->primary_track && sample->sync && primary->frag_count &&
+            (sample->dts - primary->frag_samples[0].dts) * 1000 >=
+            (uint64_t)writer->config.fragment_duration_ms * primary->config.timescale) {
+            ret = write_fragment(writer, (int64_t)sample->dts);
+            if (ret != 0) {
+                return -1;
+            }
+            flushed = 1;
+        }
+        ret = add_fragment_sample(track, sample);
+    } else {
+        if (writer->pending_count >= WRITER_MAX_IOV || writer->pending_bytes >= WRITER_MAX_PENDING_BYTES) {
+            ret = write_pending(writer);
+            if (ret != 0) {
+                return -1;
+            }
+            flushed = 1;
+        }
+        ret = add_table_sample(writer, track, sample);
+        if (ret == 0) {
+            ret = queue_data(writer, sample->data, sample->size);
+        }
+    }
+    if (ret != 0) {
+        return -1;
+    }
+
+    track->last_dts = sample->dts;
+    ++track->sample_count;
+    return flushed;
+}
+
+// Move "size" bytes at "from" to "to", a later offset of the same file.
+// Blocks are copied from the end, so data is read before being overwritten.
+// @return 0 on success.
+static int move_data_forward(FILE *f, uint64_t from, uint64_t to, uint64_t size)
+{
+    uint8_t *buffer = malloc(WRITER_MOVE_BLOCK);
+    if (NULL == buffer) {
+        printf("failed to allocate move buffer\n");
+        return -1;
+    }
+
+    int ret = 0;
+    uint64_t left = size;
+    while (left && ret == 0) {
+        size_t n = left < WRITER_MOVE_BLOCK ? (size_t)left : WRITER_MOVE_BLOCK;
+        left -= n;
+        if (_fseeki64(f, from + left, SEEK_SET) != 0 || fread(buffer, 1, n, f) != n ||
+            _fseeki64(f, to + left, SEEK_SET) != 0 || fwrite(buffer, 1, n, f) != n) {
+            printf("failed to move %zu bytes at: %llu\n", n, from + left);
+            ret = -1;
+        }
+    }
+    free(buffer);
+    return ret;
+}
+
+static void shift_chunk_offsets(mov_writer_t *writer, uint64_t shift)
+{
+    for (int i = 0; i != writer->track_count; ++i) {
+        mov_writer_track_t *track = writer->tracks + i;
+        for (uint32_t j = 0; j != track->chunk_count; ++j) {
+            track->chunk_offsets[j] += shift;
+        }
+    }
+}
+
+// Put 'moov' of a progressive file in front of 'mdat': into the reserved
+// space if it fits, otherwise 'mdat' is moved behind it and chunk offsets
+// are patched.
+static int write_progressive_moov(mov_writer_t *writer)
+{
+    int ret;
+    uint8_t size[8];
+
+    // The last sample of each track lasts as long as the one before.
+    for (int i = 0; i != writer->track_count; ++i) {
+        mov_writer_track_t *track = writer->tracks + i;
+        if (track->sample_count && add_stts_delta(track, track->last_delta) != 0) {
+            return -1;
+        }
+    }
+
+    box_buffer_t b = { 0 };
+    put_moov(&b, writer);
+    if (b.failed) {
+        printf("failed to allocate moov\n");
+        free(b.data);
+        return -1;
+    }
+
+    // 'mdat' runs up to the end of the file.
+    set_u32(size, (uint32_t)((writer->pos - writer->mdat_offset) >> 32));
+    set_u32(size + 4, (uint32_t)(writer->pos - writer->mdat_offset));
+    _fseeki64(writer->f, writer->mdat_offset + 8, SEEK_SET);
+    ret = fwrite(size, 1, 8, writer->f) == 8 ? 0 : -1;
+
+    // What is left of the reserved space must hold a 'free' box header.
+    uint32_t reserve = writer->config.moov_reserve < 8 ? 8 : writer->config.moov_reserve;
+    if (ret == 0 && writer->config.moov_reserve &&
+        (b.size == reserve || b.size + 8 <= reserve)) {
+        _fseeki64(writer->f, writer->reserve_offset, SEEK_SET);
+        ret = fwrite(b.data, 1, b.size, writer->f) == b.size ? 0 : -1;
+        if (ret == 0 && b.size != reserve) {
+            uint8_t free_header[8];
+            set_u32(free_header, (uint32_t)(reserve - b.size));
+            memcpy(free_header + 4, "free", 4);
+            ret = fwrite(free_header, 1, 8, writer->f) == 8 ? 0 : -1;
+        }
+    } else if (ret == 0) {
+        // 'moov' takes the place of the reserved space, a gap left before
+        // 'mdat' must hold a 'free' box. Larger offsets may need 'co64', so
+        // the shift is settled once 'moov' stops growing.
+        uint64_t start = writer->config.moov_reserve ? writer->reserve_offset : writer->mdat_offset;
+        uint64_t shift = 0;
+        uint64_t moov_end = start + b.size;
+        uint64_t need = moov_end > writer->mdat_offset ? moov_end - writer->mdat_offset :
+            moov_end + 8 - writer->mdat_offset;
+        while (need != shift) {
+            shift_chunk_offsets(writer, need - shift);
+            shift = need;
+            free(b.data);
+            memset(&b, 0, sizeof(b));
+            put_moov(&b, writer);
+            if (b.failed) {
+                printf("failed to allocate moov\n");
+                free(b.data);
+                return -1;
+            }
+            moov_end = start + b.size;
+            need = moov_end > writer->mdat_offset ? moov_end - writer->mdat_offset :
+                moov_end + 8 - writer->mdat_offset;
+        }
+        if (writer->config.moov_reserve) {
+            printf("moov of %zu bytes does not fit the reserved %u bytes, media data moved by %llu bytes\n",
+                b.size, reserve, shift);
+        }
+
+        ret = move_data_forward(writer->f, writer->mdat_offset, writer->mdat_offset + shift,
+            writer->pos - writer->mdat_offset);
+        if (ret == 0) {
+            _fseeki64(writer->f, start, SEEK_SET);
+            ret = fwrite(b.data, 1, b.size, writer->f) == b.size ? 0 : -1;
+        }
+        if (ret == 0 && moov_end != writer->mdat_offset + shift) {
+            uint8_t free_header[8];
+            set_u32(free_header, (uint32_t)(writer->mdat_offset + shift - moov_end));
+            memcpy(free_header + 4, "free", 4);
+            ret = fwrite(free_header, 1, 8, writer->f) == 8 ? 0 : -1;
+        }
+        writer->pos += shift;
+    }
+    if (ret != 0) {
+        printf("failed to write moov\n");
+    }
+
+    free(b.data);
+    return ret;
+}
+
+static void free_track(mov_writer_track_t *track)
+{
+    free(track->decoder_config);
+    free(track->stts_sample_counts);
+    free(track->stts_sample_deltas);
+    free(track->ctts_sample_counts);
+    free(track->ctts_sample_offsets);
+    free(track->sync_samples);
+    free(track->sizes);
+    free(track->chunk_offsets);
+    free(track->chunk_sample_counts);
+    free(track->frag_samples);
+}
+
+int mov_writer_close(mov_writer_t *writer)
+{
+    int ret = 0;
+
+    // Nothing to write for a writer only used to build boxes.
+    if (writer->f) {
+        if (!writer->header_written) {
+            ret = write_header(writer);
+        }
+        if (ret == 0 && writer->config.fragmented) {
+            ret = write_fragment(writer, -1);
+        } else if (ret == 0) {
+            ret = write_pending(writer);
+            if (ret == 0) {
+                ret = write_progressive_moov(writer);
+            }
+        }
+        if (fclose(writer->f) != 0) {
+            printf("failed to close output file\n");
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; i != writer->track_count; ++i) {
+        free_track(writer->tracks + i);
+    }
+    free(writer->tracks);
+    free(writer->pending);
+    memset(writer, 0, sizeof(*writer));
+    return ret;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// MP4 writer. Samples are given in decoding order per track, interleaved
+// in the order their data should land in the file.
+//
+// Progressive files are laid out as 'ftyp' 'moov' [free] 'mdat'. With
+// "moov_reserve" set, 'moov' is written into the reserved 'free' box in
+// front of 'mdat' if it fits, the rest of the reserved space stays 'free'.
+// Otherwise 'mdat' is moved behind 'moov' on closing, a second pass over
+// the media data that the reservation avoids.
+//
+// Fragmented files are laid out as 'ftyp' 'moov' ('moof' 'mdat')*. A
+// fragment is cut before a sync sample of the first video track (or the
+// first track) once it holds "fragment_duration_ms" of that track.
+//
+// Sample data is not copied. It is written straight from the caller's
+// buffers, gathered with writev() where available.
+
+typedef struct tag_mov_writer_config {
+    int fragmented;
+    uint32_t fragment_duration_ms;
+    uint32_t moov_reserve;      // Bytes reserved before 'mdat' of progressive files.
+} mov_writer_config_t;
+
+typedef struct tag_mov_writer_track_config {
+    uint32_t timescale;
+    int is_video;               // Audio otherwise.
+    char codec_format[5];       // "avc1", "avc3", "hvc1", "hev1" or "mp4a".
+    uint16_t width;
+    uint16_t height;
+    uint16_t channel_count;
+    uint32_t sample_rate;
+
+    // 'avcC' or 'hvcC' content for video, AudioSpecificConfig for "mp4a".
+    // Without one, audio is described as AAC LC.
+    const uint8_t *decoder_config;
+    uint32_t decoder_config_len;
+} mov_writer_track_config_t;
+
+typedef struct tag_mov_writer_sample {
+    const uint8_t *data;
+    uint32_t size;
+    uint64_t dts;               // In the track timescale.
+    int32_t cts_offset;
+    int sync;
+} mov_writer_sample_t;
+
+// Sample data waiting to be written.
+typedef struct tag_mov_writer_data {
+    const uint8_t *data;
+    uint32_t size;
+} mov_writer_data_t;
+
+typedef struct tag_mov_writer_track {
+    mov_writer_track_config_t config;
+    uint8_t *decoder_config;    // Owned copy of config.decoder_config.
+
+    uint32_t sample_count;
+    uint64_t first_dts;
+    uint64_t last_dts;
+    uint32_t last_delta;
+
+    // Progressive tables, run-length coded as they are stored.
+    uint32_t stts_count;
+    uint32_t stts_capacity;
+    uint32_t *stts_sample_counts;
+    uint32_t *stts_sample_deltas;
+
+    uint32_t ctts_count;
+    uint32_t ctts_capacity;
+    uint32_t *ctts_sample_counts;
+    int32_t *ctts_sample_offsets;
+    int has_cts;
+
+    uint32_t sync_count;
+    uint32_t sync_capacity;
+    uint32_t *sync_samples;
+
+    uint32_t size_capacity;
+    uint32_t *sizes;
+
+    uint32_t chunk_count;
+    uint32_t chunk_capacity;
+    uint64_t *chunk_offsets;
+    uint32_t *chunk_sample_counts;
+
+    // Samples of the fragment being built.
+    uint32_t frag_count;
+    uint32_t frag_capacity;
+    mov_writer_sample_t *frag_samples;
+} mov_writer_track_t;
+
+typedef struct tag_mov_writer {
+    FILE *f;
+    mov_writer_config_t config;
+    uint64_t pos;               // File size once pending data is written.
+
+    mov_writer_track_t *tracks;
+    int track_count;
+    int header_written;
+
+    // Progressive layout.
+    uint64_t reserve_offset;    // Offset of the reserved 'free' box.
+    uint64_t mdat_offset;
+    int last_chunk_track;       // Track of the chunk being written, -1 if none.
+
+    // Fragmented layout.
+    uint32_t sequence_number;
+    int primary_track;          // Fragments are cut on sync samples of this track.
+
+    mov_writer_data_t *pending;
+    uint32_t pending_count;
+    uint32_t pending_capacity;
+    uint64_t pending_bytes;
+} mov_writer_t;
+
+// "filename" may be NULL for a writer only used to build boxes, see
+// mov_writer_build_header() and mov_writer_build_fragment().
+// @return 0 on success.
+int mov_writer_open(mov_writer_t *writer, const char *filename, const mov_writer_config_t *config);
+
+// Tracks are added before the first sample is written. The decoder config
+// is copied.
+// @return index of the track, or -1 on failure.
+int mov_writer_add_track(mov_writer_t *writer, const mov_writer_track_config_t *config);
+
+// Queue a sample of track "track". Its data must stay valid until a later
+// call returns 1, or until mov_writer_close().
+// @return 1 when data of all samples before this one have been written,
+// 0 when they may still be referenced, -1 on failure.
+int mov_writer_write_sample(mov_writer_t *writer, int track, const mov_writer_sample_t *sample);
+
+// Build the file header in memory: 'ftyp' and 'moov' of a fragmented file,
+// an initialization segment. "*data" is to be freed by the caller.
+// @return 0 on success.
+int mov_writer_build_header(mov_writer_t *writer, uint8_t **data, size_t *size);
+
+// Build 'moof' and the 'mdat' header of a fragment holding "count" samples
+// of track "track", in memory. Sample data is not touched: the caller
+// writes it right after the header, in sample order. "next_dts" is the
+// decoding time of the sample following the fragment, -1 if none.
+// "*data" is to be freed by the caller.
+// @return 0 on success.
+int mov_writer_build_fragment(mov_writer_t *writer, int track, uint32_t sequence_number,
+    const mov_writer_sample_t *samples, uint32_t count, int64_t next_dts, uint8_t **data, size_t *size);
+
+// Write pending samples and 'moov', then close the file. The writer is
+// released even on failure.
+// @return 0 on success.
+int mov_writer_close(mov_writer_t *writer);
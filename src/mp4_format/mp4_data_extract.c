@@ -1,51 +1,135 @@
 #include "mov_defs.h"
 #include "mov_read_functions.h"
+#include "mov_sample_index.h"
+#include "mov_demux.h"
+#include "mov_seek.h"
+#include "mov_thread.h"
+#include "decoder_config_record.h"
 
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
 static mov_track_t *get_video_track(mov_ctx_t *ctx);
 static mov_track_t *get_audio_track(mov_ctx_t *ctx);
-static void extract_raw_h26x_video(mov_ctx_t *ctx, const char *filename);
-static void extract_raw_aac_audio(mov_ctx_t *ctx, const char *filename);
+static int is_avc_format(const char *codec_format);
+static int is_hevc_format(const char *codec_format);
+static int select_tracks(mov_ctx_t *ctx, const char *list);
+static void extract_raw_streams(mov_ctx_t *ctx);
+static void extract_keyframes(mov_ctx_t *ctx);
+static int print_fragment(mov_ctx_t *ctx, uint64_t moof_offset, void *opaque);
 
 static const uint8_t prefix_code[] = { 0x00, 0x00, 0x00, 0x01 };
 
-static uint8_t buffer[4 * 1024 * 1024];
+// Samples are read in runs of contiguous data, up to this size per read.
+#define MAX_READ_RUN (8 * 1024 * 1024)
+
+// Pieces of output gathered per writev().
+#define OUTPUT_BATCH_CHUNKS 1024
+
+// Runs read ahead of the output threads.
+#define READ_SLOTS 4
+
+// Tracks to extract and their output files.
+#define MAX_OUTPUTS 32
+static mov_track_t *extract_tracks[MAX_OUTPUTS];
+static char extract_filenames[MAX_OUTPUTS][64];
+static int extract_count = 0;
+
+// Time range to extract, in seconds. Negative when not set.
+static double range_start = -1;
+static double range_duration = -1;
+
+// Use the compressed sample index, for very long tracks.
+static int use_packed_index = 0;
+
+// Only extract every n-th sync sample of video tracks. 0 to extract all samples.
+static uint32_t keyframe_interval = 0;
 
 int main(int argc, char *argv[])
 {
     int ret;
 
-    if (argc < 2) {
-        fprintf(stdout, "Usage: %s <filename>\n", argv[0]);
+    const char *filename = NULL;
+    int lazy = 0;
+    int follow = 0;
+    const char *track_list = NULL;
+    const char *profile_filename = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--lazy") == 0) {
+            lazy = 1;
+        } else if (strcmp(argv[i], "--packed") == 0) {
+            use_packed_index = 1;
+        } else if (strcmp(argv[i], "--follow") == 0) {
+            follow = 1;
+        } else if (strcmp(argv[i], "--tracks") == 0 && i + 1 < argc) {
+            track_list = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile_filename = argv[++i];
+        } else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) {
+            range_start = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            range_duration = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--keyframes") == 0 && i + 1 < argc) {
+            keyframe_interval = (uint32_t)strtoul(argv[++i], NULL, 10);
+            if (keyframe_interval == 0) {
+                keyframe_interval = 1;
+            }
+        } else {
+            filename = argv[i];
+        }
+    }
+
+    if (NULL == filename) {
+        fprintf(stdout, "Usage: %s [--lazy] [--packed] [--follow] [--tracks <all|id,...>]\n"
+            "    [--start <seconds>] [--duration <seconds>] [--keyframes <n>] [--profile <json>] <filename>\n", argv[0]);
+        fprintf(stdout, "  --lazy    only index sample tables, decode them when extracting\n");
+        fprintf(stdout, "  --packed  use compressed sample index\n");
+        fprintf(stdout, "  --follow  report fragments of a growing file as they are written\n");
+        fprintf(stdout, "  --tracks  extract all tracks, or tracks of the ids, to mp4_data_extract_<id>.<ext>\n");
+        fprintf(stdout, "  --start, --duration  only extract this time range, video from the sync sample before\n");
+        fprintf(stdout, "  --keyframes  only extract every n-th sync sample of video, each with parameter sets\n");
+        fprintf(stdout, "  --profile report time and bytes read per box to a JSON file\n");
         return 1;
     }
 
-    const char *filename = argv[1];
     printf("Processing file: %s\n", filename);
 
     mov_ctx_t *mov_ctx = malloc(sizeof(*mov_ctx));
     memset(mov_ctx, 0, sizeof(*mov_ctx));
+    mov_ctx->lazy = lazy;
+    mov_ctx->profile = profile_filename != NULL;
 
-    ret = parse_mov_file(filename, mov_ctx);
+    if (follow) {
+        // Stop when the recorder has not written for 10 seconds.
+        ret = mov_follow_file(filename, mov_ctx, 200, 10000, print_fragment, NULL);
+    } else {
+        ret = parse_mov_file(filename, mov_ctx);
+    }
     if (ret != 0) {
         printf("failed to parse_mov_file\n");
+        mov_ctx_free(mov_ctx);
+        free(mov_ctx);
         return 1;
     }
     printf("succeeded parsing\n");
 
-
 #if 0
     // extract raw video data.
     mov_track_t *video_track = get_video_track(mov_ctx);
     if (video_track) {
-        if (strncmp(video_track->codec_format, "avc1", 4) == 0) {
-            extract_raw_h26x_video(mov_ctx, "mp4_data_extract.264");
-        } else if (strncmp(video_track->codec_format, "hvc1", 4) == 0) {
-            extract_raw_h26x_video(mov_ctx, "mp4_data_extract.265");
+        if (is_avc_format(video_track->codec_format)) {
+            extract_tracks[extract_count] = video_track;
+            strcpy(extract_filenames[extract_count++], "mp4_data_extract.264");
+        } else if (is_hevc_format(video_track->codec_format)) {
+            extract_tracks[extract_count] = video_track;
+            strcpy(extract_filenames[extract_count++], "mp4_data_extract.265");
         }
     }
 #endif
@@ -55,18 +139,57 @@ int main(int argc, char *argv[])
     mov_track_t *audio_track = get_audio_track(mov_ctx);
     if (audio_track) {
         if (strncmp(audio_track->codec_format, "mp4a", 4) == 0) {
-            extract_raw_aac_audio(mov_ctx, "mp4_data_extract.aac");
+            extract_tracks[extract_count] = audio_track;
+            strcpy(extract_filenames[extract_count++], "mp4_data_extract.aac");
         }
     }
 #endif
 
-    // TODO clean mov ctx.
+    if (track_list && select_tracks(mov_ctx, track_list) != 0) {
+        mov_ctx_free(mov_ctx);
+        free(mov_ctx);
+        return 1;
+    }
 
+    if (keyframe_interval) {
+        extract_keyframes(mov_ctx);
+    } else {
+        // All tracks are extracted in one pass over the file.
+        extract_raw_streams(mov_ctx);
+    }
+
+    // After extraction, which loads deferred tables.
+    if (profile_filename) {
+        FILE *f = fopen(profile_filename, "w");
+        if (NULL == f || mov_write_box_profile(mov_ctx, f) != 0) {
+            printf("failed to write profile: %s\n", profile_filename);
+        }
+        if (f) {
+            fclose(f);
+        }
+    }
+
+    mov_ctx_free(mov_ctx);
     free(mov_ctx);
     printf("end\n");
     return 0;
 }
 
+static int print_fragment(mov_ctx_t *ctx, uint64_t moof_offset, void *opaque)
+{
+    printf("fragment at: %llu\n", moof_offset);
+    for (int i = 0; i != ctx->track_count; ++i) {
+        mov_track_t *track = ctx->tracks + i;
+        if (track->fragment_count == 0) {
+            continue;
+        }
+        printf("  track %u, samples: %u, base decode time: %llu\n", track->trackid,
+            track->samples.count - track->fragments[0].first_sample,
+            track->fragments[0].base_decode_time);
+    }
+    return 0;
+}
+
 static mov_track_t *get_video_track(mov_ctx_t *ctx)
 {
     for (int i = 0; i != ctx->track_count; ++i) {
@@ -87,68 +210,176 @@ static mov_track_t *get_audio_track(mov_ctx_t *ctx)
     return NULL;
 }
 
-static int h26x_process_sample(uint8_t *buffer, uint32_t sample_len, FILE *f)
+// avc1 or avc3.
+static int is_avc_format(const char *codec_format)
 {
-    int ret;
-    int pos_in_sample = 0;
-    while (pos_in_sample < sample_len - 4) {
-        uint8_t *pos = buffer + pos_in_sample;
-        uint32_t remain_len = sample_len - pos_in_sample - 4;
-        uint32_t prefix_len = (pos[0] << 24) | (pos[1] << 16) | (pos[2] << 8) | pos[3];
-        if (prefix_len > remain_len) {
-            printf("invalid prefix_len: %u, remain_len: %u\n", prefix_len, remain_len);
-            break;
+    return strncmp(codec_format, "avc", 3) == 0;
+}
+
+// hvc1 or hev1.
+static int is_hevc_format(const char *codec_format)
+{
+    return strncmp(codec_format, "hvc", 3) == 0 || strncmp(codec_format, "hev", 3) == 0;
+}
+
+// Add "track" to the extracted tracks, if its codec can be written raw.
+// @return 0 on success.
+static int add_extract_track(mov_track_t *track)
+{
+    const char *ext;
+    if (is_avc_format(track->codec_format)) {
+        ext = "264";
+    } else if (is_hevc_format(track->codec_format)) {
+        ext = "265";
+    } else if (strncmp(track->codec_format, "mp4a", 4) == 0) {
+        ext = "aac";
+    } else {
+        printf("codec of track %u is not supported: %.4s\n", track->trackid, track->codec_format);
+        return -1;
+    }
+
+    for (int i = 0; i != extract_count; ++i) {
+        if (extract_tracks[i] == track) {
+            return 0;
         }
+    }
+    if (extract_count == MAX_OUTPUTS) {
+        printf("too many tracks to extract\n");
+        return -1;
+    }
+    extract_tracks[extract_count] = track;
+    snprintf(extract_filenames[extract_count], sizeof(extract_filenames[0]),
+        "mp4_data_extract_%u.%s", track->trackid, ext);
+    ++extract_count;
+    return 0;
+}
 
-        // Write nalu.
-        ret = fwrite(prefix_code, sizeof(prefix_code), 1, f);
-        if (ret != 1) {
-            printf("failed to write prefix code.\n");
-            return -1;
+// Select tracks from "list": "all", or comma separated track ids.
+// @return 0 on success.
+static int select_tracks(mov_ctx_t *ctx, const char *list)
+{
+    if (strcmp(list, "all") == 0) {
+        for (int i = 0; i != ctx->track_count; ++i) {
+            mov_track_t *track = ctx->tracks + i;
+            if (track->valid && (track->is_video || track->is_audio)) {
+                add_extract_track(track);
+            }
         }
-        ret = fwrite(pos + 4, prefix_len, 1, f);
-        if (ret != 1) {
-            printf("failed to write nalu body.\n");
+        return 0;
+    }
+
+    while (*list) {
+        char *end;
+        unsigned long id = strtoul(list, &end, 10);
+        if (end == list || (*end != ',' && *end != '\0')) {
+            printf("invalid track list: %s\n", list);
             return -1;
         }
 
-        pos_in_sample += prefix_len + 4;
-        if (pos_in_sample == sample_len) {
-            //printf("current sample parsed successfully.\n");
-            break;
+        mov_track_t *track = NULL;
+        for (int i = 0; i != ctx->track_count; ++i) {
+            if (ctx->tracks[i].valid && ctx->tracks[i].trackid == id) {
+                track = ctx->tracks + i;
+            }
+        }
+        if (NULL == track) {
+            printf("track not found: %lu\n", id);
+            return -1;
+        }
+        if (add_extract_track(track) != 0) {
+            return -1;
         }
+        list = *end ? end + 1 : end;
     }
-
     return 0;
 }
 
-static int aac_process_sample(uint8_t *buffer, uint32_t sample_len, uint32_t frequency,
-    uint32_t channel_count, FILE *f)
-{
-    int ret;
+// A run of contiguous samples, read at once.
+typedef struct tag_read_slot {
+    uint8_t *buffer;            // Grown to the largest run.
+    uint64_t buffer_size;
+    uint64_t offset;            // File offset of the run.
+    mov_demux_sample_t *run;
+    uint32_t run_count;
+    uint32_t run_capacity;
+    int pending;                // Outputs still processing the run.
+} read_slot_t;
+
+// The file is read on the calling thread, and each output is written on a
+// thread of its own. "slots" are handed over with "mutex" held.
+typedef struct tag_extract_pipeline {
+    mov_mutex_t mutex;
+    mov_cond_t cond;
+    read_slot_t slots[READ_SLOTS];
+    int done;
+} extract_pipeline_t;
 
-    static int frequency_array[] = {
+// Raw stream written from one track.
+typedef struct tag_extract_output {
+    mov_track_t *track;
+    FILE *f;
+    int is_h26x;
+    int is_aac;
+    uint32_t sample_count;
+
+    uint8_t adts_template[7];   // Only aac_frame_length varies per frame.
+
+    // Output is gathered, pieces point into the read buffer or to
+    // "adts_headers", until flush_output().
+    const uint8_t *chunks[OUTPUT_BATCH_CHUNKS];
+    uint32_t chunk_sizes[OUTPUT_BATCH_CHUNKS];
+    uint32_t chunk_count;
+    uint8_t adts_headers[OUTPUT_BATCH_CHUNKS / 2][7];
+    uint32_t adts_count;
+
+    // Slots to process, in file order.
+    extract_pipeline_t *pipeline;
+    mov_thread_t thread;
+    int queue[READ_SLOTS];
+    int queue_head;
+    int queue_count;
+    uint32_t first_sample;      // Samples [first_sample, end_sample) are extracted.
+    uint32_t end_sample;
+    int queued;                 // The slot being filled has samples of the track.
+    int failed;
+} extract_output_t;
+
+// Build the ADTS header of the track, from the AudioSpecificConfig of
+// 'esds', or from the sample entry as AAC LC without one.
+// @return 0 on success.
+static int make_adts_template(mov_track_t *track, uint8_t adts[7])
+{
+    static const uint32_t frequency_array[] = {
         96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000,
-        11025, 8000
+        11025, 8000, 7350
     };
-    static uint32_t frequency_array_len = sizeof(frequency_array) / sizeof(int);
+    static const uint32_t frequency_array_len = sizeof(frequency_array) / sizeof(frequency_array[0]);
 
-    uint8_t frequency_index = frequency_array_len;
-    for (int i = 0; i != frequency_array_len; ++i) {
-        if (frequency == frequency_array[i]) {
-            frequency_index = i;
-            break;
+    aac_audio_config_t config;
+    memset(&config, 0, sizeof(config));
+    if (track->audio_specific_config_len == 0 ||
+        aac_audio_config_parse(track->audio_specific_config, track->audio_specific_config_len, &config) != 0) {
+        config.object_type = 2;     // AAC LC
+        config.sampling_index = frequency_array_len;
+        for (uint8_t i = 0; i != frequency_array_len; ++i) {
+            if (track->audio_sample_rate == frequency_array[i]) {
+                config.sampling_index = i;
+                break;
+            }
         }
+        config.channel_config = (uint8_t)track->channel_count;
     }
-    if (frequency_index == frequency_array_len) {
-        printf("audio sample frequency not found: %u\n", frequency);
+
+    // ADTS only has room for the first four object types, HE-AAC is carried
+    // as its core with implicit SBR.
+    if (config.object_type < 1 || config.object_type > 4) {
+        printf("audio object type not supported by ADTS: %u\n", config.object_type);
+        return -1;
+    }
+    if (config.sampling_index >= frequency_array_len) {
+        printf("audio sample frequency not found: %u\n", track->audio_sample_rate);
         return -1;
     }
-
-    uint16_t frame_length = 7 + sample_len;
-
-    // Formulate ADTS header.
-    uint8_t adts[7];
 
     // fixed header.
     // syncword
@@ -156,244 +387,739 @@ static int aac_process_sample(uint8_t *buffer, uint32_t sample_len, uint32_t fre
     adts[1] = 0xF0;
     // ID, layer, protection_absent.
     adts[1] |= (0x0 << 3) | (0x00 << 1) | 0x1;
-    // profile object type. 1 for AAC LC.
-    adts[2] = 0x1 << 6;
+    // profile, audio object type minus 1.
+    adts[2] = (config.object_type - 1) << 6;
     // sampling_frequency_index
-    adts[2] |= (frequency_index & 0xF) << 2;
+    adts[2] |= (config.sampling_index & 0xF) << 2;
     // private bit.
     adts[2] |= 0 << 1;
     // channel_configuration
-    adts[2] |= (channel_count >> 2) & 0x1;
-    adts[3] = (channel_count & 0x3) << 6;
+    adts[2] |= (config.channel_config >> 2) & 0x1;
+    adts[3] = (config.channel_config & 0x3) << 6;
     // original_copy, home.
     adts[3] |= (0 << 5) | (0 << 4);
 
     // variable header.
     // copyright_identification_bit, copyright_identification_start
     adts[3] |= (0 << 3) | (0 << 2);
-    // aac_frame_length
-    adts[3] |= frame_length >> 11;  // 2 bits
-    adts[4] = frame_length >> 3;    // 8 bits
-    adts[5] = frame_length << 5;   // 3 bits
+    // aac_frame_length, patched per frame.
+    adts[4] = 0;
     // adts_buffer_fullness, all 1s
-    adts[5] |= 0x1F;
+    adts[5] = 0x1F;
     adts[6] = 0x3F << 2;
     // number_of_raw_data_blocks_in_frame
     adts[6] |= 0x0;
+    return 0;
+}
+
+// Write gathered output in one call.
+// @return 0 on success.
+static int flush_output(extract_output_t *output)
+{
+    if (output->chunk_count == 0) {
+        return 0;
+    }
+
+#ifdef _WIN32
+    for (uint32_t i = 0; i != output->chunk_count; ++i) {
+        if (output->chunk_sizes[i] && fwrite(output->chunks[i], output->chunk_sizes[i], 1, output->f) != 1) {
+            printf("failed to write to output file\n");
+            return -1;
+        }
+    }
+#else
+    struct iovec iov[OUTPUT_BATCH_CHUNKS];
+    int count = (int)output->chunk_count;
+    for (int i = 0; i != count; ++i) {
+        iov[i].iov_base = (void *)output->chunks[i];
+        iov[i].iov_len = output->chunk_sizes[i];
+    }
+
+    fflush(output->f);
+    int fd = fileno(output->f);
+    int first = 0;
+    while (first < count) {
+        ssize_t written = writev(fd, iov + first, count - first);
+        if (written < 0) {
+            printf("failed to write to output file\n");
+            return -1;
+        }
+        // Go on from where a short write stopped.
+        while (first < count && (size_t)written >= iov[first].iov_len) {
+            written -= iov[first].iov_len;
+            ++first;
+        }
+        if (first < count) {
+            iov[first].iov_base = (uint8_t *)iov[first].iov_base + written;
+            iov[first].iov_len -= written;
+        }
+    }
+#endif
+
+    output->chunk_count = 0;
+    output->adts_count = 0;
+    return 0;
+}
+
+// Gather "count" more pieces of output, flushing first if they do not fit.
+// @return 0 on success.
+static int reserve_chunks(extract_output_t *output, uint32_t count)
+{
+    if (output->chunk_count + count > OUTPUT_BATCH_CHUNKS) {
+        return flush_output(output);
+    }
+    return 0;
+}
+
+static void add_chunk(extract_output_t *output, const uint8_t *data, uint32_t size)
+{
+    output->chunks[output->chunk_count] = data;
+    output->chunk_sizes[output->chunk_count] = size;
+    ++output->chunk_count;
+}
+
+// Convert a sample from length prefixed NAL units to Annex B. 4-byte lengths
+// are overwritten with start codes in place, so the sample is gathered
+// whole. Shorter lengths cannot hold a start code, start codes and NAL units
+// are gathered one by one instead.
+// @return 0 on success.
+static int h26x_process_sample(extract_output_t *output, uint8_t *buffer, uint32_t sample_len)
+{
+    uint32_t length_size = output->track->length_size;
+    uint32_t pos_in_sample = 0;
+
+    if (length_size == 4) {
+        while (pos_in_sample + 4 <= sample_len) {
+            uint8_t *pos = buffer + pos_in_sample;
+            uint32_t remain_len = sample_len - pos_in_sample - 4;
+            uint32_t prefix_len = (pos[0] << 24) | (pos[1] << 16) | (pos[2] << 8) | pos[3];
+            if (prefix_len > remain_len) {
+                printf("invalid prefix_len: %u, remain_len: %u\n", prefix_len, remain_len);
+                break;
+            }
+            memcpy(pos, prefix_code, sizeof(prefix_code));
+            pos_in_sample += prefix_len + 4;
+        }
+
+        if (reserve_chunks(output, 1) != 0) {
+            return -1;
+        }
+        add_chunk(output, buffer, pos_in_sample);
+        return 0;
+    }
+
+    while (pos_in_sample + length_size <= sample_len) {
+        const uint8_t *pos = buffer + pos_in_sample;
+        uint32_t remain_len = sample_len - pos_in_sample - length_size;
+        uint32_t prefix_len = 0;
+        for (uint32_t i = 0; i != length_size; ++i) {
+            prefix_len = (prefix_len << 8) | pos[i];
+        }
+        if (prefix_len > remain_len) {
+            printf("invalid prefix_len: %u, remain_len: %u\n", prefix_len, remain_len);
+            break;
+        }
 
-    ret = fwrite(adts, 7, 1, f);
-    if (ret != 1) {
-        printf("failed to write adts header to output file\n");
+        if (reserve_chunks(output, 2) != 0) {
+            return -1;
+        }
+        add_chunk(output, prefix_code, sizeof(prefix_code));
+        add_chunk(output, pos + length_size, prefix_len);
+        pos_in_sample += prefix_len + length_size;
+    }
+    return 0;
+}
+
+// Gather one frame with its ADTS header.
+// @return 0 on success.
+static int aac_process_sample(extract_output_t *output, const uint8_t *buffer, uint32_t sample_len)
+{
+    uint32_t frame_length = 7 + sample_len;
+    if (frame_length > 0x1FFF) {
+        printf("aac frame too long for ADTS: %u\n", sample_len);
         return -1;
     }
 
-    ret = fwrite(buffer, sample_len, 1, f);
-    if (ret != 1) {
-        printf("failed to write sample data to output file\n");
+    if (reserve_chunks(output, 2) != 0) {
+        return -1;
+    }
+
+    uint8_t *adts = output->adts_headers[output->adts_count++];
+    memcpy(adts, output->adts_template, 7);
+    adts[3] |= frame_length >> 11;  // 2 bits
+    adts[4] = frame_length >> 3;    // 8 bits
+    adts[5] |= frame_length << 5;   // 3 bits
+
+    add_chunk(output, adts, 7);
+    add_chunk(output, buffer, sample_len);
+    return 0;
+}
+
+// Gather parameter sets of the video track, as Annex B NAL units.
+// @return 0 on success.
+static int gather_parameter_sets(extract_output_t *output)
+{
+    mov_track_t *track = output->track;
+    if (reserve_chunks(output, 6) != 0) {
         return -1;
     }
+
+    if (is_hevc_format(track->codec_format)) {
+        if (track->vps_len && track->sps_len && track->pps_len) {
+            add_chunk(output, prefix_code, sizeof(prefix_code));
+            add_chunk(output, track->vps, track->vps_len);
+            add_chunk(output, prefix_code, sizeof(prefix_code));
+            add_chunk(output, track->sps, track->sps_len);
+            add_chunk(output, prefix_code, sizeof(prefix_code));
+            add_chunk(output, track->pps, track->pps_len);
+        }
+    } else if (track->sps_len && track->pps_len) {
+        // SPS and PPS.
+        add_chunk(output, prefix_code, sizeof(prefix_code));
+        add_chunk(output, track->sps, track->sps_len);
+        add_chunk(output, prefix_code, sizeof(prefix_code));
+        add_chunk(output, track->pps, track->pps_len);
+    }
     return 0;
 }
 
-static void extract_raw_from_fmp4(mov_ctx_t *ctx, mov_track_t *cur_track, FILE *f)
+// Open the output of the track, and write parameter sets of video.
+// @return 0 on success.
+static int open_output(mov_ctx_t *ctx, extract_output_t *output, mov_track_t *cur_track,
+    const char *filename)
 {
     int ret;
 
-    int is_avc = strncmp(cur_track->codec_format, "avc1", 4) == 0;
-    int is_hevc = strncmp(cur_track->codec_format, "hvc1", 4) == 0;
+    memset(output, 0, sizeof(*output));
+
+    ret = mov_load_track_tables(ctx, cur_track);
+    if (ret != 0) {
+        printf("failed to load sample tables\n");
+        return ret;
+    }
+
+    int is_avc = is_avc_format(cur_track->codec_format);
+    int is_hevc = is_hevc_format(cur_track->codec_format);
     int is_aac = strncmp(cur_track->codec_format, "mp4a", 4) == 0;
 
-    printf("extract_raw_from_fmp4 start\n");
+    // Parameter sets of 'avc3' may be in the samples only.
+    if (is_avc && strncmp(cur_track->codec_format, "avc3", 4) != 0 &&
+        !(cur_track->sps_len && cur_track->pps_len)) {
+        printf("No sps or pps!\n");
+        return -1;
+    }
 
-    for (size_t i = 0; i != cur_track->trun_sample_count; ++i) {
-        uint64_t offset = cur_track->trun_sample_offsets[i];
-        uint32_t length = cur_track->trun_sample_sizes[i];
+    if (is_avc && (cur_track->length_size < 1 || cur_track->length_size > 4)) {
+        printf("invalid length_size: %u\n", cur_track->length_size);
+        return -1;
+    }
 
-        _fseeki64(ctx->f, offset, SEEK_SET);
-        ret = fread(buffer, length, 1, ctx->f);
-        if (ret != 1) {
-            printf("failed to read %u data at offset %llu\n", length, offset);
-            break;
-        }
+    // Check sample to chunk data. Samples of fragments are indexed already.
+    if (cur_track->stsc_count == 0 && cur_track->samples.count == 0) {
+        printf("No sample chunk data.\n");
+        return -1;
+    }
 
-        if (is_avc || is_hevc) {
-            ret = h26x_process_sample(buffer, length, f);
-        } else if (is_aac) {
-            ret = aac_process_sample(buffer, length, cur_track->audio_sample_rate,
-                cur_track->channel_count, f);
+    if (use_packed_index && cur_track->fragment_count == 0) {
+        ret = mov_build_packed_index(cur_track);
+        if (ret != 0) {
+            printf("failed to build sample index\n");
+            return ret;
         }
+    }
 
+    if (is_aac) {
+        ret = make_adts_template(cur_track, output->adts_template);
         if (ret != 0) {
-            printf("process sample failed\n");
-            break;
+            return ret;
         }
     }
 
-    printf("extract_raw_from_fmp4 end\n");
+    FILE *f = fopen(filename, "wb");
+    if (NULL == f) {
+        printf("failed to open file for writing: %s\n", filename);
+        return -1;
+    }
+
+    output->track = cur_track;
+    output->f = f;
+    output->is_h26x = is_avc || is_hevc;
+    output->is_aac = is_aac;
+
+    if (output->is_h26x && (gather_parameter_sets(output) != 0 || flush_output(output) != 0)) {
+        fclose(f);
+        return -1;
+    }
+    return 0;
 }
 
-static void extract_raw_data(mov_ctx_t *ctx, mov_track_t *cur_track, FILE *f)
+// Locate samples of "tracks" within --start and --duration. The first video
+// track starts at the sync sample at or before the start time, or after it
+// if there is none before, others start
+// at the time of that sample. Only tables are searched, so this must run
+// before they are released for a packed index.
+// @return 0 on success.
+static int find_ranges(mov_ctx_t *ctx, mov_track_t **tracks, int count,
+    uint32_t *first_samples, uint32_t *end_samples)
 {
     int ret;
-    int is_avc = strncmp(cur_track->codec_format, "avc1", 4) == 0;
-    int is_hevc = strncmp(cur_track->codec_format, "hvc1", 4) == 0;
-    int is_aac = strncmp(cur_track->codec_format, "mp4a", 4) == 0;
+    mov_seek_result_t result;
 
-    if (is_hevc) {
-        if (cur_track->vps_len && cur_track->sps_len && cur_track->pps_len) {
-            fwrite(prefix_code, sizeof(prefix_code), 1, f);
-            fwrite(cur_track->vps, cur_track->vps_len, 1, f);
-            fwrite(prefix_code, sizeof(prefix_code), 1, f);
-            fwrite(cur_track->sps, cur_track->sps_len, 1, f);
-            fwrite(prefix_code, sizeof(prefix_code), 1, f);
-            fwrite(cur_track->pps, cur_track->pps_len, 1, f);
+    int primary = 0;
+    for (int i = count - 1; i >= 0; --i) {
+        if (tracks[i]->is_video) {
+            primary = i;
         }
     }
 
-    if (is_avc) {
-        // SPS and PPS.
-        if (cur_track->sps_len && cur_track->pps_len) {
-            fwrite(prefix_code, sizeof(prefix_code), 1, f);
-            fwrite(cur_track->sps, cur_track->sps_len, 1, f);
-            fwrite(prefix_code, sizeof(prefix_code), 1, f);
-            fwrite(cur_track->pps, cur_track->pps_len, 1, f);
-        } else {
-            printf("No sps or pps!\n");
-            return;
+    // Start of the primary track, in seconds.
+    double start = range_start > 0 ? range_start : 0;
+    for (int k = 0; k != count; ++k) {
+        int i = (primary + k) % count;
+        mov_track_t *track = tracks[i];
+        double timescale = track->timescale;
+
+        first_samples[i] = 0;
+        if (start > 0) {
+            uint64_t time = (uint64_t)(start * timescale);
+            ret = mov_seek(ctx, track, time, k == 0 ? MOV_SEEK_SYNC_BEFORE : MOV_SEEK_ANY, &result);
+            if (ret != 0 && k == 0) {
+                // No sync sample before the start, begin at the first one after.
+                ret = mov_seek(ctx, track, time, MOV_SEEK_SYNC_AFTER, &result);
+            }
+            if (ret != 0) {
+                printf("failed to seek to %.3f in track %u\n", start, track->trackid);
+                return ret;
+            }
+            first_samples[i] = result.sample;
+            if (k == 0) {
+                start = (result.dts + result.cts_offset) / timescale;
+            }
         }
-    }
 
-    // Assume length size prefix is 4 bytes.
-    if (is_avc && cur_track->length_size != 4) {
-        printf("Need length_size equals 4\n");
-        return;
+        // Up to the last sample decoded before the end.
+        end_samples[i] = UINT32_MAX;
+        if (range_duration >= 0) {
+            double end = (range_start > 0 ? range_start : 0) + range_duration;
+            uint64_t end_time = (uint64_t)(end * timescale);
+            ret = mov_seek(ctx, track, end_time ? end_time - 1 : 0, MOV_SEEK_ANY, &result);
+            if (ret != 0) {
+                printf("failed to seek to %.3f in track %u\n", end, track->trackid);
+                return ret;
+            }
+            end_samples[i] = result.sample + 1;
+        }
+        if (end_samples[i] < first_samples[i]) {
+            end_samples[i] = first_samples[i];
+        }
+        printf("track %u, samples %u to %u\n", track->trackid, first_samples[i] + 1, end_samples[i]);
     }
+    return 0;
+}
 
-    // Check sample to chunk data.
-    if (cur_track->stsc_count == 0) {
-        printf("No sample chunk data.\n");
-        if (cur_track->trun_sample_count > 0) {
-            extract_raw_from_fmp4(ctx, cur_track, f);
+// Process samples of the output in "slot".
+// @return 0 on success.
+static int process_run(extract_output_t *output, read_slot_t *slot)
+{
+    int ret = 0;
+
+    for (uint32_t i = 0; i != slot->run_count && ret == 0; ++i) {
+        mov_demux_sample_t *s = slot->run + i;
+        if (s->track != output->track) {
+            continue;
         }
-        return;
+
+        uint8_t *sample_data = slot->buffer + (s->sample.offset - slot->offset);
+        uint32_t sample_len = s->sample.size;
+        if (output->is_h26x) {
+            ret = h26x_process_sample(output, sample_data, sample_len);
+        } else if (output->is_aac) {
+            ret = aac_process_sample(output, sample_data, sample_len);
+        }
+        if (ret != 0) {
+            printf("process sample failed, track: %u\n", output->track->trackid);
+            break;
+        }
+        ++output->sample_count;
     }
 
-    uint32_t cur_chunk = 0;
-    uint32_t cur_sample_index = 0;
-    int exit = 0;
-    int nalu_count = 0;
-    for (int i = 0; !exit; ++i, ++cur_chunk) {
-        // Check current chunk is present.
-        if (cur_chunk >= cur_track->chunk_offset_count) {
-            printf("last chunk was processed\n");
+    // The slot is reused once every output is done with it.
+    if (flush_output(output) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+static void output_thread(void *arg)
+{
+    extract_output_t *output = arg;
+    extract_pipeline_t *pipeline = output->pipeline;
+
+    mov_mutex_lock(&pipeline->mutex);
+    for (;;) {
+        while (output->queue_count == 0 && !pipeline->done) {
+            mov_cond_wait(&pipeline->cond, &pipeline->mutex);
+        }
+        if (output->queue_count == 0) {
             break;
         }
+        read_slot_t *slot = pipeline->slots + output->queue[output->queue_head];
+        mov_mutex_unlock(&pipeline->mutex);
 
-        // Seek to current chunk.
-        uint64_t chunk_start_offset = cur_track->chunk_offsets[cur_chunk];
-        ret = fseek(ctx->f, chunk_start_offset, SEEK_SET);
-        if (ret == -1) {
-            printf("failed to seek to: %llu\n", chunk_start_offset);
+        int ret = output->failed ? -1 : process_run(output, slot);
+
+        mov_mutex_lock(&pipeline->mutex);
+        if (ret != 0) {
+            output->failed = 1;
         }
+        output->queue_head = (output->queue_head + 1) % READ_SLOTS;
+        --output->queue_count;
+        --slot->pending;
+        mov_cond_broadcast(&pipeline->cond);
+    }
+    mov_mutex_unlock(&pipeline->mutex);
+}
 
-        // Get sample per chunk.
-        uint32_t cur_sample_per_chunk = 1;
-        for (int stsc_idx = 0; stsc_idx != cur_track->stsc_count; ++stsc_idx) {
-            if (cur_track->stsc_first_chunk[stsc_idx] <= cur_chunk + 1) {
-                cur_sample_per_chunk = cur_track->stsc_sample_per_chunk[stsc_idx];
-            } else {
-                break;
+// Fill "slot" with the next run of samples, starting at "next".
+// @return 0 on success.
+static int read_run(mov_ctx_t *ctx, mov_demux_t *demux, read_slot_t *slot,
+    mov_demux_sample_t *next, int *has_next, uint64_t *file_pos)
+{
+    int ret;
+    uint64_t run_offset = next->sample.offset;
+    uint64_t run_size = 0;
+
+    slot->run_count = 0;
+    do {
+        if (slot->run_count == slot->run_capacity) {
+            uint32_t capacity = slot->run_capacity ? slot->run_capacity * 2 : 256;
+            mov_demux_sample_t *samples = realloc(slot->run, capacity * sizeof(mov_demux_sample_t));
+            if (NULL == samples) {
+                printf("failed to allocate run\n");
+                return -1;
             }
+            slot->run = samples;
+            slot->run_capacity = capacity;
+        }
+        slot->run[slot->run_count++] = *next;
+        run_size += next->sample.size;
+        *has_next = mov_demux_next(demux, next) == 0;
+    } while (*has_next && next->sample.offset == run_offset + run_size &&
+        run_size + next->sample.size <= MAX_READ_RUN);
 
-            if (stsc_idx == cur_track->stsc_count - 1) {
-                break;
+    if (run_size > slot->buffer_size) {
+        uint8_t *new_buffer = realloc(slot->buffer, run_size);
+        if (NULL == new_buffer) {
+            printf("failed to allocate read buffer of %llu bytes\n", run_size);
+            return -1;
+        }
+        slot->buffer = new_buffer;
+        slot->buffer_size = run_size;
+    }
+
+    if (run_offset != *file_pos) {
+        ret = _fseeki64(ctx->f, run_offset, SEEK_SET);
+        if (ret != 0) {
+            printf("failed to seek to: %llu\n", run_offset);
+            return -1;
+        }
+    }
+    if (run_size && fread(slot->buffer, run_size, 1, ctx->f) != 1) {
+        printf("failed to read %llu bytes from file.\n", run_size);
+        return -1;
+    }
+    slot->offset = run_offset;
+    *file_pos = run_offset + run_size;
+    return 0;
+}
+
+static void extract_raw_streams(mov_ctx_t *ctx)
+{
+    int ret;
+
+    extract_output_t *outputs = calloc(extract_count + 1, sizeof(extract_output_t));
+    mov_track_t *tracks[MAX_OUTPUTS];
+    int output_count = 0;
+    if (NULL == outputs) {
+        printf("failed to allocate outputs\n");
+        return;
+    }
+
+    uint32_t first_samples[MAX_OUTPUTS];
+    uint32_t end_samples[MAX_OUTPUTS];
+    if ((range_start >= 0 || range_duration >= 0) &&
+        find_ranges(ctx, extract_tracks, extract_count, first_samples, end_samples) != 0) {
+        free(outputs);
+        return;
+    }
+
+    for (int i = 0; i != extract_count; ++i) {
+        printf("\nStart extract track %u to file: %s\n", extract_tracks[i]->trackid, extract_filenames[i]);
+        if (open_output(ctx, outputs + output_count, extract_tracks[i], extract_filenames[i]) == 0) {
+            outputs[output_count].first_sample = 0;
+            outputs[output_count].end_sample = UINT32_MAX;
+            if (range_start >= 0 || range_duration >= 0) {
+                outputs[output_count].first_sample = first_samples[i];
+                outputs[output_count].end_sample = end_samples[i];
             }
+            tracks[output_count++] = extract_tracks[i];
         }
-        //printf("current chunk: %u, sample_per_chunk: %u\n", cur_chunk, cur_sample_per_chunk);
+    }
+
+    if (output_count == 0) {
+        free(outputs);
+        return;
+    }
 
-        if (cur_sample_index >= cur_track->sample_lengths_count) {
-            printf("cur_sample_index is not less than cur_track->sample_lengths_count!\n");
-            exit = 1;
+    mov_demux_t demux;
+    ret = mov_demux_init(&demux, ctx, tracks, output_count);
+    if (ret != 0) {
+        printf("failed to build sample index\n");
+    }
+    for (int i = 0; ret == 0 && i != output_count; ++i) {
+        mov_demux_set_range(&demux, i, outputs[i].first_sample, outputs[i].end_sample);
+    }
+
+    extract_pipeline_t pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    mov_mutex_init(&pipeline.mutex);
+    mov_cond_init(&pipeline.cond);
+
+    int thread_count = 0;
+    for (; ret == 0 && thread_count != output_count; ++thread_count) {
+        outputs[thread_count].pipeline = &pipeline;
+        ret = mov_thread_create(&outputs[thread_count].thread, output_thread, outputs + thread_count);
+        if (ret != 0) {
             break;
         }
+    }
 
-        // Parse all samples in current chunk, one by one.
-        for (int idx_in_chunk = 0; idx_in_chunk < cur_sample_per_chunk; ++idx_in_chunk) {
-            // Sample length.
-            uint32_t sample_len = cur_track->sample_lengths[cur_sample_index];
-            ret = fread(buffer, sample_len, 1, ctx->f);
-            if (ret != 1) {
-                printf("failed to read %u bytes from file.\n", sample_len);
-                exit = 1;
-                break;
-            }
+    // Samples come in file order. Physically contiguous samples, across
+    // chunks and tracks, are read at once into a slot, and processed in place
+    // by the outputs with samples in it. Seek only when a run does not start
+    // right after the previous one.
+    uint64_t file_pos = UINT64_MAX;
+    mov_demux_sample_t next;
+    int has_next = ret == 0 && mov_demux_next(&demux, &next) == 0;
+    for (int k = 0; has_next; k = (k + 1) % READ_SLOTS) {
+        read_slot_t *slot = pipeline.slots + k;
 
-            if (is_avc || is_hevc) {
-                ret = h26x_process_sample(buffer, sample_len, f);
-            } else if (is_aac) {
-                ret = aac_process_sample(buffer, sample_len, cur_track->audio_sample_rate, 
-                    cur_track->channel_count, f);
-            }
-            
-            if (ret != 0) {
-                printf("process sample failed\n");
-                exit = 1;
-                break;
+        int failed = 0;
+        mov_mutex_lock(&pipeline.mutex);
+        while (slot->pending) {
+            mov_cond_wait(&pipeline.cond, &pipeline.mutex);
+        }
+        for (int i = 0; i != output_count; ++i) {
+            failed |= outputs[i].failed;
+        }
+        mov_mutex_unlock(&pipeline.mutex);
+        if (failed || read_run(ctx, &demux, slot, &next, &has_next, &file_pos) != 0) {
+            break;
+        }
+
+        for (uint32_t i = 0; i != slot->run_count; ++i) {
+            extract_output_t *output = outputs;
+            while (output->track != slot->run[i].track) {
+                ++output;
             }
+            output->queued = 1;
+        }
 
-            ++cur_sample_index;
+        mov_mutex_lock(&pipeline.mutex);
+        for (int i = 0; i != output_count; ++i) {
+            extract_output_t *output = outputs + i;
+            if (output->queued) {
+                output->queue[(output->queue_head + output->queue_count) % READ_SLOTS] = k;
+                ++output->queue_count;
+                ++slot->pending;
+                output->queued = 0;
+            }
         }
+        mov_cond_broadcast(&pipeline.cond);
+        mov_mutex_unlock(&pipeline.mutex);
+    }
+
+    mov_mutex_lock(&pipeline.mutex);
+    pipeline.done = 1;
+    mov_cond_broadcast(&pipeline.cond);
+    mov_mutex_unlock(&pipeline.mutex);
+    for (int i = 0; i != thread_count; ++i) {
+        mov_thread_join(&outputs[i].thread);
+    }
 
-        // Only write the first several nalu.
-        //if (nalu_count > 2000) {
-        //    printf("current nalu count: %d, stop.\n", nalu_count);
-        //    break;
-        //}
+    for (int i = 0; i != READ_SLOTS; ++i) {
+        free(pipeline.slots[i].buffer);
+        free(pipeline.slots[i].run);
     }
+    mov_cond_destroy(&pipeline.cond);
+    mov_mutex_destroy(&pipeline.mutex);
 
-    printf("nalu count totally processed: %d\n", nalu_count);
+    for (int i = 0; i != output_count; ++i) {
+        printf("sample count totally processed: %u, track: %u\n", outputs[i].sample_count,
+            outputs[i].track->trackid);
+        fclose(outputs[i].f);
+    }
+    mov_demux_free(&demux);
+    free(outputs);
+    printf("End extract\n");
 }
 
-static void extract_raw_h26x_video(mov_ctx_t *ctx, const char *filename)
+// Find the first sync sample at or after "*sample" (0-based). Tables are
+// used as they are: the flattened index or the packed index if built,
+// otherwise 'stss', with trun flags already in the index for fragments.
+// @return 0 on success, -1 when no more sync sample.
+static int next_sync_sample(const mov_track_t *track, uint32_t *sample)
 {
-    printf("\nStart extract raw h26x video to file: %s\n", filename);
+    uint32_t n = *sample;
 
-    mov_track_t *cur_track = get_video_track(ctx);
-    if (NULL == cur_track) {
-        printf("No video track found!\n");
-        return;
+    if (track->samples.count) {
+        while (n < track->samples.count && !track->samples.sync_flags[n]) {
+            ++n;
+        }
+        *sample = n;
+        return n < track->samples.count ? 0 : -1;
     }
-    assert(strncmp(cur_track->codec_format, "avc1", 4) == 0 ||
-        strncmp(cur_track->codec_format, "hvc1", 4) == 0);
 
-    FILE *f = fopen(filename, "wb");
-    if (NULL == f) {
-        printf("failed to open file for writing: %s\n", filename);
-        return;
+    if (track->packed.count) {
+        const mov_packed_index_t *packed = &track->packed;
+        while (n < packed->count && !packed->all_sync && !((packed->sync_bits[n >> 3] >> (n & 7)) & 1)) {
+            ++n;
+        }
+        *sample = n;
+        return n < packed->count ? 0 : -1;
     }
 
-    extract_raw_data(ctx, cur_track, f);
+    // Every sample is a sync sample without 'stss'.
+    if (track->sample_number_count == 0) {
+        return n < track->sample_lengths_count ? 0 : -1;
+    }
 
-    fclose(f);
-    printf("End extract\n");
+    // First sample number in 'stss' greater than n, numbers are 1-based.
+    uint32_t lo = 0;
+    uint32_t hi = track->sample_number_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (track->sample_numbers[mid] <= n) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == track->sample_number_count || track->sample_numbers[lo] > track->sample_lengths_count) {
+        return -1;
+    }
+    *sample = track->sample_numbers[lo] - 1;
+    return 0;
 }
 
-static void extract_raw_aac_audio(mov_ctx_t *ctx, const char *filename)
+// Extract every n-th sync sample of the video tracks, each preceded by the
+// parameter sets so any of them decodes alone. Samples are located from the
+// tables and read with one positioned read each, the rest of the file is
+// never read.
+static void extract_keyframes(mov_ctx_t *ctx)
 {
-    mov_track_t *cur_track = get_audio_track(ctx);
-    if (NULL == cur_track) {
-        printf("No video track found!\n");
+    int ret;
+
+    uint32_t first_samples[MAX_OUTPUTS];
+    uint32_t end_samples[MAX_OUTPUTS];
+    if ((range_start >= 0 || range_duration >= 0) &&
+        find_ranges(ctx, extract_tracks, extract_count, first_samples, end_samples) != 0) {
         return;
     }
-    assert(strncmp(cur_track->codec_format, "mp4a", 4) == 0);
 
-    FILE *f = fopen(filename, "wb");
-    if (NULL == f) {
-        printf("failed to open file for writing: %s\n", filename);
+    uint8_t *buffer = NULL;
+    uint32_t buffer_size = 0;
+    extract_output_t *output = malloc(sizeof(extract_output_t));
+    if (NULL == output) {
+        printf("failed to allocate output\n");
         return;
     }
 
-    extract_raw_data(ctx, cur_track, f);
+    for (int i = 0; i != extract_count; ++i) {
+        mov_track_t *track = extract_tracks[i];
+        if (!track->is_video) {
+            printf("\nSkip track %u, keyframes are only extracted from video\n", track->trackid);
+            continue;
+        }
+
+        printf("\nStart extract keyframes of track %u to file: %s\n", track->trackid, extract_filenames[i]);
+        if (open_output(ctx, output, track, extract_filenames[i]) != 0) {
+            continue;
+        }
+
+        uint32_t sample = 0;
+        uint32_t end = UINT32_MAX;
+        if (range_start >= 0 || range_duration >= 0) {
+            sample = first_samples[i];
+            end = end_samples[i];
+        }
+
+        uint32_t sync_count = 0;
+        uint64_t bytes_read = 0;
+        mov_packed_cursor_t cursor;
+        for (ret = 0; ret == 0 && next_sync_sample(track, &sample) == 0 && sample < end; ++sample) {
+            if (sync_count++ % keyframe_interval != 0) {
+                continue;
+            }
+
+            uint64_t offset;
+            uint32_t size;
+            if (track->packed.count) {
+                mov_sample_t packed_sample;
+                mov_packed_cursor_seek(&cursor, &track->packed, sample);
+                mov_packed_cursor_next(&cursor, &packed_sample);
+                offset = packed_sample.offset;
+                size = packed_sample.size;
+            } else {
+                mov_seek_result_t result;
+                ret = mov_locate_sample(ctx, track, sample, &result);
+                if (ret != 0) {
+                    printf("failed to locate sample %u\n", sample + 1);
+                    break;
+                }
+                offset = result.chunk_offset + result.offset_in_chunk;
+                size = result.size;
+            }
+
+            if (size > buffer_size) {
+                uint8_t *new_buffer = realloc(buffer, size);
+                if (NULL == new_buffer) {
+                    printf("failed to allocate read buffer of %u bytes\n", size);
+                    ret = -1;
+                    break;
+                }
+                buffer = new_buffer;
+                buffer_size = size;
+            }
 
-    fclose(f);
-}
\ No newline at end of file
+            ret = _fseeki64(ctx->f, offset, SEEK_SET);
+            if (ret != 0 || (size && fread(buffer, size, 1, ctx->f) != 1)) {
+                printf("failed to read sample %u of %u bytes at %llu\n", sample + 1, size, offset);
+                ret = -1;
+                break;
+            }
+            bytes_read += size;
+
+            // Parameter sets of the first keyframe were written on opening.
+            if (output->sample_count && gather_parameter_sets(output) != 0) {
+                ret = -1;
+                break;
+            }
+            ret = h26x_process_sample(output, buffer, size);
+            if (ret == 0) {
+                ret = flush_output(output);
+            }
+            if (ret == 0) {
+                ++output->sample_count;
+            }
+        }
+
+        printf("keyframes extracted: %u of %u, bytes read: %llu, track: %u\n", output->sample_count,
+            sync_count, bytes_read, track->trackid);
+        fclose(output->f);
+    }
+
+    free(buffer);
+    free(output);
+    printf("End extract\n");
+}
@@ -0,0 +1,416 @@
+// Move 'moov' in front of media data, so playback can start before the
+// whole file is downloaded. Chunk offsets are patched by the relocation.
+
+#include "mov_defs.h"
+#include "mov_read_functions.h"
+#include "mov_copy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A top-level box of the input file.
+typedef struct tag_faststart_box {
+    int32_t node;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t new_offset;
+} faststart_box_t;
+
+typedef struct tag_faststart {
+    mov_ctx_t *ctx;
+
+    faststart_box_t *boxes;     // In input order.
+    int box_count;
+    int moov;                   // Index of 'moov' in "boxes".
+    int insert_before;          // 'moov' goes before this box.
+
+    uint8_t *moov_data;         // Input 'moov'.
+    uint64_t moov_size;
+
+    // Per box node of the 'moov' subtree, indexed from the 'moov' node.
+    uint32_t node_count;
+    uint64_t *growth;           // Size added by stco promoted to co64.
+    uint8_t *has_table;         // Node is, or contains, a chunk offset table.
+    uint8_t *promoted;
+} faststart_t;
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+    return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+    put_u32(p, (uint32_t)(v >> 32));
+    put_u32(p + 4, (uint32_t)v);
+}
+
+static int compare_box_offset(const void *a, const void *b)
+{
+    const faststart_box_t *x = a;
+    const faststart_box_t *y = b;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static const mov_box_node_t *get_node(faststart_t *fs, uint32_t i)
+{
+    return fs->ctx->box_nodes + fs->boxes[fs->moov].node + i;
+}
+
+static uint64_t node_box_size(const mov_box_node_t *node)
+{
+    return node->content_pos + node->size - node->offset;
+}
+
+static uint8_t *node_data(faststart_t *fs, const mov_box_node_t *node)
+{
+    return fs->moov_data + (node->offset - fs->boxes[fs->moov].offset);
+}
+
+static int is_chunk_table(const mov_box_node_t *node)
+{
+    return node->type == MOV_BOX_TYPE('s','t','c','o') || node->type == MOV_BOX_TYPE('c','o','6','4');
+}
+
+// Place boxes of the output file, with 'moov' grown to "moov_size".
+static void compute_layout(faststart_t *fs, uint64_t moov_size)
+{
+    uint64_t pos = 0;
+    for (int i = 0; i != fs->box_count; ++i) {
+        if (i == fs->insert_before) {
+            fs->boxes[fs->moov].new_offset = pos;
+            pos += moov_size;
+        }
+        if (i != fs->moov) {
+            fs->boxes[i].new_offset = pos;
+            pos += fs->boxes[i].size;
+        }
+    }
+}
+
+// New position of input file offset "offset".
+static uint64_t relocate(faststart_t *fs, uint64_t offset)
+{
+    // Last box starting at or before "offset".
+    int lo = 0;
+    int hi = fs->box_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (fs->boxes[mid].offset <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return offset;
+    }
+    faststart_box_t *box = fs->boxes + lo - 1;
+    return offset - box->offset + box->new_offset;
+}
+
+// Mark 'stco' tables whose relocated offsets no longer fit 32 bits.
+// @return count of tables newly promoted.
+static int promote_tables(faststart_t *fs)
+{
+    int promoted = 0;
+    for (uint32_t i = 0; i != fs->node_count; ++i) {
+        const mov_box_node_t *node = get_node(fs, i);
+        if (node->type != MOV_BOX_TYPE('s','t','c','o') || fs->promoted[i]) {
+            continue;
+        }
+
+        const uint8_t *content = fs->moov_data + (node->content_pos - fs->boxes[fs->moov].offset);
+        uint32_t entry_count = get_u32(content + 4);
+        for (uint32_t j = 0; j != entry_count; ++j) {
+            if (relocate(fs, get_u32(content + 8 + 4 * j)) > UINT32_MAX) {
+                fs->promoted[i] = 1;
+                ++promoted;
+
+                // Every container up to 'moov' grows.
+                uint64_t growth = 4 * (uint64_t)entry_count;
+                int32_t k = (int32_t)i;
+                while (k >= 0) {
+                    fs->growth[k] += growth;
+                    k = get_node(fs, k)->parent - fs->boxes[fs->moov].node;
+                }
+                break;
+            }
+        }
+    }
+    return promoted;
+}
+
+// Write node "i" of the 'moov' subtree to "out", patching chunk offsets.
+// @return end of written data.
+static uint8_t *write_node(faststart_t *fs, uint32_t i, uint8_t *out)
+{
+    const mov_box_node_t *node = get_node(fs, i);
+    const uint8_t *data = node_data(fs, node);
+    uint64_t size = node_box_size(node);
+    uint32_t header_size = (uint32_t)(node->content_pos - node->offset);
+
+    if (fs->promoted[i]) {
+        uint32_t entry_count = get_u32(data + header_size + 4);
+        uint64_t new_size = size + fs->growth[i];
+        put_u32(out, (uint32_t)new_size);
+        memcpy(out + 4, "co64", 4);
+        memcpy(out + 8, data + header_size, 8);     // version, flags and entry_count
+        for (uint32_t j = 0; j != entry_count; ++j) {
+            uint64_t offset = get_u32(data + header_size + 8 + 4 * j);
+            put_u64(out + 16 + 8 * j, relocate(fs, offset));
+        }
+        return out + 16 + 8 * (uint64_t)entry_count;
+    }
+
+    if (is_chunk_table(node)) {
+        int large = node->type == MOV_BOX_TYPE('c','o','6','4');
+        memcpy(out, data, size);
+        uint8_t *content = out + header_size;
+        uint32_t entry_count = get_u32(content + 4);
+        for (uint32_t j = 0; j != entry_count; ++j) {
+            if (large) {
+                put_u64(content + 8 + 8 * j, relocate(fs, get_u64(content + 8 + 8 * j)));
+            } else {
+                put_u32(content + 8 + 4 * j, (uint32_t)relocate(fs, get_u32(content + 8 + 4 * j)));
+            }
+        }
+        return out + size;
+    }
+
+    if (!fs->has_table[i]) {
+        memcpy(out, data, size);
+        return out + size;
+    }
+
+    // Container of chunk offset tables. Its size may change.
+    uint64_t new_size = size + fs->growth[i];
+    memcpy(out, data, header_size);
+    if (header_size == 16) {
+        put_u64(out + 8, new_size);
+    } else {
+        put_u32(out, (uint32_t)new_size);
+    }
+
+    uint8_t *p = out + header_size;
+    uint64_t pos = node->content_pos;
+    uint64_t end = node->content_pos + node->size;
+    for (uint32_t j = i + 1; j != fs->node_count; ++j) {
+        const mov_box_node_t *child = get_node(fs, j);
+        if (child->parent != fs->boxes[fs->moov].node + (int32_t)i) {
+            continue;
+        }
+        // Bytes between children are kept.
+        memcpy(p, fs->moov_data + (pos - fs->boxes[fs->moov].offset), child->offset - pos);
+        p += child->offset - pos;
+        p = write_node(fs, j, p);
+        pos = child->offset + node_box_size(child);
+    }
+    memcpy(p, fs->moov_data + (pos - fs->boxes[fs->moov].offset), end - pos);
+    return p + (end - pos);
+}
+
+static int write_faststart(faststart_t *fs, const char *filename)
+{
+    int ret = 0;
+    mov_ctx_t *ctx = fs->ctx;
+    const mov_box_node_t *moov = ctx->box_nodes + fs->boxes[fs->moov].node;
+
+    // Input 'moov'.
+    fs->moov_size = fs->boxes[fs->moov].size;
+    fs->moov_data = malloc(fs->moov_size);
+    if (NULL == fs->moov_data) {
+        printf("failed to allocate moov of %llu bytes\n", fs->moov_size);
+        return -1;
+    }
+    _fseeki64(ctx->f, moov->offset, SEEK_SET);
+    if (fread(fs->moov_data, fs->moov_size, 1, ctx->f) != 1) {
+        printf("failed to read moov\n");
+        return -1;
+    }
+
+    // Nodes of the 'moov' subtree directly follow it in the index.
+    uint64_t moov_end = moov->content_pos + moov->size;
+    int32_t moov_node = fs->boxes[fs->moov].node;
+    fs->node_count = 1;
+    while (moov_node + fs->node_count < ctx->box_node_count &&
+        (uint64_t)ctx->box_nodes[moov_node + fs->node_count].offset < moov_end &&
+        ctx->box_nodes[moov_node + fs->node_count].parent >= moov_node) {
+        ++fs->node_count;
+    }
+    fs->growth = calloc(fs->node_count, sizeof(uint64_t));
+    fs->has_table = calloc(fs->node_count, 1);
+    fs->promoted = calloc(fs->node_count, 1);
+    if (!fs->growth || !fs->has_table || !fs->promoted) {
+        printf("failed to allocate moov layout\n");
+        return -1;
+    }
+
+    // Tables are patched in place, and not parsed in lazy mode: check that
+    // their entries fit the box before touching them.
+    uint32_t table_count = 0;
+    for (uint32_t i = 0; i != fs->node_count; ++i) {
+        const mov_box_node_t *node = get_node(fs, i);
+        if (!is_chunk_table(node)) {
+            continue;
+        }
+        uint64_t entry_size = node->type == MOV_BOX_TYPE('c','o','6','4') ? 8 : 4;
+        uint64_t entry_count = 0;
+        if (node->size >= 8 && (uint64_t)node->content_pos + node->size <= moov_end) {
+            entry_count = get_u32(fs->moov_data + (node->content_pos - moov->offset) + 4);
+        }
+        if (node->size < 8 || (uint64_t)node->content_pos + node->size > moov_end ||
+            8 + entry_size * entry_count > (uint64_t)node->size) {
+            printf("invalid chunk offset table at: %llu\n", node->offset);
+            return -1;
+        }
+        ++table_count;
+        int32_t k = (int32_t)i;
+        while (k >= 0) {
+            fs->has_table[k] = 1;
+            k = get_node(fs, k)->parent - moov_node;
+        }
+    }
+
+    // Promotion grows 'moov', which moves media data further. Repeat until
+    // no more table needs 64-bit offsets.
+    do {
+        compute_layout(fs, fs->moov_size + fs->growth[0]);
+    } while (promote_tables(fs));
+
+    uint64_t new_moov_size = fs->moov_size + fs->growth[0];
+    printf("moov size: %llu -> %llu, chunk offset tables: %u\n",
+        fs->moov_size, new_moov_size, table_count);
+
+    uint8_t *new_moov = malloc(new_moov_size);
+    if (NULL == new_moov) {
+        printf("failed to allocate moov of %llu bytes\n", new_moov_size);
+        return -1;
+    }
+    uint8_t *end = write_node(fs, 0, new_moov);
+    if ((uint64_t)(end - new_moov) != new_moov_size) {
+        printf("moov size mismatch: %llu\n", (uint64_t)(end - new_moov));
+        free(new_moov);
+        return -1;
+    }
+
+    FILE *out = fopen(filename, "wb");
+    if (NULL == out) {
+        printf("failed to open file for writing: %s\n", filename);
+        free(new_moov);
+        return -1;
+    }
+
+    // Boxes are written in output order.
+    for (int i = 0; i <= fs->box_count && ret == 0; ++i) {
+        if (i == fs->insert_before) {
+            if (fwrite(new_moov, new_moov_size, 1, out) != 1) {
+                printf("failed to write moov\n");
+                ret = -1;
+            }
+        }
+        if (i != fs->box_count && i != fs->moov && ret == 0) {
+            ret = mov_copy_range(ctx->f, fs->boxes[i].offset, fs->boxes[i].size, out);
+        }
+    }
+
+    fclose(out);
+    free(new_moov);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+
+    if (argc < 3) {
+        fprintf(stdout, "Usage: %s <input> <output>\n", argv[0]);
+        fprintf(stdout, "  Move 'moov' in front of media data.\n");
+        return 1;
+    }
+
+    mov_ctx_t *ctx = malloc(sizeof(*ctx));
+    memset(ctx, 0, sizeof(*ctx));
+    // Sample tables are only located, chunk offsets are patched as raw bytes.
+    ctx->lazy = 1;
+
+    ret = parse_mov_file(argv[1], ctx);
+    if (ret != 0) {
+        printf("failed to parse_mov_file\n");
+        mov_ctx_free(ctx);
+        free(ctx);
+        return 1;
+    }
+
+    faststart_t fs;
+    memset(&fs, 0, sizeof(fs));
+    fs.ctx = ctx;
+    fs.moov = -1;
+    fs.insert_before = -1;
+
+    fs.boxes = malloc((ctx->box_node_count + 1) * sizeof(faststart_box_t));
+    for (uint32_t i = 0; i != ctx->box_node_count; ++i) {
+        const mov_box_node_t *node = ctx->box_nodes + i;
+        if (node->parent != -1) {
+            continue;
+        }
+        if (node->type == MOV_BOX_TYPE('m','o','o','f')) {
+            printf("fragmented file is not supported\n");
+            ret = -1;
+            break;
+        }
+        faststart_box_t *box = fs.boxes + fs.box_count++;
+        box->node = (int32_t)i;
+        box->offset = node->offset;
+        box->size = node_box_size(node);
+        box->new_offset = box->offset;
+    }
+    qsort(fs.boxes, fs.box_count, sizeof(faststart_box_t), compare_box_offset);
+
+    for (int i = 0; i != fs.box_count; ++i) {
+        uint32_t type = ctx->box_nodes[fs.boxes[i].node].type;
+        if (type == MOV_BOX_TYPE('m','o','o','v') && fs.moov < 0) {
+            fs.moov = i;
+        } else if (type == MOV_BOX_TYPE('m','d','a','t') && fs.insert_before < 0) {
+            fs.insert_before = i;
+        }
+    }
+
+    if (ret == 0 && fs.moov < 0) {
+        printf("no moov found\n");
+        ret = -1;
+    }
+    if (ret == 0 && (fs.insert_before < 0 || fs.moov < fs.insert_before)) {
+        // Already in place, output is a plain copy.
+        printf("moov is already before media data\n");
+        fs.insert_before = fs.moov;
+    }
+    if (ret == 0) {
+        ret = write_faststart(&fs, argv[2]);
+    }
+
+    free(fs.boxes);
+    free(fs.moov_data);
+    free(fs.growth);
+    free(fs.has_table);
+    free(fs.promoted);
+    mov_ctx_free(ctx);
+    free(ctx);
+
+    printf("end\n");
+    return ret == 0 ? 0 : 1;
+}
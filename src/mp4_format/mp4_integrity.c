@@ -0,0 +1,423 @@
+// Verify a file after transfer: sample tables must agree, every sample must
+// lie in an 'mdat' without overlapping another, and a CRC-32C of the sample
+// payloads of each track is printed to compare with the source. Payloads
+// are checksummed on a pool of threads, each reading its own byte ranges.
+
+#include "mov_defs.h"
+#include "mov_read_functions.h"
+#include "mov_sample_index.h"
+#include "mov_crc32c.h"
+#include "mov_thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Samples of a track are checksummed in units of about this size.
+#define UNIT_SIZE (8 * 1024 * 1024)
+
+// Errors of one kind are reported up to this count, then only counted.
+#define MAX_REPORTED 10
+
+// Consecutive samples of one track, checksummed by one thread.
+typedef struct tag_check_unit {
+    mov_track_t *track;
+    uint32_t first_sample;
+    uint32_t end_sample;
+    uint64_t bytes;
+    uint32_t crc;
+    int failed;
+} check_unit_t;
+
+typedef struct tag_check_pool {
+    const char *filename;
+    check_unit_t *units;
+    uint32_t unit_count;
+    uint32_t next_unit;         // Next unit to take, with "mutex" held.
+    mov_mutex_t mutex;
+} check_pool_t;
+
+typedef struct tag_sample_range {
+    uint64_t offset;
+    uint64_t end;
+    uint32_t trackid;
+    uint32_t sample;            // 1-based.
+} sample_range_t;
+
+static int compare_range_offset(const void *a, const void *b)
+{
+    const sample_range_t *x = a;
+    const sample_range_t *y = b;
+    if (x->offset != y->offset) {
+        return x->offset < y->offset ? -1 : 1;
+    }
+    return x->end < y->end ? -1 : x->end > y->end;
+}
+
+// Check that stsz, stts, stsc and ctts describe the same number of samples,
+// and that stss only names existing samples.
+// @return number of errors found.
+static int check_tables(mov_track_t *track)
+{
+    int errors = 0;
+    uint32_t count = track->sample_lengths_count;
+
+    uint64_t stts_count = 0;
+    for (uint32_t i = 0; i != track->stts_entry_count; ++i) {
+        stts_count += track->stts_sample_counts[i];
+    }
+    if (stts_count != count) {
+        printf("track %u: stts has %llu samples, stsz has %u\n", track->trackid, stts_count, count);
+        ++errors;
+    }
+
+    if (track->ctts_entry_count) {
+        uint64_t ctts_count = 0;
+        for (uint32_t i = 0; i != track->ctts_entry_count; ++i) {
+            ctts_count += track->ctts_sample_counts[i];
+        }
+        if (ctts_count != count) {
+            printf("track %u: ctts has %llu samples, stsz has %u\n", track->trackid, ctts_count, count);
+            ++errors;
+        }
+    }
+
+    // The last stsc entry runs up to the last chunk.
+    uint64_t stsc_count = 0;
+    for (uint32_t i = 0; i != track->stsc_count; ++i) {
+        uint32_t first_chunk = track->stsc_first_chunk[i];
+        uint32_t end_chunk = i + 1 != track->stsc_count ? track->stsc_first_chunk[i + 1] :
+            track->chunk_offset_count + 1;
+        if (first_chunk == 0 || end_chunk < first_chunk || end_chunk > track->chunk_offset_count + 1) {
+            printf("track %u: invalid stsc entry %u, first chunk: %u, chunk count: %u\n",
+                track->trackid, i + 1, first_chunk, track->chunk_offset_count);
+            ++errors;
+            break;
+        }
+        stsc_count += (uint64_t)(end_chunk - first_chunk) * track->stsc_sample_per_chunk[i];
+    }
+    if (stsc_count != count) {
+        printf("track %u: stsc and stco hold %llu samples, stsz has %u\n", track->trackid, stsc_count, count);
+        ++errors;
+    }
+
+    for (uint32_t i = 0; i != track->sample_number_count; ++i) {
+        uint32_t number = track->sample_numbers[i];
+        if (number == 0 || number > count || (i && number <= track->sample_numbers[i - 1])) {
+            printf("track %u: invalid stss entry %u, sample number: %u\n", track->trackid, i + 1, number);
+            ++errors;
+            break;
+        }
+    }
+    return errors;
+}
+
+// Check every sample is inside an 'mdat', and no two samples share bytes.
+// @return number of errors found.
+static int check_sample_ranges(mov_ctx_t *ctx, mov_track_t **tracks, int track_count)
+{
+    int errors = 0;
+
+    // 'mdat' boxes, in file order.
+    uint32_t mdat_count = 0;
+    sample_range_t *mdats = malloc((ctx->box_node_count + 1) * sizeof(sample_range_t));
+    uint64_t total = 0;
+    for (int i = 0; i != track_count; ++i) {
+        total += tracks[i]->samples.count;
+    }
+    sample_range_t *ranges = malloc((total + 1) * sizeof(sample_range_t));
+    if (NULL == mdats || NULL == ranges) {
+        printf("failed to allocate sample ranges\n");
+        free(mdats);
+        free(ranges);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i != ctx->box_node_count; ++i) {
+        const mov_box_node_t *node = ctx->box_nodes + i;
+        if (node->parent == -1 && node->type == MOV_BOX_TYPE('m','d','a','t')) {
+            sample_range_t *mdat = mdats + mdat_count++;
+            mdat->offset = node->content_pos;
+            // A size of 0 extends the box to the end of file.
+            mdat->end = node->size >= 0 ? node->content_pos + node->size : ctx->file_size;
+            if (mdat->end > (uint64_t)ctx->file_size) {
+                printf("mdat at %lld is truncated, %llu bytes missing\n", node->offset,
+                    mdat->end - ctx->file_size);
+                ++errors;
+            }
+        }
+    }
+
+    uint64_t n = 0;
+    for (int i = 0; i != track_count; ++i) {
+        const mov_sample_index_t *samples = &tracks[i]->samples;
+        for (uint32_t k = 0; k != samples->count; ++k) {
+            sample_range_t *r = ranges + n++;
+            r->offset = samples->offsets[k];
+            r->end = samples->offsets[k] + samples->sizes[k];
+            r->trackid = tracks[i]->trackid;
+            r->sample = k + 1;
+        }
+    }
+    qsort(ranges, n, sizeof(sample_range_t), compare_range_offset);
+
+    // Both lists are sorted, walk them together.
+    int outside = 0;
+    int overlaps = 0;
+    uint32_t m = 0;
+    const sample_range_t *furthest = NULL;  // Range reaching furthest so far.
+    for (uint64_t i = 0; i != n; ++i) {
+        const sample_range_t *r = ranges + i;
+        while (m < mdat_count && mdats[m].end <= r->offset) {
+            ++m;
+        }
+        if (r->end > r->offset && (m == mdat_count || r->offset < mdats[m].offset || r->end > mdats[m].end)) {
+            if (++outside <= MAX_REPORTED) {
+                printf("track %u sample %u is outside mdat: %llu, size %llu\n", r->trackid, r->sample,
+                    r->offset, r->end - r->offset);
+            }
+        }
+        // A range may overlap any earlier one, not only the one just before:
+        // compare with the furthest end.
+        if (furthest && r->offset < furthest->end) {
+            if (++overlaps <= MAX_REPORTED) {
+                printf("track %u sample %u overlaps track %u sample %u at: %llu\n", r->trackid, r->sample,
+                    furthest->trackid, furthest->sample, r->offset);
+            }
+        }
+        if (NULL == furthest || r->end > furthest->end) {
+            furthest = r;
+        }
+    }
+    if (outside) {
+        printf("%d samples outside mdat\n", outside);
+    }
+    if (overlaps) {
+        printf("%d samples overlapping\n", overlaps);
+    }
+
+    free(mdats);
+    free(ranges);
+    return errors + outside + overlaps;
+}
+
+// Checksum a unit, reading contiguous samples at once.
+// @return 0 on success.
+static int check_unit(FILE *f, check_unit_t *unit, uint8_t *buffer)
+{
+    const mov_sample_index_t *samples = &unit->track->samples;
+    uint32_t crc = 0;
+
+    uint32_t i = unit->first_sample;
+    while (i != unit->end_sample) {
+        uint64_t offset = samples->offsets[i];
+        uint64_t size = 0;
+        do {
+            size += samples->sizes[i++];
+        } while (i != unit->end_sample && samples->offsets[i] == offset + size &&
+            size + samples->sizes[i] <= UNIT_SIZE);
+
+        if (_fseeki64(f, offset, SEEK_SET) != 0) {
+            printf("failed to seek to: %llu\n", offset);
+            return -1;
+        }
+        // A single sample may be larger than the buffer.
+        while (size) {
+            size_t len = size < UNIT_SIZE ? (size_t)size : UNIT_SIZE;
+            if (fread(buffer, len, 1, f) != 1) {
+                printf("failed to read %zu bytes at: %llu, track %u\n", len, offset, unit->track->trackid);
+                return -1;
+            }
+            crc = mov_crc32c(crc, buffer, len);
+            offset += len;
+            size -= len;
+        }
+    }
+    unit->crc = crc;
+    return 0;
+}
+
+static void check_thread(void *arg)
+{
+    check_pool_t *pool = arg;
+
+    FILE *f = fopen(pool->filename, "rb");
+    uint8_t *buffer = malloc(UNIT_SIZE);
+    if (NULL == f || NULL == buffer) {
+        printf("failed to open %s for checking\n", pool->filename);
+    }
+
+    for (;;) {
+        mov_mutex_lock(&pool->mutex);
+        uint32_t index = pool->next_unit;
+        if (index != pool->unit_count) {
+            ++pool->next_unit;
+        }
+        mov_mutex_unlock(&pool->mutex);
+        if (index == pool->unit_count) {
+            break;
+        }
+
+        check_unit_t *unit = pool->units + index;
+        unit->failed = NULL == f || NULL == buffer || check_unit(f, unit, buffer) != 0;
+    }
+
+    if (f) {
+        fclose(f);
+    }
+    free(buffer);
+}
+
+// Checksum payloads of all tracks on "thread_count" threads.
+// @return number of errors found.
+static int check_payloads(const char *filename, mov_track_t **tracks, int track_count, int thread_count)
+{
+    int errors = 0;
+    check_pool_t pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.filename = filename;
+
+    // Cut tracks into units. Each unit holds at least one sample.
+    uint32_t capacity = 64;
+    pool.units = malloc(capacity * sizeof(check_unit_t));
+    for (int i = 0; pool.units && i != track_count; ++i) {
+        const mov_sample_index_t *samples = &tracks[i]->samples;
+        uint32_t k = 0;
+        while (k != samples->count) {
+            if (pool.unit_count == capacity) {
+                capacity *= 2;
+                check_unit_t *units = realloc(pool.units, capacity * sizeof(check_unit_t));
+                if (NULL == units) {
+                    free(pool.units);
+                    pool.units = NULL;
+                    break;
+                }
+                pool.units = units;
+            }
+            check_unit_t *unit = pool.units + pool.unit_count++;
+            memset(unit, 0, sizeof(*unit));
+            unit->track = tracks[i];
+            unit->first_sample = k;
+            do {
+                unit->bytes += samples->sizes[k++];
+            } while (k != samples->count && unit->bytes + samples->sizes[k] <= UNIT_SIZE);
+            unit->end_sample = k;
+        }
+    }
+    if (NULL == pool.units) {
+        printf("failed to allocate check units\n");
+        return 1;
+    }
+
+    mov_crc32c_init();
+    mov_mutex_init(&pool.mutex);
+    if (thread_count > (int)pool.unit_count) {
+        thread_count = pool.unit_count ? (int)pool.unit_count : 1;
+    }
+    mov_thread_t *threads = malloc(thread_count * sizeof(mov_thread_t));
+    int started = 0;
+    for (; threads && started != thread_count; ++started) {
+        if (mov_thread_create(threads + started, check_thread, &pool) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        // Check on this thread instead.
+        check_thread(&pool);
+    }
+    for (int i = 0; i != started; ++i) {
+        mov_thread_join(threads + i);
+    }
+    free(threads);
+    mov_mutex_destroy(&pool.mutex);
+
+    // Units of a track are in sample order, combine their CRCs in order.
+    uint32_t u = 0;
+    for (int i = 0; i != track_count; ++i) {
+        uint32_t crc = 0;
+        uint64_t bytes = 0;
+        int failed = 0;
+        for (; u != pool.unit_count && pool.units[u].track == tracks[i]; ++u) {
+            failed |= pool.units[u].failed;
+            crc = mov_crc32c_combine(crc, pool.units[u].crc, pool.units[u].bytes);
+            bytes += pool.units[u].bytes;
+        }
+        if (failed) {
+            printf("track %u: %u samples, %llu bytes, crc32c: unreadable\n", tracks[i]->trackid,
+                tracks[i]->samples.count, bytes);
+            ++errors;
+        } else {
+            printf("track %u: %u samples, %llu bytes, crc32c: %08x\n", tracks[i]->trackid,
+                tracks[i]->samples.count, bytes, crc);
+        }
+    }
+
+    free(pool.units);
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+    int thread_count = mov_cpu_count();
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-' && argv[arg][1] == '-'; ++arg) {
+        if (0 == strcmp(argv[arg], "--threads") && arg + 1 < argc) {
+            thread_count = atoi(argv[++arg]);
+            if (thread_count < 1) {
+                thread_count = 1;
+            }
+        } else {
+            printf("unknown option: %s\n", argv[arg]);
+            return 1;
+        }
+    }
+
+    if (argc - arg < 1) {
+        fprintf(stdout, "Usage: %s [--threads <n>] <filename>\n", argv[0]);
+        fprintf(stdout, "  Check sample tables and data ranges, and print a CRC-32C of each track.\n");
+        return 1;
+    }
+
+    mov_ctx_t *ctx = malloc(sizeof(*ctx));
+    memset(ctx, 0, sizeof(*ctx));
+
+    ret = parse_mov_file(argv[arg], ctx);
+    if (ret != 0) {
+        printf("failed to parse_mov_file\n");
+        mov_ctx_free(ctx);
+        free(ctx);
+        return 1;
+    }
+
+    int errors = 0;
+    mov_track_t **tracks = malloc((ctx->track_count + 1) * sizeof(mov_track_t *));
+    int track_count = 0;
+    for (int i = 0; i != ctx->track_count; ++i) {
+        mov_track_t *track = ctx->tracks + i;
+        if (!track->valid) {
+            continue;
+        }
+        // Tables are released once indexed, check them first. Fragments
+        // are indexed while parsing.
+        if (track->samples.count == 0) {
+            errors += check_tables(track);
+            if (mov_build_sample_index(track) != 0) {
+                ++errors;
+                continue;
+            }
+        }
+        tracks[track_count++] = track;
+    }
+
+    errors += check_sample_ranges(ctx, tracks, track_count);
+    errors += check_payloads(argv[arg], tracks, track_count, thread_count);
+
+    printf("%s: %d errors\n", errors ? "FAILED" : "OK", errors);
+
+    free(tracks);
+    mov_ctx_free(ctx);
+    free(ctx);
+    return errors ? 1 : 0;
+}
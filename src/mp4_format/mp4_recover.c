@@ -0,0 +1,752 @@
+// Recover a recording without 'moov', such as one cut by a power loss:
+// 'ftyp' and an 'mdat' running to the end of the file. Codec settings and
+// frame durations come from a reference file of the same device.
+//
+// 'mdat' is read in large blocks and split into samples. A video sample is
+// a run of length prefixed NAL units, starting with one that begins an
+// access unit. Bytes between video samples are AAC frames. Raw AAC frames
+// carry no length, so a run is cut where a frame of the reference could
+// start (first bytes seen there) and a raw data block ends (ID_END then
+// byte alignment), into sizes closest to the reference frames.
+// The samples are then written to a new file with mov_writer.
+
+#include "mov_defs.h"
+#include "mov_read_functions.h"
+#include "mov_sample_index.h"
+#include "mov_writer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RECOVER_SSE2
+#endif
+
+// 'mdat' is scanned through a window of this size.
+#define SCAN_BLOCK (16 * 1024 * 1024)
+
+// Audio runs longer than this are not split but dropped.
+#define MAX_AUDIO_RUN (4 * 1024 * 1024)
+
+// Audio samples of the reference looked at, to learn frame starts.
+#define MAX_AUDIO_PROBES 4096
+
+// What is learned from the reference file.
+typedef struct tag_recover_reference {
+    mov_track_t *video;
+    mov_track_t *audio;
+    int is_hevc;
+    uint32_t length_size;
+    uint32_t video_delta;       // Frame duration, in the video timescale.
+    uint32_t max_nal_size;      // Larger NAL lengths are taken as noise.
+
+    uint32_t audio_delta;
+    uint32_t audio_min_size;
+    uint32_t audio_max_size;
+    double audio_mean_size;
+    uint8_t audio_first_bytes[256];     // Set for first bytes of reference frames.
+} recover_reference_t;
+
+typedef struct tag_recovered_sample {
+    uint64_t offset;
+    uint32_t size;
+    uint8_t is_video;
+    uint8_t sync;
+} recovered_sample_t;
+
+typedef struct tag_scan_reader {
+    FILE *f;
+    uint64_t end;               // End of the 'mdat' being scanned.
+    uint8_t *buffer;
+    uint64_t buffer_pos;        // File offset of buffer[0].
+    uint32_t buffer_len;
+} scan_reader_t;
+
+typedef struct tag_recover_scan {
+    const recover_reference_t *ref;
+    scan_reader_t reader;
+    recovered_sample_t *samples;
+    uint32_t sample_count;
+    uint32_t sample_capacity;
+    uint64_t dropped_bytes;
+} recover_scan_t;
+
+// Bytes [pos, pos + len) of the file, read in a block if not in the window.
+// @return NULL past the end of 'mdat' or on read failure.
+static const uint8_t *reader_get(scan_reader_t *r, uint64_t pos, uint32_t len)
+{
+    if (pos + len > r->end) {
+        return NULL;
+    }
+    if (pos >= r->buffer_pos && pos + len <= r->buffer_pos + r->buffer_len) {
+        return r->buffer + (pos - r->buffer_pos);
+    }
+
+    uint64_t remain = r->end - pos;
+    uint32_t size = remain < SCAN_BLOCK ? (uint32_t)remain : SCAN_BLOCK;
+    if (_fseeki64(r->f, pos, SEEK_SET) != 0 || fread(r->buffer, size, 1, r->f) != 1) {
+        printf("failed to read %u bytes at: %llu\n", size, pos);
+        r->buffer_len = 0;
+        return NULL;
+    }
+    r->buffer_pos = pos;
+    r->buffer_len = size;
+    return r->buffer;
+}
+
+static int add_sample(recover_scan_t *scan, uint64_t offset, uint32_t size, int is_video, int sync)
+{
+    if (scan->sample_count == scan->sample_capacity) {
+        uint32_t capacity = scan->sample_capacity ? scan->sample_capacity * 2 : 4096;
+        recovered_sample_t *samples = realloc(scan->samples, capacity * sizeof(recovered_sample_t));
+        if (NULL == samples) {
+            printf("failed to allocate recovered samples\n");
+            return -1;
+        }
+        scan->samples = samples;
+        scan->sample_capacity = capacity;
+    }
+    recovered_sample_t *s = scan->samples + scan->sample_count++;
+    s->offset = offset;
+    s->size = size;
+    s->is_video = (uint8_t)is_video;
+    s->sync = (uint8_t)sync;
+    return 0;
+}
+
+// Check the header of a NAL unit of "len" bytes, "h" holds its first 3 bytes.
+// "starts_access_unit" is set for the NAL units that may open an access
+// unit: parameter sets, AUD and prefix SEI, or the first slice of a picture.
+// @return 1 if valid.
+static int check_nal(const recover_reference_t *ref, const uint8_t *h, uint32_t len,
+    int *is_vcl, int *starts_access_unit, int *sync)
+{
+    if (h[0] & 0x80) {
+        return 0;   // forbidden_zero_bit
+    }
+
+    if (ref->is_hevc) {
+        uint8_t type = (h[0] >> 1) & 0x3F;
+        uint8_t layer_id = ((h[0] & 1) << 5) | (h[1] >> 3);
+        uint8_t temporal_id_plus1 = h[1] & 0x7;
+        if (layer_id != 0 || temporal_id_plus1 == 0) {
+            return 0;
+        }
+        if (!(type <= 9 || (type >= 16 && type <= 21) || (type >= 32 && type <= 40))) {
+            return 0;
+        }
+        // VPS, SPS, PPS, AUD, prefix SEI, or the first slice of a picture.
+        *is_vcl = type < 32;
+        *starts_access_unit = (type >= 32 && type <= 35) || type == 39 ||
+            (type < 32 && len >= 3 && (h[2] & 0x80));
+        *sync = type >= 16 && type <= 21;
+        return 1;
+    }
+
+    uint8_t ref_idc = (h[0] >> 5) & 0x3;
+    uint8_t type = h[0] & 0x1F;
+    if (type == 0 || type > 12) {
+        return 0;
+    }
+    if ((type == 5 || type == 7 || type == 8) && ref_idc == 0) {
+        return 0;
+    }
+    if ((type == 6 || type >= 9) && ref_idc != 0) {
+        return 0;
+    }
+    // SEI, SPS, PPS, AUD, or a slice with first_mb_in_slice 0.
+    *is_vcl = type >= 1 && type <= 5;
+    *starts_access_unit = (type >= 6 && type <= 9) || ((type == 1 || type == 5) && (h[1] & 0x80));
+    *sync = type == 5;
+    return 1;
+}
+
+// An access unit is the NAL units before its first slice, the first slice,
+// then everything up to the next NAL unit that starts an access unit.
+// @return size of the video sample at "pos", 0 if none starts there.
+static uint32_t parse_video_sample(recover_scan_t *scan, uint64_t pos, int *sync)
+{
+    const recover_reference_t *ref = scan->ref;
+    uint32_t length_size = ref->length_size;
+    uint64_t p = pos;
+    int seen_vcl = 0;
+
+    *sync = 0;
+    while (p - pos < SCAN_BLOCK) {
+        const uint8_t *h = reader_get(&scan->reader, p, length_size + 3);
+        if (NULL == h) {
+            break;
+        }
+        uint32_t len = 0;
+        for (uint32_t i = 0; i != length_size; ++i) {
+            len = (len << 8) | h[i];
+        }
+        if (len < 2 || len > ref->max_nal_size || p + length_size + len > scan->reader.end) {
+            break;
+        }
+
+        int is_vcl, starts_access_unit, nal_sync;
+        if (!check_nal(ref, h + length_size, len, &is_vcl, &starts_access_unit, &nal_sync)) {
+            break;
+        }
+        if (seen_vcl ? starts_access_unit : !starts_access_unit && (p == pos || is_vcl)) {
+            break;
+        }
+        seen_vcl |= is_vcl;
+        *sync |= nal_sync;
+        p += length_size + len;
+    }
+    // Parameter sets or SEI alone are no picture.
+    return seen_vcl ? (uint32_t)(p - pos) : 0;
+}
+
+// A video sample that is followed by the end of data, another video sample,
+// or the first byte of an audio frame.
+// @return size of the sample, 0 if not likely one.
+static uint32_t probe_video_sample(recover_scan_t *scan, uint64_t pos, int *sync)
+{
+    uint32_t size = parse_video_sample(scan, pos, sync);
+    if (size == 0) {
+        return 0;
+    }
+    uint64_t next = pos + size;
+    if (next == scan->reader.end) {
+        return size;
+    }
+
+    int next_sync;
+    const uint8_t *b = reader_get(&scan->reader, next, 1);
+    if (b && scan->ref->audio && scan->ref->audio_first_bytes[*b]) {
+        return size;
+    }
+    if (parse_video_sample(scan, next, &next_sync)) {
+        return size;
+    }
+    return 0;
+}
+
+static uint32_t first_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return (uint32_t)__builtin_ctz(mask);
+#endif
+}
+
+// @return first zero byte in [p, end), or "end".
+static const uint8_t *find_zero_byte(const uint8_t *p, const uint8_t *end)
+{
+#ifdef RECOVER_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+        if (mask) {
+            return p + first_bit(mask);
+        }
+        p += 16;
+    }
+#endif
+    const uint8_t *zero_pos = memchr(p, 0, end - p);
+    return zero_pos ? zero_pos : end;
+}
+
+// Bytes of the window from "pos" on, at most "max", refilled at "pos" if
+// not in the window.
+// @return NULL on read failure.
+static const uint8_t *reader_get_available(scan_reader_t *r, uint64_t pos, uint64_t max, uint32_t *len)
+{
+    const uint8_t *data;
+    if (pos >= r->buffer_pos && pos < r->buffer_pos + r->buffer_len) {
+        data = r->buffer + (pos - r->buffer_pos);
+        *len = (uint32_t)(r->buffer_pos + r->buffer_len - pos);
+    } else {
+        data = reader_get(r, pos, 1);
+        *len = r->buffer_len;
+    }
+    if (*len > max) {
+        *len = (uint32_t)max;
+    }
+    return data;
+}
+
+// Find the next video sample after "pos", at most "limit" bytes ahead.
+// With 4-byte lengths, NAL units under 16 MiB start with a zero byte, so
+// only zero bytes are tried.
+// @return offset of the sample, or pos + limit if none.
+static uint64_t find_next_video_sample(recover_scan_t *scan, uint64_t pos, uint64_t limit)
+{
+    uint64_t end = pos + limit;
+    if (end > scan->reader.end) {
+        end = scan->reader.end;
+    }
+
+    uint64_t p = pos;
+    while (p < end) {
+        uint32_t len;
+        const uint8_t *data = reader_get_available(&scan->reader, p, end - p, &len);
+        if (NULL == data) {
+            return end;
+        }
+        if (scan->ref->length_size == 4) {
+            const uint8_t *zero_pos = find_zero_byte(data, data + len);
+            p += zero_pos - data;
+            if (zero_pos == data + len) {
+                continue;
+            }
+        }
+
+        int sync;
+        if (probe_video_sample(scan, p, &sync)) {
+            return p;
+        }
+        ++p;
+    }
+    return end;
+}
+
+// A raw data block ends with ID_END (0b111) and less than a byte of zero
+// padding. "end" points past the last byte, with at least two bytes before.
+static int aac_frame_end(const uint8_t *end)
+{
+    uint32_t bits = (uint32_t)end[-2] << 8 | end[-1];
+    if (bits == 0) {
+        return 0;
+    }
+    int padding = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        ++padding;
+    }
+    return padding < 8 && (bits & 7) == 7;
+}
+
+// Split [pos, end) into AAC frames. Frames start with a byte seen at frame
+// starts of the reference, end a raw data block, and are sized within its
+// range. Among all such
+// splits, the one closest to the reference mean size is taken. Runs that
+// cannot be split are dropped.
+// @return 0 on success.
+static int split_audio_run(recover_scan_t *scan, uint64_t pos, uint64_t end)
+{
+    const recover_reference_t *ref = scan->ref;
+    uint32_t len = (uint32_t)(end - pos);
+
+    if (NULL == ref->audio || len > MAX_AUDIO_RUN) {
+        scan->dropped_bytes += len;
+        return 0;
+    }
+    const uint8_t *data = reader_get(&scan->reader, pos, len);
+    if (NULL == data) {
+        return -1;
+    }
+
+    // cost[i]: lowest cost of splitting data[i..len), next[i] the end of its
+    // first frame. Only frame starts are evaluated.
+    double *cost = malloc((len + 1) * sizeof(double));
+    uint32_t *next = malloc((len + 1) * sizeof(uint32_t));
+    if (NULL == cost || NULL == next) {
+        free(cost);
+        free(next);
+        printf("failed to allocate audio split\n");
+        return -1;
+    }
+
+    const double none = -1;
+    cost[len] = 0;
+    for (uint32_t i = len; i-- != 0;) {
+        cost[i] = none;
+        if (i != 0 && !ref->audio_first_bytes[data[i]]) {
+            continue;
+        }
+        uint32_t lo = i + ref->audio_min_size;
+        uint32_t hi = i + ref->audio_max_size;
+        if (hi > len) {
+            hi = len;
+        }
+        for (uint32_t j = lo; j <= hi; ++j) {
+            if (cost[j] < 0 || !aac_frame_end(data + j) ||
+                (j != len && !ref->audio_first_bytes[data[j]])) {
+                continue;
+            }
+            double d = (double)(j - i) - ref->audio_mean_size;
+            double c = cost[j] + d * d;
+            if (cost[i] < 0 || c < cost[i]) {
+                cost[i] = c;
+                next[i] = j;
+            }
+        }
+    }
+
+    int ret = 0;
+    if (cost[0] < 0) {
+        printf("audio of %u bytes at %llu dropped, no split found\n", len, pos);
+        scan->dropped_bytes += len;
+    } else {
+        for (uint32_t i = 0; i != len && ret == 0; i = next[i]) {
+            ret = add_sample(scan, pos + i, next[i] - i, 0, 1);
+        }
+    }
+    free(cost);
+    free(next);
+    return ret;
+}
+
+// Split 'mdat' content [start, end) into samples.
+// @return 0 on success.
+static int scan_mdat(recover_scan_t *scan, uint64_t start, uint64_t end)
+{
+    scan->reader.end = end;
+    scan->reader.buffer_len = 0;
+
+    uint64_t pos = start;
+    while (pos < end) {
+        int sync;
+        uint32_t size = parse_video_sample(scan, pos, &sync);
+        if (size) {
+            if (add_sample(scan, pos, size, 1, sync) != 0) {
+                return -1;
+            }
+            pos += size;
+            continue;
+        }
+
+        uint64_t next = find_next_video_sample(scan, pos + 1, MAX_AUDIO_RUN);
+        if (next == pos + 1 + MAX_AUDIO_RUN) {
+            printf("no video found in %u bytes at: %llu\n", MAX_AUDIO_RUN, pos);
+        }
+        if (split_audio_run(scan, pos, next) != 0) {
+            return -1;
+        }
+        pos = next;
+    }
+    return 0;
+}
+
+static int is_avc_format(const char *codec_format)
+{
+    return strncmp(codec_format, "avc", 3) == 0;
+}
+
+static int is_hevc_format(const char *codec_format)
+{
+    return strncmp(codec_format, "hvc", 3) == 0 || strncmp(codec_format, "hev", 3) == 0;
+}
+
+// Learn codec settings and frame statistics of the reference.
+// @return 0 on success.
+static int load_reference(mov_ctx_t *ctx, recover_reference_t *ref)
+{
+    memset(ref, 0, sizeof(*ref));
+    for (int i = 0; i != ctx->track_count; ++i) {
+        mov_track_t *track = ctx->tracks + i;
+        if (!track->valid) {
+            continue;
+        }
+        // avc1/avc3 and hvc1/hev1, with parameter sets in the sample entry or not.
+        if (NULL == ref->video && track->is_video && (is_avc_format(track->codec_format) ||
+            is_hevc_format(track->codec_format))) {
+            ref->video = track;
+        } else if (NULL == ref->audio && track->is_audio && strncmp(track->codec_format, "mp4a", 4) == 0) {
+            ref->audio = track;
+        }
+    }
+    if (NULL == ref->video || NULL == ref->video->decoder_config) {
+        printf("no h264 or h265 video track in reference\n");
+        return -1;
+    }
+
+    mov_track_t *video = ref->video;
+    ref->is_hevc = is_hevc_format(video->codec_format);
+    ref->length_size = video->length_size;
+    if (mov_load_track_tables(ctx, video) != 0 || mov_build_sample_index(video) != 0 ||
+        video->samples.count < 2) {
+        printf("failed to index reference video\n");
+        return -1;
+    }
+    ref->video_delta = (uint32_t)(video->samples.dts[1] - video->samples.dts[0]);
+    uint32_t max_size = 0;
+    for (uint32_t i = 0; i != video->samples.count; ++i) {
+        if (video->samples.sizes[i] > max_size) {
+            max_size = video->samples.sizes[i];
+        }
+    }
+    // Room for frames much larger than in the reference.
+    ref->max_nal_size = max_size < SCAN_BLOCK / 8 ? max_size * 8 : SCAN_BLOCK;
+    if (ref->max_nal_size < 256 * 1024) {
+        ref->max_nal_size = 256 * 1024;
+    }
+
+    mov_track_t *audio = ref->audio;
+    if (audio && (mov_load_track_tables(ctx, audio) != 0 || mov_build_sample_index(audio) != 0 ||
+        audio->samples.count < 2)) {
+        printf("reference audio is not usable, audio is dropped\n");
+        ref->audio = audio = NULL;
+    }
+    if (audio) {
+        ref->audio_delta = (uint32_t)(audio->samples.dts[1] - audio->samples.dts[0]);
+        ref->audio_min_size = UINT32_MAX;
+        uint64_t total = 0;
+        uint32_t probed = 0;
+        uint32_t probes = audio->samples.count < MAX_AUDIO_PROBES ? audio->samples.count : MAX_AUDIO_PROBES;
+        for (uint32_t i = 0; i != probes; ++i) {
+            uint32_t size = audio->samples.sizes[i];
+            uint8_t first;
+            if (size == 0 || _fseeki64(ctx->f, audio->samples.offsets[i], SEEK_SET) != 0 ||
+                fread(&first, 1, 1, ctx->f) != 1) {
+                continue;
+            }
+            ref->audio_first_bytes[first] = 1;
+            ref->audio_min_size = size < ref->audio_min_size ? size : ref->audio_min_size;
+            ref->audio_max_size = size > ref->audio_max_size ? size : ref->audio_max_size;
+            total += size;
+            ++probed;
+        }
+        if (probed == 0) {
+            printf("failed to read reference audio\n");
+            return -1;
+        }
+        ref->audio_mean_size = (double)total / probed;
+        // Accept frames somewhat out of the reference range.
+        ref->audio_min_size = ref->audio_min_size / 2 > 2 ? ref->audio_min_size / 2 : 2;
+        ref->audio_max_size = ref->audio_max_size + ref->audio_max_size / 2;
+    }
+
+    printf("reference: %s, length size %u, frame duration %u/%u", video->codec_format, ref->length_size,
+        ref->video_delta, video->timescale);
+    if (audio) {
+        printf(", audio frames %u to %u bytes", ref->audio_min_size, ref->audio_max_size);
+    }
+    printf("\n");
+    return 0;
+}
+
+// Write the samples found, in file order, with timestamps from the
+// reference frame durations. Composition offsets are not recoverable,
+// samples are presented in decoding order.
+// @return 0 on success.
+static int write_recovered(const recover_reference_t *ref, const recover_scan_t *scan, FILE *in,
+    const char *filename)
+{
+    int ret;
+    mov_writer_t writer;
+    mov_writer_config_t config;
+    memset(&config, 0, sizeof(config));
+
+    ret = mov_writer_open(&writer, filename, &config);
+    if (ret != 0) {
+        return ret;
+    }
+
+    mov_writer_track_config_t track_config;
+    memset(&track_config, 0, sizeof(track_config));
+    track_config.timescale = ref->video->timescale;
+    track_config.is_video = 1;
+    memcpy(track_config.codec_format, ref->video->codec_format, sizeof(track_config.codec_format));
+    track_config.width = (uint16_t)ref->video->width;
+    track_config.height = (uint16_t)ref->video->height;
+    track_config.decoder_config = ref->video->decoder_config;
+    track_config.decoder_config_len = ref->video->decoder_config_len;
+    int video_track = mov_writer_add_track(&writer, &track_config);
+
+    int audio_track = -1;
+    if (ref->audio) {
+        memset(&track_config, 0, sizeof(track_config));
+        track_config.timescale = ref->audio->timescale;
+        memcpy(track_config.codec_format, "mp4a", 5);
+        track_config.channel_count = ref->audio->channel_count;
+        track_config.sample_rate = ref->audio->audio_sample_rate;
+        track_config.decoder_config = ref->audio->audio_specific_config;
+        track_config.decoder_config_len = ref->audio->audio_specific_config_len;
+        audio_track = mov_writer_add_track(&writer, &track_config);
+    }
+
+    // Buffers of samples the writer may still reference.
+    uint8_t **buffers = malloc((scan->sample_count + 1) * sizeof(uint8_t *));
+    uint32_t buffer_count = 0;
+    if (video_track < 0 || (ref->audio && audio_track < 0) || NULL == buffers) {
+        ret = -1;
+    }
+
+    uint64_t file_pos = UINT64_MAX;
+    uint64_t video_dts = 0;
+    uint64_t audio_dts = 0;
+    uint32_t video_count = 0;
+    uint32_t audio_count = 0;
+    for (uint32_t i = 0; ret == 0 && i != scan->sample_count; ++i) {
+        const recovered_sample_t *s = scan->samples + i;
+        uint8_t *data = malloc(s->size);
+        if (NULL == data) {
+            printf("failed to allocate sample of %u bytes\n", s->size);
+            ret = -1;
+            break;
+        }
+        buffers[buffer_count++] = data;
+
+        if (s->offset != file_pos && _fseeki64(in, s->offset, SEEK_SET) != 0) {
+            ret = -1;
+            break;
+        }
+        if (fread(data, s->size, 1, in) != 1) {
+            printf("failed to read sample at: %llu\n", s->offset);
+            ret = -1;
+            break;
+        }
+        file_pos = s->offset + s->size;
+
+        mov_writer_sample_t sample;
+        sample.data = data;
+        sample.size = s->size;
+        sample.cts_offset = 0;
+        sample.sync = s->sync;
+        int written;
+        if (s->is_video) {
+            sample.dts = video_dts;
+            video_dts += ref->video_delta;
+            ++video_count;
+            written = mov_writer_write_sample(&writer, video_track, &sample);
+        } else {
+            sample.dts = audio_dts;
+            audio_dts += ref->audio_delta;
+            ++audio_count;
+            written = mov_writer_write_sample(&writer, audio_track, &sample);
+        }
+        if (written < 0) {
+            ret = -1;
+        } else if (written && buffer_count > 1) {
+            // All but this sample are written.
+            for (uint32_t k = 0; k + 1 < buffer_count; ++k) {
+                free(buffers[k]);
+            }
+            buffers[0] = data;
+            buffer_count = 1;
+        }
+    }
+
+    if (mov_writer_close(&writer) != 0) {
+        ret = -1;
+    }
+    for (uint32_t k = 0; k != buffer_count; ++k) {
+        free(buffers[k]);
+    }
+    free(buffers);
+    printf("%u video and %u audio samples written\n", video_count, audio_count);
+    return ret;
+}
+
+// Scan 'mdat' boxes of the broken file. A box is cut at the file end.
+// @return 0 on success.
+static int scan_file(recover_scan_t *scan, FILE *f)
+{
+    int ret = -1;
+    _fseeki64(f, 0, SEEK_END);
+    uint64_t file_size = _ftelli64(f);
+
+    uint64_t pos = 0;
+    while (pos + 8 <= file_size) {
+        uint8_t h[16];
+        _fseeki64(f, pos, SEEK_SET);
+        if (fread(h, 8, 1, f) != 1) {
+            break;
+        }
+        uint64_t size = ((uint32_t)h[0] << 24) | (h[1] << 16) | (h[2] << 8) | h[3];
+        uint32_t header_size = 8;
+        if (size == 1) {
+            if (fread(h + 8, 8, 1, f) != 1) {
+                break;
+            }
+            size = 0;
+            for (int i = 8; i != 16; ++i) {
+                size = (size << 8) | h[i];
+            }
+            header_size = 16;
+        }
+        // Size 0, or a box header never rewritten: up to the file end.
+        if (size == 0 || pos + size > file_size) {
+            size = file_size - pos;
+        }
+        if (size < header_size) {
+            printf("invalid box at: %llu, scan stopped\n", pos);
+            break;
+        }
+
+        if (0 == memcmp(h + 4, "mdat", 4)) {
+            printf("scanning mdat at %llu, %llu bytes\n", pos, size);
+            ret = scan_mdat(scan, pos + header_size, pos + size);
+            if (ret != 0) {
+                return ret;
+            }
+        } else if (0 == memcmp(h + 4, "moov", 4)) {
+            printf("file has a moov, it may not need recovery\n");
+        }
+        pos += size;
+    }
+    if (ret != 0) {
+        printf("no mdat found\n");
+    }
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+
+    if (argc < 4) {
+        fprintf(stdout, "Usage: %s <reference> <broken> <output>\n", argv[0]);
+        fprintf(stdout, "  Rebuild a file without 'moov' using a good file of the same device.\n");
+        return 1;
+    }
+
+    mov_ctx_t *ctx = malloc(sizeof(*ctx));
+    memset(ctx, 0, sizeof(*ctx));
+    ret = parse_mov_file(argv[1], ctx);
+    if (ret != 0) {
+        printf("failed to parse reference\n");
+        mov_ctx_free(ctx);
+        free(ctx);
+        return 1;
+    }
+
+    recover_reference_t ref;
+    recover_scan_t scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.ref = &ref;
+    ret = load_reference(ctx, &ref);
+
+    FILE *in = NULL;
+    if (ret == 0) {
+        in = fopen(argv[2], "rb");
+        scan.reader.f = in;
+        scan.reader.buffer = malloc(SCAN_BLOCK);
+        if (NULL == in || NULL == scan.reader.buffer) {
+            printf("failed to open file: %s\n", argv[2]);
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        ret = scan_file(&scan, in);
+    }
+    if (ret == 0) {
+        printf("%u samples found, %llu bytes dropped\n", scan.sample_count, scan.dropped_bytes);
+        ret = write_recovered(&ref, &scan, in, argv[3]);
+    }
+
+    if (in) {
+        fclose(in);
+    }
+    free(scan.reader.buffer);
+    free(scan.samples);
+    mov_ctx_free(ctx);
+    free(ctx);
+
+    printf("end\n");
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+// Rewrite the video and audio tracks of a file with mov_writer, as a
+// progressive or a fragmented MP4.
+
+#include "mov_defs.h"
+#include "mov_read_functions.h"
+#include "mov_demux.h"
+#include "mov_writer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Sample buffers still referenced by the writer.
+typedef struct tag_remux_buffers {
+    uint8_t **data;
+    uint32_t count;
+    uint32_t capacity;
+} remux_buffers_t;
+
+// Release buffers of samples already written, all but the last one.
+static void release_buffers(remux_buffers_t *buffers)
+{
+    if (buffers->count < 2) {
+        return;
+    }
+    for (uint32_t i = 0; i + 1 < buffers->count; ++i) {
+        free(buffers->data[i]);
+    }
+    buffers->data[0] = buffers->data[buffers->count - 1];
+    buffers->count = 1;
+}
+
+static int remux(mov_ctx_t *ctx, const char *filename, const mov_writer_config_t *config)
+{
+    int ret;
+    mov_writer_t writer;
+    mov_demux_t demux;
+    remux_buffers_t buffers = { 0 };
+
+    mov_track_t **tracks = malloc((ctx->track_count + 1) * sizeof(mov_track_t *));
+    int *writer_tracks = malloc((ctx->track_count + 1) * sizeof(int));
+    int track_count = 0;
+
+    ret = mov_writer_open(&writer, filename, config);
+    if (ret != 0) {
+        free(tracks);
+        free(writer_tracks);
+        return ret;
+    }
+
+    for (int i = 0; i != ctx->track_count; ++i) {
+        mov_track_t *track = ctx->tracks + i;
+        if (!track->valid || (!track->is_video && !track->is_audio)) {
+            continue;
+        }
+
+        mov_writer_track_config_t track_config;
+        memset(&track_config, 0, sizeof(track_config));
+        track_config.timescale = track->timescale;
+        track_config.is_video = track->is_video;
+        memcpy(track_config.codec_format, track->codec_format, sizeof(track_config.codec_format));
+        track_config.width = (uint16_t)track->width;
+        track_config.height = (uint16_t)track->height;
+        track_config.channel_count = track->channel_count;
+        track_config.sample_rate = track->audio_sample_rate;
+        if (track->is_video) {
+            track_config.decoder_config = track->decoder_config;
+            track_config.decoder_config_len = track->decoder_config_len;
+        } else {
+            track_config.decoder_config = track->audio_specific_config;
+            track_config.decoder_config_len = track->audio_specific_config_len;
+        }
+
+        int index = mov_writer_add_track(&writer, &track_config);
+        if (index < 0) {
+            printf("track %u is skipped\n", track->trackid);
+            continue;
+        }
+        tracks[track_count] = track;
+        writer_tracks[track_count] = index;
+        ++track_count;
+    }
+
+    ret = mov_demux_init(&demux, ctx, tracks, track_count);
+
+    mov_demux_sample_t s;
+    uint32_t sample_count = 0;
+    while (ret == 0 && mov_demux_next(&demux, &s) == 0) {
+        int index = 0;
+        while (tracks[index] != s.track) {
+            ++index;
+        }
+
+        if (buffers.count == buffers.capacity) {
+            buffers.capacity = buffers.capacity ? buffers.capacity * 2 : 64;
+            buffers.data = realloc(buffers.data, buffers.capacity * sizeof(uint8_t *));
+        }
+        uint8_t *data = malloc(s.sample.size ? s.sample.size : 1);
+        buffers.data[buffers.count++] = data;
+
+        _fseeki64(ctx->f, s.sample.offset, SEEK_SET);
+        if (fread(data, 1, s.sample.size, ctx->f) != s.sample.size) {
+            printf("failed to read sample %u of track %u\n", s.index + 1, s.track->trackid);
+            ret = -1;
+            break;
+        }
+
+        mov_writer_sample_t sample;
+        sample.data = data;
+        sample.size = s.sample.size;
+        sample.dts = s.sample.dts;
+        sample.cts_offset = s.sample.cts_offset;
+        sample.sync = s.sample.sync;
+        int written = mov_writer_write_sample(&writer, writer_tracks[index], &sample);
+        if (written < 0) {
+            ret = -1;
+            break;
+        }
+        if (written) {
+            release_buffers(&buffers);
+        }
+        ++sample_count;
+    }
+
+    if (mov_writer_close(&writer) != 0) {
+        ret = -1;
+    }
+    printf("%u samples of %d tracks written\n", sample_count, track_count);
+
+    for (uint32_t i = 0; i != buffers.count; ++i) {
+        free(buffers.data[i]);
+    }
+    free(buffers.data);
+    mov_demux_free(&demux);
+    free(tracks);
+    free(writer_tracks);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+    mov_writer_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.fragment_duration_ms = 2000;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-' && argv[arg][1] == '-'; ++arg) {
+        if (0 == strcmp(argv[arg], "--frag")) {
+            config.fragmented = 1;
+        } else if (0 == strcmp(argv[arg], "--fragment-ms") && arg + 1 < argc) {
+            config.fragment_duration_ms = (uint32_t)strtoul(argv[++arg], NULL, 10);
+        } else if (0 == strcmp(argv[arg], "--reserve") && arg + 1 < argc) {
+            config.moov_reserve = (uint32_t)strtoul(argv[++arg], NULL, 10);
+        } else {
+            printf("unknown option: %s\n", argv[arg]);
+            return 1;
+        }
+    }
+
+    if (argc - arg < 2) {
+        fprintf(stdout, "Usage: %s [--frag] [--fragment-ms <ms>] [--reserve <bytes>] <input> <output>\n", argv[0]);
+        fprintf(stdout, "  --frag         write a fragmented file, cut every <ms> (2000 by default).\n");
+        fprintf(stdout, "  --reserve      reserve space for 'moov' before media data, so it is not moved\n");
+        fprintf(stdout, "                 on closing when 'moov' fits.\n");
+        return 1;
+    }
+
+    mov_ctx_t *ctx = malloc(sizeof(*ctx));
+    memset(ctx, 0, sizeof(*ctx));
+
+    ret = parse_mov_file(argv[arg], ctx);
+    if (ret != 0) {
+        printf("failed to parse_mov_file\n");
+    } else {
+        ret = remux(ctx, argv[arg + 1], &config);
+    }
+
+    mov_ctx_free(ctx);
+    free(ctx);
+
+    printf("end\n");
+    return ret == 0 ? 0 : 1;
+}
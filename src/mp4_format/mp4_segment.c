@@ -0,0 +1,352 @@
+// Cut a progressive file into CMAF segments, with HLS and DASH playlists.
+// A single segment can also be written alone, to serve it on request.
+
+#include "mov_defs.h"
+#include "mov_read_functions.h"
+#include "mov_segmenter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PATH_SIZE 1024
+
+// RFC 6381 codec string of the track.
+static void get_codecs(const mov_segmenter_track_t *t, char *codecs, size_t size)
+{
+    const mov_track_t *track = t->track;
+    const uint8_t *config = t->writer.tracks[0].config.decoder_config;
+    uint32_t config_len = t->writer.tracks[0].config.decoder_config_len;
+
+    if (track->is_audio) {
+        // Audio object type, from the AudioSpecificConfig.
+        snprintf(codecs, size, "mp4a.40.%u", config_len ? config[0] >> 3 : 2);
+    } else if (strncmp(track->codec_format, "avc", 3) == 0 && config_len >= 4) {
+        // profile_idc, constraint flags and level_idc of the 'avcC'.
+        snprintf(codecs, size, "%.4s.%02X%02X%02X", track->codec_format, config[1], config[2], config[3]);
+    } else if (config_len >= 13) {
+        // 'hvcC': general profile, compatibility flags (bit reversed),
+        // tier and level, then constraint flags without trailing zeros.
+        static const char *spaces[] = { "", "A", "B", "C" };
+        uint32_t compat = ((uint32_t)config[2] << 24) | (config[3] << 16) | (config[4] << 8) | config[5];
+        uint32_t reversed = 0;
+        for (int i = 0; i != 32; ++i) {
+            reversed |= ((compat >> i) & 1) << (31 - i);
+        }
+        int n = snprintf(codecs, size, "%.4s.%s%u.%X.%c%u", track->codec_format, spaces[config[1] >> 6],
+            config[1] & 0x1F, reversed, (config[1] >> 5) & 1 ? 'H' : 'L', config[12]);
+        int last = 11;
+        while (last >= 6 && config[last] == 0) {
+            --last;
+        }
+        for (int i = 6; i <= last && n > 0 && (size_t)n < size; ++i) {
+            n += snprintf(codecs + n, size - n, ".%X", config[i]);
+        }
+    } else {
+        snprintf(codecs, size, "%.4s", track->codec_format);
+    }
+}
+
+static int write_media_playlist(mov_segmenter_t *segmenter, int track, const char *path)
+{
+    mov_segmenter_track_t *t = segmenter->tracks + track;
+    uint32_t timescale = t->track->timescale;
+
+    FILE *f = fopen(path, "w");
+    if (NULL == f) {
+        printf("failed to open: %s\n", path);
+        return -1;
+    }
+
+    uint64_t max_duration = 0;
+    for (uint32_t k = 0; k != t->segment_count; ++k) {
+        uint64_t start, duration;
+        mov_segmenter_get_segment_time(segmenter, track, k, &start, &duration);
+        max_duration = duration > max_duration ? duration : max_duration;
+    }
+
+    fprintf(f, "#EXTM3U\n");
+    fprintf(f, "#EXT-X-VERSION:7\n");
+    fprintf(f, "#EXT-X-TARGETDURATION:%llu\n", (max_duration + timescale - 1) / timescale);
+    fprintf(f, "#EXT-X-MEDIA-SEQUENCE:0\n");
+    fprintf(f, "#EXT-X-PLAYLIST-TYPE:VOD\n");
+    fprintf(f, "#EXT-X-INDEPENDENT-SEGMENTS\n");
+    fprintf(f, "#EXT-X-MAP:URI=\"init_%d.mp4\"\n", track + 1);
+    for (uint32_t k = 0; k != t->segment_count; ++k) {
+        uint64_t start, duration;
+        mov_segmenter_get_segment_time(segmenter, track, k, &start, &duration);
+        fprintf(f, "#EXTINF:%.6f,\n", (double)duration / timescale);
+        fprintf(f, "seg_%d_%u.m4s\n", track + 1, k + 1);
+    }
+    fprintf(f, "#EXT-X-ENDLIST\n");
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static int write_master_playlist(mov_segmenter_t *segmenter, const char *path)
+{
+    char codecs[64];
+    int audio = -1;
+    for (int i = 0; i != segmenter->track_count && audio < 0; ++i) {
+        if (segmenter->tracks[i].track->is_audio) {
+            audio = i;
+        }
+    }
+
+    FILE *f = fopen(path, "w");
+    if (NULL == f) {
+        printf("failed to open: %s\n", path);
+        return -1;
+    }
+
+    fprintf(f, "#EXTM3U\n");
+    fprintf(f, "#EXT-X-VERSION:7\n");
+    fprintf(f, "#EXT-X-INDEPENDENT-SEGMENTS\n");
+    if (audio >= 0) {
+        fprintf(f, "#EXT-X-MEDIA:TYPE=AUDIO,GROUP-ID=\"audio\",NAME=\"audio\",DEFAULT=YES,AUTOSELECT=YES,URI=\"track_%d.m3u8\"\n",
+            audio + 1);
+    }
+
+    int video_count = 0;
+    for (int i = 0; i != segmenter->track_count; ++i) {
+        mov_segmenter_track_t *t = segmenter->tracks + i;
+        if (!t->track->is_video) {
+            continue;
+        }
+        ++video_count;
+
+        char audio_codecs[32] = "";
+        uint32_t bandwidth = t->max_bitrate;
+        uint32_t average = t->avg_bitrate;
+        if (audio >= 0) {
+            get_codecs(segmenter->tracks + audio, audio_codecs, sizeof(audio_codecs));
+            bandwidth += segmenter->tracks[audio].max_bitrate;
+            average += segmenter->tracks[audio].avg_bitrate;
+        }
+        get_codecs(t, codecs, sizeof(codecs));
+
+        fprintf(f, "#EXT-X-STREAM-INF:BANDWIDTH=%u,AVERAGE-BANDWIDTH=%u,CODECS=\"%s%s%s\",RESOLUTION=%ux%u%s\n",
+            bandwidth, average, codecs, audio >= 0 ? "," : "", audio_codecs,
+            t->track->width, t->track->height, audio >= 0 ? ",AUDIO=\"audio\"" : "");
+        fprintf(f, "track_%d.m3u8\n", i + 1);
+    }
+    if (video_count == 0 && audio >= 0) {
+        get_codecs(segmenter->tracks + audio, codecs, sizeof(codecs));
+        fprintf(f, "#EXT-X-STREAM-INF:BANDWIDTH=%u,AVERAGE-BANDWIDTH=%u,CODECS=\"%s\"\n",
+            segmenter->tracks[audio].max_bitrate, segmenter->tracks[audio].avg_bitrate, codecs);
+        fprintf(f, "track_%d.m3u8\n", audio + 1);
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static void write_dash_representation(mov_segmenter_t *segmenter, int track, FILE *f)
+{
+    char codecs[64];
+    mov_segmenter_track_t *t = segmenter->tracks + track;
+    get_codecs(t, codecs, sizeof(codecs));
+
+    if (t->track->is_video) {
+        fprintf(f, "      <Representation id=\"%d\" codecs=\"%s\" bandwidth=\"%u\" width=\"%u\" height=\"%u\">\n",
+            track + 1, codecs, t->max_bitrate, t->track->width, t->track->height);
+    } else {
+        fprintf(f, "      <Representation id=\"%d\" codecs=\"%s\" bandwidth=\"%u\" audioSamplingRate=\"%u\">\n",
+            track + 1, codecs, t->max_bitrate, t->track->audio_sample_rate);
+        fprintf(f, "        <AudioChannelConfiguration schemeIdUri=\"urn:mpeg:dash:23003:3:audio_channel_configuration:2011\" value=\"%u\"/>\n",
+            t->track->channel_count);
+    }
+    fprintf(f, "        <SegmentTemplate timescale=\"%u\" initialization=\"init_%d.mp4\" media=\"seg_%d_$Number$.m4s\" startNumber=\"1\">\n",
+        t->track->timescale, track + 1, track + 1);
+    fprintf(f, "          <SegmentTimeline>\n");
+
+    // Runs of equal durations share an entry.
+    uint32_t k = 0;
+    while (k != t->segment_count) {
+        uint64_t start, duration, next_start, next_duration;
+        mov_segmenter_get_segment_time(segmenter, track, k, &start, &duration);
+        uint32_t repeat = 0;
+        while (k + repeat + 1 != t->segment_count) {
+            mov_segmenter_get_segment_time(segmenter, track, k + repeat + 1, &next_start, &next_duration);
+            if (next_duration != duration) {
+                break;
+            }
+            ++repeat;
+        }
+        if (repeat) {
+            fprintf(f, "            <S t=\"%llu\" d=\"%llu\" r=\"%u\"/>\n", start, duration, repeat);
+        } else {
+            fprintf(f, "            <S t=\"%llu\" d=\"%llu\"/>\n", start, duration);
+        }
+        k += repeat + 1;
+    }
+
+    fprintf(f, "          </SegmentTimeline>\n");
+    fprintf(f, "        </SegmentTemplate>\n");
+    fprintf(f, "      </Representation>\n");
+}
+
+static int write_dash_manifest(mov_segmenter_t *segmenter, const char *path)
+{
+    double duration = 0;
+    for (int i = 0; i != segmenter->track_count; ++i) {
+        uint64_t start, d;
+        if (segmenter->tracks[i].segment_count == 0) {
+            continue;
+        }
+        mov_segmenter_get_segment_time(segmenter, i, segmenter->tracks[i].segment_count - 1, &start, &d);
+        double end = (double)(start + d) / segmenter->tracks[i].track->timescale;
+        duration = end > duration ? end : duration;
+    }
+
+    FILE *f = fopen(path, "w");
+    if (NULL == f) {
+        printf("failed to open: %s\n", path);
+        return -1;
+    }
+
+    fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(f, "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" profiles=\"urn:mpeg:dash:profile:isoff-live:2011\" "
+        "type=\"static\" mediaPresentationDuration=\"PT%.3fS\" minBufferTime=\"PT2S\">\n", duration);
+    fprintf(f, "  <Period>\n");
+    for (int pass = 0; pass != 2; ++pass) {
+        int is_video = pass == 0;
+        int opened = 0;
+        for (int i = 0; i != segmenter->track_count; ++i) {
+            if (segmenter->tracks[i].track->is_video != is_video) {
+                continue;
+            }
+            if (!opened) {
+                fprintf(f, "    <AdaptationSet contentType=\"%s\" mimeType=\"%s\" segmentAlignment=\"true\" startWithSAP=\"1\">\n",
+                    is_video ? "video" : "audio", is_video ? "video/mp4" : "audio/mp4");
+                opened = 1;
+            }
+            write_dash_representation(segmenter, i, f);
+        }
+        if (opened) {
+            fprintf(f, "    </AdaptationSet>\n");
+        }
+    }
+    fprintf(f, "  </Period>\n");
+    fprintf(f, "</MPD>\n");
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static int write_all(mov_segmenter_t *segmenter, const char *dir)
+{
+    int ret = 0;
+    char path[PATH_SIZE];
+
+    for (int i = 0; i != segmenter->track_count && ret == 0; ++i) {
+        snprintf(path, sizeof(path), "%s/init_%d.mp4", dir, i + 1);
+        FILE *f = fopen(path, "wb");
+        if (NULL == f) {
+            printf("failed to open: %s\n", path);
+            return -1;
+        }
+        ret = mov_segmenter_write_init(segmenter, i, f);
+        fclose(f);
+
+        for (uint32_t k = 0; k != segmenter->tracks[i].segment_count && ret == 0; ++k) {
+            snprintf(path, sizeof(path), "%s/seg_%d_%u.m4s", dir, i + 1, k + 1);
+            f = fopen(path, "wb");
+            if (NULL == f) {
+                printf("failed to open: %s\n", path);
+                return -1;
+            }
+            ret = mov_segmenter_write_segment(segmenter, i, k, f);
+            if (fclose(f) != 0) {
+                ret = -1;
+            }
+        }
+
+        if (ret == 0) {
+            snprintf(path, sizeof(path), "%s/track_%d.m3u8", dir, i + 1);
+            ret = write_media_playlist(segmenter, i, path);
+        }
+    }
+
+    if (ret == 0) {
+        snprintf(path, sizeof(path), "%s/master.m3u8", dir);
+        ret = write_master_playlist(segmenter, path);
+    }
+    if (ret == 0) {
+        snprintf(path, sizeof(path), "%s/manifest.mpd", dir);
+        ret = write_dash_manifest(segmenter, path);
+    }
+    printf("%u segments of %d tracks written\n", segmenter->segment_count, segmenter->track_count);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+    uint32_t duration_ms = 6000;
+    int init_track = 0;         // 1-based, to write a single segment.
+    int segment_track = 0;
+    uint32_t segment_index = 0;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-' && argv[arg][1] == '-'; ++arg) {
+        if (0 == strcmp(argv[arg], "--duration") && arg + 1 < argc) {
+            duration_ms = (uint32_t)strtoul(argv[++arg], NULL, 10);
+        } else if (0 == strcmp(argv[arg], "--init") && arg + 1 < argc) {
+            init_track = atoi(argv[++arg]);
+        } else if (0 == strcmp(argv[arg], "--segment") && arg + 2 < argc) {
+            segment_track = atoi(argv[++arg]);
+            segment_index = (uint32_t)strtoul(argv[++arg], NULL, 10);
+        } else {
+            printf("unknown option: %s\n", argv[arg]);
+            return 1;
+        }
+    }
+
+    int single = init_track || segment_track;
+    if (argc - arg < 2) {
+        fprintf(stdout, "Usage: %s [--duration <ms>] <input> <output_dir>\n", argv[0]);
+        fprintf(stdout, "       %s [--duration <ms>] --init <track> | --segment <track> <number> <input> <output>\n", argv[0]);
+        fprintf(stdout, "  Write CMAF segments with HLS (master.m3u8) and DASH (manifest.mpd) playlists,\n");
+        fprintf(stdout, "  or a single one. Tracks and segments are numbered from 1.\n");
+        return 1;
+    }
+
+    mov_ctx_t *ctx = malloc(sizeof(*ctx));
+    memset(ctx, 0, sizeof(*ctx));
+    // Only tables of the segmented tracks are decoded.
+    ctx->lazy = 1;
+
+    mov_segmenter_t segmenter;
+    memset(&segmenter, 0, sizeof(segmenter));
+
+    ret = parse_mov_file(argv[arg], ctx);
+    if (ret != 0) {
+        printf("failed to parse_mov_file\n");
+    } else {
+        ret = mov_segmenter_init(&segmenter, ctx, duration_ms);
+    }
+
+    if (ret == 0 && single) {
+        int track = (init_track ? init_track : segment_track) - 1;
+        FILE *out = NULL;
+        if (track < 0 || track >= segmenter.track_count) {
+            printf("invalid track: %d\n", track + 1);
+            ret = -1;
+        } else if (NULL == (out = fopen(argv[arg + 1], "wb"))) {
+            printf("failed to open: %s\n", argv[arg + 1]);
+            ret = -1;
+        } else if (init_track) {
+            ret = mov_segmenter_write_init(&segmenter, track, out);
+        } else {
+            ret = mov_segmenter_write_segment(&segmenter, track, segment_index - 1, out);
+        }
+        if (out && fclose(out) != 0) {
+            ret = -1;
+        }
+    } else if (ret == 0) {
+        ret = write_all(&segmenter, argv[arg + 1]);
+    }
+
+    mov_segmenter_free(&segmenter);
+    mov_ctx_free(ctx);
+    free(ctx);
+
+    printf("end\n");
+    return ret == 0 ? 0 : 1;
+}
@@ -1,6 +1,20 @@
 #include "read_utils.h"
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define READ_UTILS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#else
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
 
 uint32_t read_int8(FILE *f)
 {
@@ -13,46 +27,51 @@ uint32_t read_int8(FILE *f)
     return v;
 }
 
+// Multi-byte integers are read with one fread.
+static int read_be(FILE *f, uint8_t *data, size_t bytes)
+{
+    size_t ret = fread(data, bytes, 1, f);
+    if (ret != 1) {
+        printf("failed to read int%zu\n", bytes * 8);
+        memset(data, 0, bytes);
+        return -1;
+    }
+    return 0;
+}
+
 uint32_t read_int16(FILE *f)
 {
-    uint32_t v;
-    v = read_int8(f) << 8;
-    v = read_int8(f) | v;
-    return v;
+    uint8_t data[2];
+    read_be(f, data, sizeof(data));
+    return get_int16(data);
 }
 
 uint32_t read_int24(FILE *f)
 {
-    uint32_t v;
-    v = read_int16(f) << 8;
-    v = read_int8(f) | v;
-    return v;
+    uint8_t data[3];
+    read_be(f, data, sizeof(data));
+    return get_int24(data);
 }
 
 uint32_t read_int32(FILE *f)
 {
-    uint32_t v1;
-    uint32_t v2;
-    v1 = read_int16(f);
-    v2 = read_int16(f);
-    return (v1 << 16) | v2;
+    uint8_t data[4];
+    read_be(f, data, sizeof(data));
+    return get_int32(data);
 }
 
 uint64_t read_int48(FILE *f)
 {
-    uint64_t v;
-    v = (uint64_t)read_int16(f) << 32;
-    v |= read_int32(f);
-    return v;
+    uint8_t data[6];
+    read_be(f, data, sizeof(data));
+    return ((uint64_t)get_int16(data) << 32) | get_int32(data + 2);
 }
 
 uint64_t read_int64(FILE *f)
 {
-    uint32_t v1;
-    uint32_t v2;
-    v1 = read_int32(f);
-    v2 = read_int32(f);
-    return ((uint64_t)v1 << 32) | v2;
+    uint8_t data[8];
+    read_be(f, data, sizeof(data));
+    return get_int64(data);
 }
 
 int skip_bytes(FILE *f, int64_t bytes)
@@ -80,3 +99,197 @@ int read_bytes(FILE *f, int64_t bytes, void *dst)
     }
     return 0;
 }
+
+#ifdef READ_UTILS_X86
+// Bit 0: SSSE3, bit 1: AVX2. -1 until detected.
+static int cpu_features = -1;
+
+static int get_cpu_features(void)
+{
+    if (cpu_features >= 0) {
+        return cpu_features;
+    }
+
+    int features = 0;
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    int has_ssse3 = (info[2] >> 9) & 1;
+    int has_osxsave = (info[2] >> 27) & 1;
+    int has_avx = (info[2] >> 28) & 1;
+    if (has_ssse3) {
+        features |= 1;
+    }
+    // AVX state must be enabled by the OS.
+    if (has_osxsave && has_avx && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        if ((info[1] >> 5) & 1) {
+            features |= 2;
+        }
+    }
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        features |= 1;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        features |= 2;
+    }
+#endif
+    cpu_features = features;
+    return features;
+}
+
+TARGET_SSSE3 static size_t swap_int32_ssse3(uint32_t *data, size_t count)
+{
+    const __m128i mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        _mm_storeu_si128((__m128i *)(data + i), _mm_shuffle_epi8(v, mask));
+    }
+    return i;
+}
+
+TARGET_AVX2 static size_t swap_int32_avx2(uint32_t *data, size_t count)
+{
+    const __m256i mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(data + i + 8));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_shuffle_epi8(v0, mask));
+        _mm256_storeu_si256((__m256i *)(data + i + 8), _mm256_shuffle_epi8(v1, mask));
+    }
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_shuffle_epi8(v, mask));
+    }
+    return i;
+}
+
+TARGET_SSSE3 static size_t swap_int64_ssse3(uint64_t *data, size_t count)
+{
+    const __m128i mask = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        _mm_storeu_si128((__m128i *)(data + i), _mm_shuffle_epi8(v, mask));
+    }
+    return i;
+}
+
+TARGET_AVX2 static size_t swap_int64_avx2(uint64_t *data, size_t count)
+{
+    const __m256i mask = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+        7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_shuffle_epi8(v, mask));
+    }
+    return i;
+}
+#endif
+
+void swap_int32_array(uint32_t *data, size_t count)
+{
+    size_t i = 0;
+#ifdef READ_UTILS_X86
+    int features = get_cpu_features();
+    if (features & 2) {
+        i = swap_int32_avx2(data, count);
+    } else if (features & 1) {
+        i = swap_int32_ssse3(data, count);
+    }
+#endif
+    for (; i < count; ++i) {
+        data[i] = get_int32((uint8_t *)(data + i));
+    }
+}
+
+void swap_int64_array(uint64_t *data, size_t count)
+{
+    size_t i = 0;
+#ifdef READ_UTILS_X86
+    int features = get_cpu_features();
+    if (features & 2) {
+        i = swap_int64_avx2(data, count);
+    } else if (features & 1) {
+        i = swap_int64_ssse3(data, count);
+    }
+#endif
+    for (; i < count; ++i) {
+        data[i] = get_int64((uint8_t *)(data + i));
+    }
+}
+
+// Read "bytes" into "dst", zeroing what the file does not have.
+static int read_table(FILE *f, void *dst, size_t bytes)
+{
+    size_t ret = fread(dst, 1, bytes, f);
+    if (ret != bytes) {
+        printf("table truncated. read %zu of %zu bytes\n", ret, bytes);
+        memset((uint8_t *)dst + ret, 0, bytes - ret);
+        return -1;
+    }
+    return 0;
+}
+
+int read_int32_array(FILE *f, uint32_t *dst, uint32_t count)
+{
+    int ret = read_table(f, dst, (size_t)count * sizeof(uint32_t));
+    swap_int32_array(dst, count);
+    return ret;
+}
+
+int read_int64_array(FILE *f, uint64_t *dst, uint32_t count)
+{
+    int ret = read_table(f, dst, (size_t)count * sizeof(uint64_t));
+    swap_int64_array(dst, count);
+    return ret;
+}
+
+// Rows are read in blocks that stay in cache.
+#define READ_BLOCK_INTS 4096
+
+int read_int32_columns(FILE *f, uint32_t **columns, int column_count, uint32_t count)
+{
+    if (column_count == 1) {
+        return read_int32_array(f, columns[0], count);
+    }
+
+    int ret = 0;
+    uint32_t block[READ_BLOCK_INTS];
+    uint32_t rows_per_block = READ_BLOCK_INTS / column_count;
+    for (uint32_t row = 0; row < count; row += rows_per_block) {
+        uint32_t rows = count - row < rows_per_block ? count - row : rows_per_block;
+        if (read_int32_array(f, block, rows * column_count) != 0) {
+            ret = -1;
+        }
+        for (int c = 0; c != column_count; ++c) {
+            uint32_t *column = columns[c] + row;
+            for (uint32_t i = 0; i != rows; ++i) {
+                column[i] = block[i * column_count + c];
+            }
+        }
+    }
+    return ret;
+}
+
+int read_int32_array_to_64(FILE *f, uint64_t *dst, uint32_t count)
+{
+    int ret = 0;
+    uint32_t block[READ_BLOCK_INTS];
+    for (uint32_t i = 0; i < count; i += READ_BLOCK_INTS) {
+        uint32_t n = count - i < READ_BLOCK_INTS ? count - i : READ_BLOCK_INTS;
+        if (read_int32_array(f, block, n) != 0) {
+            ret = -1;
+        }
+        for (uint32_t j = 0; j != n; ++j) {
+            dst[i + j] = block[j];
+        }
+    }
+    return ret;
+}
@@ -15,6 +15,20 @@ uint64_t read_int64(FILE *f);
 int skip_bytes(FILE *f, int64_t bytes);
 int read_bytes(FILE *f, int64_t bytes, void *dst);
 
+// Bulk read of big-endian tables, converted to host order. Rows of
+// "column_count" integers are split into "columns". Missing data of a
+// truncated table reads as 0.
+// @return 0 on success.
+int read_int32_array(FILE *f, uint32_t *dst, uint32_t count);
+int read_int64_array(FILE *f, uint64_t *dst, uint32_t count);
+int read_int32_columns(FILE *f, uint32_t **columns, int column_count, uint32_t count);
+int read_int32_array_to_64(FILE *f, uint64_t *dst, uint32_t count);
+
+// Convert big-endian integers to host order in place. Uses AVX2 or SSSE3
+// when the CPU has it.
+void swap_int32_array(uint32_t *data, size_t count);
+void swap_int64_array(uint64_t *data, size_t count);
+
 // Parse from buffer.
 inline uint8_t get_int8(uint8_t *data) { return data[0]; }
 inline uint16_t get_int16(uint8_t *data) { return (data[0] << 8) + data[1]; }